@@ -0,0 +1,82 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/buffer_pool.h"
+#include "../include/tape.h"
+#include <iostream>
+#include <iomanip>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+// training steps of an mlp with tensor buffers from the heap vs from the buffer pool, then
+// with the pool under a tape, whose arena also takes the graph nodes off the heap: step
+// time, heap allocations per step and the pool's hit rate and footprint
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 300;
+    int batch_size = argc > 2 ? std::atoi(argv[2]) : 64;
+
+    Sequential model({std::make_shared<Linear>(784, 256), std::make_shared<ReLU>(), std::make_shared<Linear>(256, 128),
+                      std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+    auto initial = model.parameters();
+    std::vector<Eigen::MatrixXf> initial_values;
+    for (auto& p : initial) initial_values.push_back(p->data());
+
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    std::mt19937 gen(7);
+    std::vector<int> targets(batch_size);
+    for (auto& t : targets) t = static_cast<int>(gen() % 10);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "buffers   us/step   allocs/step   hit rate   peak pool KiB   final loss" << std::endl;
+
+    for (int mode = 0; mode < 3; mode++) {
+        const bool pooled = mode > 0;
+        const bool taped = mode == 2;
+        auto params = model.parameters();
+        for (size_t i = 0; i < params.size(); i++) params[i]->data() = initial_values[i];
+        SGD optimizer(params, 0.01f);
+        BufferPool::set_enabled(pooled);
+        Tape tape;
+        tape.set_reuse_order(true);
+
+        auto step = [&]() {
+            std::optional<TapeGuard> guard;
+            if (taped) {
+                guard.emplace(tape);
+            }
+            auto loss = model.forward(inputs)->cross_entropy(targets);
+            optimizer.zero_grad();
+            loss->backward();
+            optimizer.step();
+            return loss->data()(0, 0);
+        };
+
+        step(); // warm up, fills the pool
+        BufferPool::reset_stats();
+        float last = 0.0f;
+        auto before = bench::allocation_snapshot();
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            last = step();
+        }
+        double ms = timer.elapsed_ms();
+        auto after = bench::allocation_snapshot();
+        BufferPoolStats stats = BufferPool::stats();
+        std::size_t acquires = stats.hits + stats.misses;
+
+        std::cout << std::left << std::setw(10) << (taped ? "tape+pool" : pooled ? "pool" : "heap") << std::right
+                  << std::setw(7) << ms * 1000.0 / steps
+                  << std::setw(14) << static_cast<double>(after.allocations - before.allocations) / steps
+                  << std::setw(10) << (acquires ? 100.0 * stats.hits / acquires : 0.0) << "%"
+                  << std::setw(16) << stats.peak_bytes / 1024.0
+                  << std::setw(13) << std::setprecision(4) << last << std::setprecision(1) << std::endl;
+    }
+
+    BufferPool::set_enabled(false);
+    BufferPool::trim();
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/checkpoint.h"
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+
+// cold start of an inference process: checkpoint open + load by copy vs. zero-copy map,
+// and the first forward pass afterwards
+
+int main(int argc, char** argv) {
+    int hidden = argc > 1 ? std::atoi(argv[1]) : 4096;
+    std::string path = (std::filesystem::temp_directory_path() / "krykhitgrad-bench.ckpt").string();
+
+    auto make_model = [&]() {
+        return Sequential({std::make_shared<Linear>(784, hidden), std::make_shared<ReLU>(),
+                           std::make_shared<Linear>(hidden, hidden), std::make_shared<ReLU>(),
+                           std::make_shared<Linear>(hidden, 10)});
+    };
+
+    {
+        Sequential model = make_model();
+        bench::Timer timer;
+        Checkpoint::save(path, model.parameters());
+        std::cout << "checkpoint of " << std::filesystem::file_size(path) / (1024.0 * 1024.0) << " MiB, saved in "
+                  << std::fixed << std::setprecision(2) << timer.elapsed_ms() << " ms" << std::endl;
+    }
+
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, 1));
+    std::cout << "load     open+load ms   first forward ms" << std::endl;
+
+    for (bool zero_copy : {false, true}) {
+        Sequential model = make_model();
+        auto params = model.parameters();
+
+        bench::Timer timer;
+        Checkpoint checkpoint(path);
+        if (zero_copy) {
+            checkpoint.map(params);
+        } else {
+            checkpoint.load(params);
+        }
+        double load_ms = timer.elapsed_ms();
+
+        timer.reset();
+        {
+            NoGradGuard no_grad;
+            model.forward(inputs);
+        }
+        double forward_ms = timer.elapsed_ms();
+
+        std::cout << std::left << std::setw(9) << (zero_copy ? "map" : "copy") << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(14) << load_ms << std::setw(19) << forward_ms << std::endl;
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
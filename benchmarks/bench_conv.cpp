@@ -0,0 +1,71 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// conv2d with the im2col + gemm path vs the direct 3x3 / 5x5 kernels on mnist-sized layers:
+// forward and forward + backward time per batch, forward GFLOP/s of each path and the largest
+// difference between their outputs
+
+struct Layer {
+    std::string name;
+    Conv2dShape shape;
+};
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+    int batch_size = argc > 2 ? std::atoi(argv[2]) : 64;
+
+    std::vector<Layer> layers = {
+        {"1->8 28x28 3x3", {1, 28, 28, 8, 3, 1, 1}},
+        {"8->16 14x14 3x3", {8, 14, 14, 16, 3, 1, 1}},
+        {"32->32 14x14 3x3", {32, 14, 14, 32, 3, 1, 1}},
+        {"16->16 28x28 3x3 /2", {16, 28, 28, 16, 3, 2, 1}},
+        {"1->6 28x28 5x5", {1, 28, 28, 6, 5, 1, 0}},
+        {"6->16 12x12 5x5", {6, 12, 12, 16, 5, 1, 0}},
+    };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "layer                  im2col fwd us  direct fwd us  im2col f+b us  direct f+b us"
+                 "  im2col GF/s  direct GF/s   max diff" << std::endl;
+
+    for (const Layer& layer : layers) {
+        const Conv2dShape& s = layer.shape;
+        auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(s.in_features(), batch_size), true);
+        auto w = std::make_shared<Tensor>(Eigen::MatrixXf::Random(s.out_channels, s.patch_size()) * 0.1f, true);
+        auto b = std::make_shared<Tensor>(Eigen::MatrixXf::Random(s.out_channels, 1), true);
+        Eigen::MatrixXf grad_output = Eigen::MatrixXf::Random(s.out_features(), batch_size);
+        const double flops = 2.0 * s.out_features() * s.patch_size() * batch_size;
+
+        auto time = [&](auto&& step) {
+            step(); // warm up
+            bench::Timer timer;
+            for (int i = 0; i < iterations; i++) {
+                step();
+            }
+            return timer.elapsed_ms() * 1000.0 / iterations;
+        };
+
+        double forward_us[2];
+        double step_us[2];
+        Eigen::MatrixXf outputs[2];
+        for (int path = 0; path < 2; path++) {
+            ConvAlgorithm algorithm = path == 0 ? ConvAlgorithm::Im2col : ConvAlgorithm::Direct;
+            forward_us[path] = time([&]() {
+                NoGradGuard no_grad;
+                outputs[path] = x->conv2d(w, b, s, algorithm)->data();
+            });
+            step_us[path] = time([&]() { x->conv2d(w, b, s, algorithm)->backward(grad_output); });
+        }
+
+        std::cout << std::left << std::setw(22) << layer.name << std::right
+                  << std::setw(15) << forward_us[0] << std::setw(15) << forward_us[1]
+                  << std::setw(15) << step_us[0] << std::setw(15) << step_us[1]
+                  << std::setw(13) << flops / forward_us[0] / 1e3 << std::setw(13) << flops / forward_us[1] / 1e3
+                  << std::setw(11) << std::scientific << std::setprecision(1)
+                  << (outputs[0] - outputs[1]).cwiseAbs().maxCoeff() << std::fixed << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/data.h"
+#include "../include/data_loader.h"
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+// time the training loop waits on batch preparation: synchronous get_batch vs the
+// prefetching DataLoader, on a synthetic mnist-shaped idx file
+
+struct Net {
+    Linear fc1{784, 128};
+    Linear fc2{128, 10};
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
+        return fc2.forward(fc1.forward(x, Activation::ReLU));
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() {
+        auto p = fc1.parameters();
+        auto p2 = fc2.parameters();
+        p.insert(p.end(), p2.begin(), p2.end());
+        return p;
+    }
+};
+
+void train_step(Net& net, SGD& optimizer, const std::shared_ptr<Tensor>& inputs, const std::vector<int>& targets) {
+    optimizer.zero_grad();
+    net.forward(inputs)->log_softmax()->nll_loss(targets)->backward();
+    optimizer.step();
+}
+
+int main(int argc, char** argv) {
+    int samples = argc > 1 ? std::atoi(argv[1]) : 20000;
+    int batch_size = argc > 2 ? std::atoi(argv[2]) : 64;
+
+    auto dir = std::filesystem::temp_directory_path();
+    std::string images = (dir / "krykhitgrad-bench-images.idx3-ubyte").string();
+    std::string labels = (dir / "krykhitgrad-bench-labels.idx1-ubyte").string();
+
+    std::mt19937 gen(5);
+    std::vector<unsigned char> pixels(static_cast<std::size_t>(samples) * 784);
+    std::vector<unsigned char> label_bytes(samples);
+    for (auto& p : pixels) {
+        p = static_cast<unsigned char>(gen());
+    }
+    for (auto& l : label_bytes) {
+        l = static_cast<unsigned char>(gen() % 10);
+    }
+    bench::write_idx(images, {0x803, static_cast<uint32_t>(samples), 28, 28}, pixels);
+    bench::write_idx(labels, {0x801, static_cast<uint32_t>(samples)}, label_bytes);
+
+    MNISTDataset dataset(images, labels);
+    int num_batches = dataset.size() / batch_size;
+
+    std::cout << samples << " samples, batch " << batch_size << std::endl;
+    std::cout << "loader          epoch ms   stall ms" << std::endl;
+
+    auto report = [](const std::string& name, double total_ms, double stall_ms) {
+        std::cout << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(11) << total_ms << std::setw(11) << stall_ms << std::endl;
+    };
+
+    {
+        Net net;
+        SGD optimizer(net.parameters(), 0.01f);
+        double stall_ms = 0.0;
+        bench::Timer timer;
+        for (int b = 0; b < num_batches; b++) {
+            bench::Timer wait;
+            auto [inputs, targets] = dataset.get_batch(batch_size, b * batch_size);
+            stall_ms += wait.elapsed_ms();
+            train_step(net, optimizer, inputs, targets);
+        }
+        report("get_batch", timer.elapsed_ms(), stall_ms);
+    }
+
+    for (int prefetch : {0, 2, 4}) {
+        Net net;
+        SGD optimizer(net.parameters(), 0.01f);
+        DataLoader loader(dataset, {.batch_size = batch_size, .drop_last = true, .prefetch = prefetch});
+        bench::Timer timer;
+        while (const auto* batch = loader.next()) {
+            train_step(net, optimizer, batch->inputs, batch->targets);
+        }
+        report("prefetch " + std::to_string(prefetch), timer.elapsed_ms(), loader.stall_ms());
+    }
+
+    std::filesystem::remove(images);
+    std::filesystem::remove(labels);
+    return 0;
+}
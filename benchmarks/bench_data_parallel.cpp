@@ -0,0 +1,77 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/parallel.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <vector>
+
+// samples/sec of a data-parallel mnist-shaped training step for 1..N threads
+
+struct Net {
+    Linear fc1{784, 128};
+    Linear fc2{128, 10};
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
+        return fc2.forward(fc1.forward(x, Activation::ReLU));
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() {
+        auto p = fc1.parameters();
+        auto p2 = fc2.parameters();
+        p.insert(p.end(), p2.begin(), p2.end());
+        return p;
+    }
+};
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 50;
+    int batch_size = argc > 2 ? std::atoi(argv[2]) : 256;
+    int max_threads = argc > 3 ? std::atoi(argv[3]) : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    std::vector<int> targets(batch_size);
+    std::mt19937 gen(3);
+    for (auto& t : targets) {
+        t = static_cast<int>(gen() % 10);
+    }
+
+    auto loss_fn = [](Net& net, std::shared_ptr<Tensor> x, const std::vector<int>& t) {
+        return std::vector<std::shared_ptr<Tensor>>{net.forward(x)->log_softmax()->nll_loss(t)};
+    };
+
+    std::cout << "batch " << batch_size << ", " << steps << " steps" << std::endl;
+    std::cout << "threads   samples/sec   speedup" << std::endl;
+
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    double baseline = 0.0;
+    for (int threads : thread_counts) {
+        Net net;
+        SGD optimizer(net.parameters(), 0.01f);
+        DataParallel<Net> trainer(net, threads, loss_fn);
+
+        trainer.step(inputs, targets); // warm up replicas and tapes
+
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            trainer.step(inputs, targets);
+            optimizer.step();
+        }
+        double rate = steps * batch_size / (timer.elapsed_ms() / 1000.0);
+        if (baseline == 0.0) {
+            baseline = rate;
+        }
+
+        std::cout << std::setw(7) << threads << std::fixed << std::setprecision(1)
+                  << std::setw(14) << rate << std::setw(10) << std::setprecision(2) << rate / baseline << "x" << std::endl;
+    }
+    return 0;
+}
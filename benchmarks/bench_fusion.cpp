@@ -0,0 +1,63 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/lazy.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// forward + backward of a chain of depth pointwise steps h = relu(h + y), as eager ops (a
+// node and a full-size buffer per op) vs one fused lazy expression, on a cache-resident and
+// a memory-bound shape
+
+template <int Depth, typename E>
+auto chain(const E& h, const std::shared_ptr<Tensor>& y) {
+    if constexpr (Depth == 0) {
+        return h;
+    } else {
+        return chain<Depth - 1>(lazy::relu(h + y), y);
+    }
+}
+
+template <int Depth>
+void run(int rows, int cols, int iterations) {
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(rows, cols), true);
+    auto y = std::make_shared<Tensor>(Eigen::MatrixXf::Random(rows, cols), true);
+    Eigen::MatrixXf grad_output = Eigen::MatrixXf::Ones(rows, cols);
+
+    auto time = [&](auto&& forward) {
+        forward()->backward(grad_output); // warm up
+        bench::Timer timer;
+        for (int i = 0; i < iterations; i++) {
+            forward()->backward(grad_output);
+        }
+        return timer.elapsed_ms() * 1000.0 / iterations;
+    };
+
+    double eager = time([&]() {
+        std::shared_ptr<Tensor> h = x;
+        for (int i = 0; i < Depth; i++) {
+            h = h->add(y)->relu();
+        }
+        return h;
+    });
+    double fused = time([&]() { return chain<Depth>(lazy::leaf(x), y).eval(); });
+
+    std::cout << std::setw(11) << (std::to_string(rows) + "x" + std::to_string(cols)) << std::setw(7) << Depth
+              << std::setw(12) << eager << std::setw(12) << fused << std::setw(10) << eager / fused << "x"
+              << std::setw(20) << 2.0 * Depth * rows * cols * sizeof(float) / (1 << 20) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 50;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "      shape  depth    eager us    fused us   speedup   eager temps MiB" << std::endl;
+    for (auto [rows, cols] : {std::pair{256, 256}, std::pair{2048, 1024}}) {
+        run<1>(rows, cols, iterations);
+        run<2>(rows, cols, iterations);
+        run<4>(rows, cols, iterations);
+        run<8>(rows, cols, iterations);
+    }
+    return 0;
+}
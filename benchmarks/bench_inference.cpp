@@ -0,0 +1,66 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+// forward latency and throughput of an mnist-shaped model for batch sizes 1..1024,
+// building the autograd graph vs. inside a NoGradGuard
+
+struct Net {
+    Linear fc1{784, 128};
+    Linear fc2{128, 10};
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
+        return fc2.forward(fc1.forward(x, Activation::ReLU));
+    }
+};
+
+struct Result {
+    double latency_ms;
+    double allocations;
+};
+
+Result run(Net& net, const std::shared_ptr<Tensor>& inputs, int iterations, bool no_grad) {
+    net.forward(inputs); // warm up
+
+    auto before = bench::allocation_snapshot();
+    bench::Timer timer;
+    for (int i = 0; i < iterations; i++) {
+        if (no_grad) {
+            NoGradGuard guard;
+            net.forward(inputs)->log_softmax_();
+        } else {
+            net.forward(inputs)->log_softmax();
+        }
+    }
+    double elapsed = timer.elapsed_ms();
+    auto after = bench::allocation_snapshot();
+    return {elapsed / iterations, static_cast<double>(after.allocations - before.allocations) / iterations};
+}
+
+int main(int argc, char** argv) {
+    int samples = argc > 1 ? std::atoi(argv[1]) : 65536;
+
+    Net net;
+    std::cout << "batch   grad ms  no_grad ms   grad samples/s  no_grad samples/s   grad allocs  no_grad allocs" << std::endl;
+
+    for (int batch_size = 1; batch_size <= 1024; batch_size *= 2) {
+        auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+        int iterations = std::max(10, samples / batch_size);
+
+        Result grad = run(net, inputs, iterations, false);
+        Result no_grad = run(net, inputs, iterations, true);
+
+        std::cout << std::setw(5) << batch_size << std::fixed << std::setprecision(4)
+                  << std::setw(10) << grad.latency_ms << std::setw(12) << no_grad.latency_ms
+                  << std::setprecision(0)
+                  << std::setw(17) << batch_size / (grad.latency_ms / 1000.0)
+                  << std::setw(19) << batch_size / (no_grad.latency_ms / 1000.0)
+                  << std::setprecision(1)
+                  << std::setw(14) << grad.allocations << std::setw(16) << no_grad.allocations << std::endl;
+    }
+    return 0;
+}
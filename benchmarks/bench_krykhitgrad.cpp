@@ -0,0 +1,320 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/tape.h"
+#include "../include/data.h"
+#include "../include/value.h"
+#include "../include/scalar.h"
+#include "../include/value_program.h"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ *microbenchmark suite: every Tensor op forward and backward across shapes,
+ *Value and ScalarTape graph construction and backward, compiled Value programs, MNISTDataset load and get_batch, and
+ *full training steps; run with --benchmark_format=json (or --benchmark_out=
+ *results.json) and diff two runs with google benchmark's tools/compare.py
+ */
+
+namespace {
+
+using OpFn = std::function<std::shared_ptr<Tensor>(const std::vector<std::shared_ptr<Tensor>>&)>;
+
+struct OpCase {
+    std::string name;
+    std::vector<std::pair<int, int>> shapes; // of the inputs
+    double flops;                            // of the forward
+    OpFn op;
+};
+
+std::vector<int> make_targets(int batch_size, int classes) {
+    std::mt19937 gen(7);
+    std::vector<int> targets(batch_size);
+    for (auto& t : targets) t = static_cast<int>(gen() % classes);
+    return targets;
+}
+
+std::vector<std::shared_ptr<Tensor>> make_inputs(const OpCase& c, bool requires_grad) {
+    std::vector<std::shared_ptr<Tensor>> inputs;
+    for (auto [rows, cols] : c.shapes) {
+        inputs.push_back(std::make_shared<Tensor>(Eigen::MatrixXf::Random(rows, cols), requires_grad));
+    }
+    return inputs;
+}
+
+void set_counters(benchmark::State& state, double flops, std::size_t allocations) {
+    state.counters["flops"] = benchmark::Counter(flops, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["allocs"] = benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+}
+
+void op_forward(benchmark::State& state, const OpCase& c) {
+    auto inputs = make_inputs(c, false);
+    NoGradGuard no_grad;
+    auto before = bench::allocation_snapshot();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(c.op(inputs)->data().data());
+    }
+    set_counters(state, c.flops, bench::allocation_snapshot().allocations - before.allocations);
+}
+
+// the graph is built once and its backward closures are re-run from a fixed output grad
+void op_backward(benchmark::State& state, const OpCase& c) {
+    auto inputs = make_inputs(c, true);
+    auto out = c.op(inputs);
+    Eigen::MatrixXf grad_output = Eigen::MatrixXf::Random(out->rows(), out->cols());
+    auto before = bench::allocation_snapshot();
+    for (auto _ : state) {
+        out->backward(grad_output);
+        benchmark::DoNotOptimize(inputs[0]->grad().data());
+    }
+    set_counters(state, 2.0 * c.flops, bench::allocation_snapshot().allocations - before.allocations);
+}
+
+std::vector<OpCase> op_cases() {
+    std::vector<OpCase> cases;
+    // mnist-shaped layers: 784 -> 128 and 128 -> 10, one sample up to a large batch
+    for (int batch : {1, 64, 256}) {
+        for (auto [in, out] : {std::pair{784, 128}, std::pair{128, 10}}) {
+            std::string shape = "/" + std::to_string(out) + "x" + std::to_string(in) + "x" + std::to_string(batch);
+            double gemm = 2.0 * in * out * batch;
+            cases.push_back({"matmul" + shape, {{out, in}, {in, batch}}, gemm,
+                             [](const auto& t) { return t[0]->matmul(t[1]); }});
+            cases.push_back({"linear" + shape, {{in, batch}, {out, in}, {out, 1}}, gemm + 2.0 * out * batch,
+                             [](const auto& t) { return t[0]->linear(t[1], t[2], Activation::ReLU); }});
+        }
+
+        std::string shape = "/128x" + std::to_string(batch);
+        double size = 128.0 * batch;
+        cases.push_back({"add" + shape, {{128, batch}, {128, 1}}, size, [](const auto& t) { return t[0]->add(t[1]); }});
+        cases.push_back({"relu" + shape, {{128, batch}}, size, [](const auto& t) { return t[0]->relu(); }});
+        cases.push_back({"reshape" + shape, {{128, batch}}, 0.0,
+                         [](const auto& t) { return t[0]->reshape(t[0]->cols(), t[0]->rows()); }});
+        cases.push_back({"mse_loss" + shape, {{128, batch}, {128, batch}}, 3.0 * size,
+                         [](const auto& t) { return t[0]->mse_loss(t[1]); }});
+
+        std::string head = "/10x" + std::to_string(batch);
+        double logits = 10.0 * batch;
+        auto targets = std::make_shared<std::vector<int>>(make_targets(batch, 10));
+        cases.push_back({"log_softmax" + head, {{10, batch}}, 4.0 * logits, [](const auto& t) { return t[0]->log_softmax(); }});
+        cases.push_back({"nll_loss" + head, {{10, batch}}, static_cast<double>(batch),
+                         [targets](const auto& t) { return t[0]->nll_loss(*targets); }});
+        cases.push_back({"cross_entropy" + head, {{10, batch}}, 4.0 * logits,
+                         [targets](const auto& t) { return t[0]->cross_entropy(*targets); }});
+    }
+    return cases;
+}
+
+// a neuron over n inputs: tanh(sum(w_i * x_i) + b)
+std::shared_ptr<Value> build_neuron(const std::vector<std::shared_ptr<Value>>& w,
+                                    const std::vector<std::shared_ptr<Value>>& x, const std::shared_ptr<Value>& b) {
+    auto sum = b;
+    for (std::size_t i = 0; i < w.size(); i++) {
+        sum = *sum + (*w[i] * x[i]);
+    }
+    return sum->tanh();
+}
+
+void value_graph(benchmark::State& state, bool backward) {
+    const int n = static_cast<int>(state.range(0));
+    std::vector<std::shared_ptr<Value>> w, x;
+    for (int i = 0; i < n; i++) {
+        w.push_back(std::make_shared<Value>(0.01 * i));
+        x.push_back(std::make_shared<Value>(1.0 - 0.02 * i));
+    }
+    auto b = std::make_shared<Value>(0.5);
+
+    auto before = bench::allocation_snapshot();
+    for (auto _ : state) {
+        auto out = build_neuron(w, x, b);
+        if (backward) {
+            out->backward();
+        }
+        benchmark::DoNotOptimize(out->get_data());
+    }
+    state.SetItemsProcessed(state.iterations() * (2 * n + 1)); // nodes built
+    set_counters(state, 2.0 * n, bench::allocation_snapshot().allocations - before.allocations);
+}
+
+// the neuron compiled once with w, x and b as inputs, then evaluated at new values, one input
+// set per call or `lanes` sets per call
+void value_compiled(benchmark::State& state, int lanes) {
+    const int n = static_cast<int>(state.range(0));
+    std::vector<std::shared_ptr<Value>> w, x, inputs;
+    for (int i = 0; i < n; i++) {
+        w.push_back(std::make_shared<Value>(0.01 * i));
+        x.push_back(std::make_shared<Value>(1.0 - 0.02 * i));
+    }
+    auto b = std::make_shared<Value>(0.5);
+    inputs.insert(inputs.end(), w.begin(), w.end());
+    inputs.insert(inputs.end(), x.begin(), x.end());
+    inputs.push_back(b);
+    ValueProgram program = ValueProgram::compile(build_neuron(w, x, b), inputs);
+
+    Eigen::ArrayXXd sets = Eigen::ArrayXXd::Random(lanes, program.num_inputs());
+    Eigen::VectorXd set = sets.row(0).transpose();
+    auto before = bench::allocation_snapshot();
+    for (auto _ : state) {
+        if (lanes == 1) {
+            benchmark::DoNotOptimize(program.forward(set));
+            program.backward();
+            benchmark::DoNotOptimize(program.grad(0));
+        } else {
+            benchmark::DoNotOptimize(program.forward_lanes(sets).data());
+            benchmark::DoNotOptimize(program.backward_lanes().data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lanes); // input sets evaluated
+    set_counters(state, 2.0 * n * lanes, bench::allocation_snapshot().allocations - before.allocations);
+}
+
+// the same neuron on a ScalarTape, cleared (capacity kept) every iteration
+void scalar_graph(benchmark::State& state, bool backward) {
+    const int n = static_cast<int>(state.range(0));
+    ScalarTape tape;
+    std::vector<double> w, x;
+    for (int i = 0; i < n; i++) {
+        w.push_back(0.01 * i);
+        x.push_back(1.0 - 0.02 * i);
+    }
+
+    auto before = bench::allocation_snapshot();
+    for (auto _ : state) {
+        tape.clear();
+        Scalar sum = tape.leaf(0.5);
+        for (int i = 0; i < n; i++) {
+            sum = sum + tape.leaf(w[i]) * tape.leaf(x[i]);
+        }
+        Scalar out = sum.tanh();
+        if (backward) {
+            tape.backward(out);
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * (2 * n + 1));
+    set_counters(state, 2.0 * n, bench::allocation_snapshot().allocations - before.allocations);
+}
+
+struct SyntheticMnist {
+    std::string images;
+    std::string labels;
+    int samples;
+
+    explicit SyntheticMnist(int samples) : samples(samples) {
+        auto dir = std::filesystem::temp_directory_path();
+        images = (dir / "krykhitgrad-bench-images.idx3-ubyte").string();
+        labels = (dir / "krykhitgrad-bench-labels.idx1-ubyte").string();
+        std::mt19937 gen(7);
+        std::vector<unsigned char> pixels(static_cast<std::size_t>(samples) * 784), label_bytes(samples);
+        for (auto& p : pixels) p = static_cast<unsigned char>(gen());
+        for (auto& l : label_bytes) l = static_cast<unsigned char>(gen() % 10);
+        bench::write_idx(images, {0x803, static_cast<uint32_t>(samples), 28, 28}, pixels);
+        bench::write_idx(labels, {0x801, static_cast<uint32_t>(samples)}, label_bytes);
+    }
+
+    ~SyntheticMnist() {
+        std::filesystem::remove(images);
+        std::filesystem::remove(labels);
+    }
+};
+
+void mnist_load(benchmark::State& state, const SyntheticMnist& data) {
+    for (auto _ : state) {
+        MNISTDataset dataset(data.images, data.labels);
+        benchmark::DoNotOptimize(dataset.image(0));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(data.samples) * 785);
+}
+
+void mnist_get_batch(benchmark::State& state, const MNISTDataset& dataset, Layout layout) {
+    const int batch_size = static_cast<int>(state.range(0));
+    int offset = 0;
+    for (auto _ : state) {
+        auto batch = dataset.get_batch(batch_size, offset, layout);
+        benchmark::DoNotOptimize(batch.first->data().data());
+        offset = (offset + batch_size) % (dataset.size() - batch_size);
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(batch_size) * dataset.image_size());
+}
+
+// forward, cross_entropy, backward and an sgd step of an mnist mlp, eager or on a tape
+void train_step(benchmark::State& state, bool on_tape) {
+    const int batch_size = static_cast<int>(state.range(0));
+    Sequential model({std::make_shared<Linear>(784, 128), std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+    SGD optimizer(model.parameters(), 0.01f);
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    auto targets = make_targets(batch_size, 10);
+
+    Tape tape;
+    tape.set_reuse_order(true);
+    tape.set_plan_memory(true);
+    auto step = [&]() {
+        auto loss = model.forward(inputs)->cross_entropy(targets);
+        optimizer.zero_grad();
+        loss->backward();
+        optimizer.step();
+        benchmark::DoNotOptimize(loss->data()(0, 0));
+    };
+
+    auto before = bench::allocation_snapshot();
+    for (auto _ : state) {
+        if (on_tape) {
+            TapeGuard guard(tape);
+            step();
+        } else {
+            step();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+    double flops = 3.0 * 2.0 * (784.0 * 128 + 128.0 * 10) * batch_size; // forward + two backward gemms per layer
+    set_counters(state, flops, bench::allocation_snapshot().allocations - before.allocations);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    // the cases and the dataset outlive RunSpecifiedBenchmarks, which the lambdas refer to
+    std::vector<OpCase> cases = op_cases();
+    for (const auto& c : cases) {
+        benchmark::RegisterBenchmark(("tensor/forward/" + c.name).c_str(), [&c](benchmark::State& s) { op_forward(s, c); });
+        benchmark::RegisterBenchmark(("tensor/backward/" + c.name).c_str(), [&c](benchmark::State& s) { op_backward(s, c); });
+    }
+
+    benchmark::RegisterBenchmark("value/build", [](benchmark::State& s) { value_graph(s, false); })->Arg(16)->Arg(256);
+    benchmark::RegisterBenchmark("value/build+backward", [](benchmark::State& s) { value_graph(s, true); })->Arg(16)->Arg(256);
+    benchmark::RegisterBenchmark("value/compiled", [](benchmark::State& s) { value_compiled(s, 1); })->Arg(16)->Arg(256);
+    benchmark::RegisterBenchmark("value/compiled_lanes", [](benchmark::State& s) { value_compiled(s, 256); })
+        ->Arg(16)->Arg(256);
+    benchmark::RegisterBenchmark("scalar/build", [](benchmark::State& s) { scalar_graph(s, false); })
+        ->Arg(16)->Arg(256)->Arg(1 << 20);
+    benchmark::RegisterBenchmark("scalar/build+backward", [](benchmark::State& s) { scalar_graph(s, true); })
+        ->Arg(16)->Arg(256)->Arg(1 << 20);
+
+    SyntheticMnist data(4096);
+    MNISTDataset dataset(data.images, data.labels);
+    benchmark::RegisterBenchmark("mnist/load", [&](benchmark::State& s) { mnist_load(s, data); });
+    benchmark::RegisterBenchmark("mnist/get_batch", [&](benchmark::State& s) {
+        mnist_get_batch(s, dataset, Layout::FeatureMajor);
+    })->Arg(64)->Arg(256);
+    benchmark::RegisterBenchmark("mnist/get_batch_batch_major", [&](benchmark::State& s) {
+        mnist_get_batch(s, dataset, Layout::BatchMajor);
+    })->Arg(64)->Arg(256);
+
+    benchmark::RegisterBenchmark("train/step_eager", [](benchmark::State& s) { train_step(s, false); })->Arg(64)->Arg(256);
+    benchmark::RegisterBenchmark("train/step_tape", [](benchmark::State& s) { train_step(s, true); })->Arg(64)->Arg(256);
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+// mnist-shaped training steps and the classifier head alone (log_softmax + nll_loss vs the
+// fused cross_entropy), with feature-major (features x batch) vs batch-major (batch x features) activations
+
+struct Data {
+    std::vector<Eigen::MatrixXf> inputs; // features x batch
+    std::vector<std::vector<int>> targets;
+};
+
+Data make_data(int batches, int batch_size) {
+    Data data;
+    std::mt19937 gen(7);
+    for (int b = 0; b < batches; b++) {
+        data.inputs.push_back(Eigen::MatrixXf::Random(784, batch_size));
+        std::vector<int> t(batch_size);
+        for (auto& v : t) {
+            v = static_cast<int>(gen() % 10);
+        }
+        data.targets.push_back(t);
+    }
+    return data;
+}
+
+std::shared_ptr<Tensor> make_input(const Eigen::MatrixXf& features_by_batch, Layout layout, bool requires_grad) {
+    auto x = layout == Layout::BatchMajor
+                 ? std::make_shared<Tensor>(Eigen::MatrixXf(features_by_batch.transpose()), requires_grad)
+                 : std::make_shared<Tensor>(features_by_batch, requires_grad);
+    x->set_layout(layout);
+    return x;
+}
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 300;
+    const int batch_size = 64;
+    Data data = make_data(16, batch_size);
+
+    Sequential reference({std::make_shared<Linear>(784, 128), std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+    auto initial = reference.parameters();
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << "layout          steps/sec    head/sec   fused/sec    final loss" << std::endl;
+
+    for (Layout layout : {Layout::FeatureMajor, Layout::BatchMajor}) {
+        Sequential model({std::make_shared<Linear>(784, 128), std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+        auto params = model.parameters();
+        for (size_t i = 0; i < params.size(); i++) params[i]->data() = initial[i]->data();
+        SGD optimizer(params, 0.01f);
+
+        std::vector<std::shared_ptr<Tensor>> inputs;
+        for (const auto& x : data.inputs) inputs.push_back(make_input(x, layout, false));
+
+        float last = 0.0f;
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            auto loss = model.forward(inputs[i % inputs.size()])->log_softmax()->nll_loss(data.targets[i % data.targets.size()]);
+            optimizer.zero_grad();
+            loss->backward();
+            optimizer.step();
+            last = loss->data()(0, 0);
+        }
+        double step_rate = steps / (timer.elapsed_ms() / 1000.0);
+
+        // the classifier head on its own: whole-batch reductions, forward and backward
+        auto logits = make_input(Eigen::MatrixXf::Random(10, 256), layout, true);
+        const std::vector<int>& targets = data.targets[0];
+        std::vector<int> head_targets(256);
+        for (int j = 0; j < 256; j++) head_targets[j] = targets[j % targets.size()];
+        const int head_steps = steps * 20;
+        timer.reset();
+        for (int i = 0; i < head_steps; i++) {
+            logits->zero_grad();
+            logits->log_softmax()->nll_loss(head_targets)->backward();
+        }
+        double head_rate = head_steps / (timer.elapsed_ms() / 1000.0);
+
+        timer.reset();
+        for (int i = 0; i < head_steps; i++) {
+            logits->zero_grad();
+            logits->cross_entropy(head_targets)->backward();
+        }
+        double fused_rate = head_steps / (timer.elapsed_ms() / 1000.0);
+
+        std::cout << std::left << std::setw(14) << (layout == Layout::BatchMajor ? "batch-major" : "feature-major")
+                  << std::right << std::setw(12) << step_rate << std::setw(12) << head_rate << std::setw(12) << fused_rate
+                  << std::setw(14) << last << std::endl;
+    }
+
+    return 0;
+}
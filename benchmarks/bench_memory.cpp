@@ -0,0 +1,69 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/tape.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+// peak activation + grad bytes per training step of a deep mlp, on a plain tape
+// vs a memory-planning tape that releases and reuses buffers during backward
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 200;
+    int depth = argc > 2 ? std::atoi(argv[2]) : 8;
+    const int batch_size = 128;
+    const int hidden = 256;
+
+    std::vector<std::shared_ptr<Module>> layers = {std::make_shared<Linear>(784, hidden)};
+    for (int i = 0; i < depth - 1; i++) {
+        layers.push_back(std::make_shared<ReLU>());
+        layers.push_back(i + 2 < depth ? std::make_shared<Linear>(hidden, hidden) : std::make_shared<Linear>(hidden, 10));
+    }
+    Sequential model(layers);
+    auto initial = model.parameters();
+    std::vector<Eigen::MatrixXf> initial_values;
+    for (auto& p : initial) initial_values.push_back(p->data());
+
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    std::mt19937 gen(7);
+    std::vector<int> targets(batch_size);
+    for (auto& t : targets) t = static_cast<int>(gen() % 10);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "tape      peak KiB/step   steps/sec   allocs/step   final loss" << std::endl;
+
+    for (bool plan : {false, true}) {
+        auto params = model.parameters();
+        for (size_t i = 0; i < params.size(); i++) params[i]->data() = initial_values[i];
+        SGD optimizer(params, 0.01f);
+        Tape tape;
+        tape.set_reuse_order(true);
+        tape.set_plan_memory(plan);
+
+        float last = 0.0f;
+        auto before = bench::allocation_snapshot();
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            TapeGuard guard(tape);
+            auto loss = model.forward(inputs)->cross_entropy(targets);
+            optimizer.zero_grad();
+            loss->backward();
+            optimizer.step();
+            last = loss->data()(0, 0);
+        }
+        double ms = timer.elapsed_ms();
+        auto after = bench::allocation_snapshot();
+
+        std::cout << std::left << std::setw(10) << (plan ? "planned" : "plain") << std::right
+                  << std::setw(15) << tape.last_peak_bytes() / 1024.0
+                  << std::setw(12) << steps / (ms / 1000.0)
+                  << std::setw(14) << static_cast<double>(after.allocations - before.allocations) / steps
+                  << std::setw(13) << std::setprecision(4) << last << std::setprecision(1) << std::endl;
+    }
+
+    return 0;
+}
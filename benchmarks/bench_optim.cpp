@@ -0,0 +1,59 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/thread_pool.h"
+#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// microseconds per optimizer step over the parameters of a small mlp, on the caller vs. a thread pool
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 200;
+    int hidden = argc > 2 ? std::atoi(argv[2]) : 1024;
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    Linear fc1(784, hidden);
+    Linear fc2(hidden, 10);
+    auto params = fc1.parameters();
+    auto p2 = fc2.parameters();
+    params.insert(params.end(), p2.begin(), p2.end());
+    std::size_t count = 0;
+    for (auto& p : params) {
+        p->grad().setRandom();
+        count += p->data().size();
+    }
+
+    std::cout << count << " parameters, " << steps << " steps" << std::endl;
+    std::cout << "optimizer        us/step   threads" << std::endl;
+
+    auto run = [&](const std::string& name, Optimizer& optimizer, ThreadPool* pool) {
+        optimizer.set_thread_pool(pool);
+        optimizer.step(); // warm up
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            optimizer.step();
+        }
+        std::cout << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(11) << timer.elapsed_ms() * 1000.0 / steps
+                  << std::setw(10) << (pool ? pool->size() : 1) << std::endl;
+    };
+
+    ThreadPool pool(threads);
+    SGD sgd(params, 1e-6f);
+    SGD nesterov(params, 1e-6f, 0.9f, true);
+    Adam adam(params, 1e-6f);
+    AdamW adamw(params, 1e-6f);
+    for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+        run("sgd", sgd, p);
+        run("sgd nesterov", nesterov, p);
+        run("adam", adam, p);
+        run("adamw", adamw, p);
+    }
+    return 0;
+}
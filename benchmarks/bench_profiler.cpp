@@ -0,0 +1,59 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/tape.h"
+#include "../include/profiler.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+// cost of the op profiler on mnist-shaped training steps, stopped vs started, then the
+// per-op summary of the profiled run and its chrome trace
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 500;
+    std::string trace_path = argc > 2 ? argv[2] : "trace.json";
+    const int batch_size = 64;
+
+    Sequential model({std::make_shared<Linear>(784, 128), std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+    SGD optimizer(model.parameters(), 0.01f);
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    std::mt19937 gen(7);
+    std::vector<int> targets(batch_size);
+    for (auto& t : targets) t = static_cast<int>(gen() % 10);
+
+    Tape tape;
+    tape.set_reuse_order(true);
+    auto run = [&]() {
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            TapeGuard guard(tape);
+            ProfileScope step("step");
+            auto loss = model.forward(inputs)->cross_entropy(targets);
+            optimizer.zero_grad();
+            loss->backward();
+            optimizer.step();
+        }
+        return timer.elapsed_ms() * 1000.0 / steps;
+    };
+
+    Profiler profiler;
+    run(); // warm up
+    double stopped = run();
+    profiler.start();
+    double started = run();
+    profiler.stop();
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "profiler stopped: " << stopped << " us/step" << std::endl;
+    std::cout << "profiler started: " << started << " us/step (" << profiler.events().size() / steps
+              << " events/step)" << std::endl << std::endl;
+    profiler.print_summary(std::cout);
+
+    profiler.write_trace(trace_path);
+    std::cout << std::endl << "trace written to " << trace_path << std::endl;
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/data.h"
+#include "../include/data_loader.h"
+#include "../include/quantize.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+// accuracy and throughput of int8 vs fp32 inference for a trained 784-128-10 mlp; trains on
+// synthetic mnist-shaped data unless mnist train/test idx files are given
+
+// noisy copies of ten random prototype images
+void write_synthetic(const std::string& images, const std::string& labels, int samples, unsigned int seed) {
+    std::mt19937 proto_gen(1);
+    std::vector<std::vector<unsigned char>> prototypes(10, std::vector<unsigned char>(784));
+    for (auto& prototype : prototypes) {
+        for (auto& p : prototype) p = proto_gen() % 4 == 0 ? 255 : 0;
+    }
+
+    std::mt19937 gen(seed);
+    std::vector<unsigned char> pixels, label_bytes;
+    for (int i = 0; i < samples; i++) {
+        int label = static_cast<int>(gen() % 10);
+        for (unsigned char p : prototypes[label]) {
+            pixels.push_back(gen() % 3 == 0 ? static_cast<unsigned char>(gen() % 256) : p);
+        }
+        label_bytes.push_back(static_cast<unsigned char>(label));
+    }
+    bench::write_idx(images, {0x803, static_cast<uint32_t>(samples), 28, 28}, pixels);
+    bench::write_idx(labels, {0x801, static_cast<uint32_t>(samples)}, label_bytes);
+}
+
+float accuracy(const Eigen::MatrixXf& outputs, const std::vector<int>& targets) {
+    int correct = 0;
+    for (int i = 0; i < outputs.cols(); i++) {
+        Eigen::MatrixXf::Index predicted;
+        outputs.col(i).maxCoeff(&predicted);
+        correct += predicted == targets[i];
+    }
+    return 100.0f * correct / outputs.cols();
+}
+
+int main(int argc, char** argv) {
+    auto dir = std::filesystem::temp_directory_path();
+    std::vector<std::string> files;
+    bool synthetic = argc < 5;
+    if (synthetic) {
+        for (const char* name : {"train-images", "train-labels", "test-images", "test-labels"}) {
+            files.push_back((dir / (std::string("krykhitgrad-bench-") + name)).string());
+        }
+        write_synthetic(files[0], files[1], 6000, 2);
+        write_synthetic(files[2], files[3], 1000, 3);
+    } else {
+        files = {argv[1], argv[2], argv[3], argv[4]};
+    }
+
+    MNISTDataset train(files[0], files[1], 10000);
+    MNISTDataset test(files[2], files[3], 1000);
+
+    Sequential model({std::make_shared<Linear>(784, 128), std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+    Adam optimizer(model.parameters(), 1e-3f);
+    DataLoader loader(train, {.batch_size = 64, .seed = 4});
+    for (int epoch = 0; epoch < 2; epoch++) {
+        while (const auto* batch = loader.next()) {
+            optimizer.zero_grad();
+            model.forward(batch->inputs)->log_softmax()->nll_loss(batch->targets)->backward();
+            optimizer.step();
+        }
+    }
+
+    QuantizedSequential quantized(QuantizedSequential::layers_of(model), train);
+
+    auto [inputs, targets] = test.get_batch(test.size(), 0);
+    NoGradGuard no_grad;
+    Eigen::MatrixXf fp32 = model.forward(inputs)->data();
+    Eigen::MatrixXf int8 = quantized.forward(inputs)->data();
+
+    int agree = 0;
+    for (int i = 0; i < fp32.cols(); i++) {
+        Eigen::MatrixXf::Index a, b;
+        fp32.col(i).maxCoeff(&a);
+        int8.col(i).maxCoeff(&b);
+        agree += a == b;
+    }
+
+    std::size_t weight_bytes = 0;
+    for (const auto& layer : quantized.layers()) weight_bytes += layer.weight_bytes();
+
+    std::cout << (synthetic ? "synthetic" : "mnist") << " test set, " << fp32.cols() << " samples" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << "fp32 accuracy " << accuracy(fp32, targets) << "%, int8 accuracy " << accuracy(int8, targets)
+              << "%, top-1 agreement " << 100.0f * agree / fp32.cols() << "%" << std::endl;
+    std::cout << "max |logit error| " << (int8 - fp32).cwiseAbs().maxCoeff()
+              << ", weights " << weight_bytes * 4 / 1024 << " KiB fp32 -> " << weight_bytes / 1024 << " KiB int8" << std::endl;
+
+    std::cout << "batch   fp32 samples/s   int8 samples/s   speedup" << std::endl;
+    for (int batch_size = 1; batch_size <= 256; batch_size *= 4) {
+        auto x = std::make_shared<Tensor>(inputs->data().leftCols(batch_size));
+        int iterations = std::max(20, 20000 / batch_size);
+
+        bench::Timer timer;
+        for (int i = 0; i < iterations; i++) model.forward(x);
+        double fp32_rate = iterations * batch_size / (timer.elapsed_ms() / 1000.0);
+
+        timer.reset();
+        for (int i = 0; i < iterations; i++) quantized.forward(x);
+        double int8_rate = iterations * batch_size / (timer.elapsed_ms() / 1000.0);
+
+        std::cout << std::setw(5) << batch_size << std::setprecision(0) << std::setw(17) << fp32_rate
+                  << std::setw(17) << int8_rate << std::setprecision(2) << std::setw(9) << int8_rate / fp32_rate
+                  << "x" << std::endl;
+    }
+
+    if (synthetic) {
+        for (const auto& file : files) std::filesystem::remove(file);
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+// peak heap bytes per training step of a deep mlp vs the time spent re-running forward,
+// without checkpointing and with every run of k layers checkpointed as one segment
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 20;
+    int depth = argc > 2 ? std::atoi(argv[2]) : 16;
+    const int batch_size = 256;
+    const int hidden = 512;
+
+    std::vector<std::shared_ptr<Module>> layers = {std::make_shared<Linear>(784, hidden)};
+    for (int i = 0; i < depth - 1; i++) {
+        layers.push_back(std::make_shared<ReLU>());
+        layers.push_back(i + 2 < depth ? std::make_shared<Linear>(hidden, hidden) : std::make_shared<Linear>(hidden, 10));
+    }
+    Sequential model(layers);
+    auto initial = model.parameters();
+    std::vector<Eigen::MatrixXf> initial_values;
+    for (auto& p : initial) initial_values.push_back(p->data());
+
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    std::mt19937 gen(7);
+    std::vector<int> targets(batch_size);
+    for (auto& t : targets) t = static_cast<int>(gen() % 10);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "segment   peak KiB/step   steps/sec   final loss" << std::endl;
+
+    for (int segment : {0, depth / 4, 2, 1}) {
+        auto params = model.parameters();
+        for (size_t i = 0; i < params.size(); i++) params[i]->data() = initial_values[i];
+        SGD optimizer(params, 0.01f);
+        model.set_checkpoint_segments(2 * segment); // a linear and its relu per layer
+
+        float last = 0.0f;
+        std::size_t peak = 0;
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            std::size_t base = bench::live_heap_bytes.load();
+            bench::reset_peak_heap();
+            auto loss = model.forward(inputs)->cross_entropy(targets);
+            optimizer.zero_grad();
+            loss->backward();
+            optimizer.step();
+            last = loss->data()(0, 0);
+            peak = std::max(peak, bench::reset_peak_heap() - base);
+        }
+        double ms = timer.elapsed_ms();
+
+        std::cout << std::left << std::setw(10) << (segment ? std::to_string(segment) : "none") << std::right
+                  << std::setw(15) << peak / 1024.0
+                  << std::setw(12) << steps / (ms / 1000.0)
+                  << std::setw(13) << std::setprecision(4) << last << std::setprecision(1) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+// no-grad forward latency of a small mlp for a hand-written forward, Sequential (virtual
+// dispatch over a module list) and StaticSequential (pipeline fixed at compile time)
+
+template <typename Forward>
+double latency_us(Forward&& forward, const std::shared_ptr<Tensor>& inputs, int iterations) {
+    NoGradGuard guard;
+    forward(inputs); // warm up
+    bench::Timer timer;
+    for (int i = 0; i < iterations; i++) {
+        forward(inputs);
+    }
+    return timer.elapsed_ms() * 1000.0 / iterations;
+}
+
+int main(int argc, char** argv) {
+    int samples = argc > 1 ? std::atoi(argv[1]) : 65536;
+
+    auto fc1 = std::make_shared<Linear>(64, 32);
+    auto fc2 = std::make_shared<Linear>(32, 32);
+    auto fc3 = std::make_shared<Linear>(32, 10);
+    Sequential dynamic({fc1, std::make_shared<ReLU>(), fc2, std::make_shared<ReLU>(), fc3});
+    StaticSequential<Linear, ReLU, Linear, ReLU, Linear> fixed(*fc1, ReLU(), *fc2, ReLU(), *fc3);
+    auto by_hand = [&](std::shared_ptr<Tensor> x) {
+        return fc3->forward(fc2->forward(fc1->forward(x, Activation::ReLU), Activation::ReLU));
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "batch    by hand us   Sequential us   StaticSequential us" << std::endl;
+
+    for (int batch_size : {1, 8, 64, 512}) {
+        auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(64, batch_size));
+        int iterations = std::max(100, samples * 4 / batch_size);
+
+        double hand = latency_us(by_hand, inputs, iterations);
+        double seq = latency_us([&](std::shared_ptr<Tensor> x) { return dynamic.forward(x); }, inputs, iterations);
+        double stat = latency_us([&](std::shared_ptr<Tensor> x) { return fixed.forward(x); }, inputs, iterations);
+
+        std::cout << std::setw(5) << batch_size << std::setw(14) << hand << std::setw(16) << seq
+                  << std::setw(22) << stat << std::endl;
+    }
+
+    return 0;
+}
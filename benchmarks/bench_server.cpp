@@ -0,0 +1,60 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/server.h"
+#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+// closed-loop load: every client submits one mnist-shaped sample, waits for its scores and
+// submits the next; per-request latency and throughput with batching off (max batch 1) and on
+
+int main(int argc, char** argv) {
+    int clients = argc > 1 ? std::atoi(argv[1]) : 16;
+    int requests = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+    Sequential model({std::make_shared<Linear>(784, 128), std::make_shared<ReLU>(), std::make_shared<Linear>(128, 10)});
+    Eigen::MatrixXf samples = Eigen::MatrixXf::Random(784, 256);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "max batch   delay us   p50 us   p99 us   requests/sec   mean batch" << std::endl;
+
+    struct Config {
+        int max_batch_size;
+        int delay_us;
+    };
+    for (Config config : {Config{1, 0}, Config{8, 100}, Config{32, 200}, Config{64, 500}}) {
+        InferenceServer server(model, 784, {.max_batch_size = config.max_batch_size,
+                                            .max_delay = std::chrono::microseconds(config.delay_us)});
+
+        std::vector<std::vector<double>> latencies(clients);
+        std::vector<std::thread> threads;
+        bench::Timer timer;
+        for (int c = 0; c < clients; c++) {
+            threads.emplace_back([&, c]() {
+                latencies[c].reserve(requests);
+                for (int i = 0; i < requests; i++) {
+                    bench::Timer request;
+                    server.submit(samples.col((c * requests + i) % samples.cols())).get();
+                    latencies[c].push_back(request.elapsed_ms() * 1000.0);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        double ms = timer.elapsed_ms();
+
+        std::vector<double> all;
+        for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        auto percentile = [&](double p) { return all[static_cast<std::size_t>(p * (all.size() - 1))]; };
+
+        std::cout << std::setw(9) << config.max_batch_size << std::setw(11) << config.delay_us
+                  << std::setw(9) << percentile(0.5) << std::setw(9) << percentile(0.99)
+                  << std::setw(15) << all.size() / (ms / 1000.0)
+                  << std::setw(13) << static_cast<double>(server.requests()) / server.batches() << std::endl;
+    }
+
+    return 0;
+}
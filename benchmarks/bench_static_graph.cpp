@@ -0,0 +1,126 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/tape.h"
+#include "../include/graph.h"
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// mnist-shaped training steps: eager, eager on a tape, and static graph replay
+
+struct Net {
+    Linear fc1{784, 128};
+    Linear fc2{128, 10};
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
+        return fc2.forward(fc1.forward(x, Activation::ReLU));
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() {
+        auto p = fc1.parameters();
+        auto p2 = fc2.parameters();
+        p.insert(p.end(), p2.begin(), p2.end());
+        return p;
+    }
+};
+
+struct Data {
+    std::vector<Eigen::MatrixXf> inputs;
+    std::vector<std::vector<int>> targets;
+};
+
+Data make_data(int batches, int batch_size) {
+    Data data;
+    std::mt19937 gen(7);
+    for (int b = 0; b < batches; b++) {
+        data.inputs.push_back(Eigen::MatrixXf::Random(784, batch_size));
+        std::vector<int> t(batch_size);
+        for (auto& v : t) {
+            v = static_cast<int>(gen() % 10);
+        }
+        data.targets.push_back(t);
+    }
+    return data;
+}
+
+void report(const std::string& name, int steps, double ms, bench::AllocationStats before,
+            bench::AllocationStats after, float loss) {
+    std::cout << std::left << std::setw(8) << name << std::right
+              << std::setw(12) << steps / (ms / 1000.0)
+              << std::setw(14) << static_cast<double>(after.allocations - before.allocations) / steps
+              << std::setw(14) << loss << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 300;
+    const int batch_size = 64;
+    Data data = make_data(16, batch_size);
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << "mode     steps/sec   allocs/step    final loss" << std::endl;
+
+    // every mode starts from the same weights so the final losses must agree
+    Net reference;
+    auto initial = reference.parameters();
+
+    auto run_eager = [&](bool use_tape) {
+        Net net;
+        auto params = net.parameters();
+        for (size_t i = 0; i < params.size(); i++) params[i]->data() = initial[i]->data();
+        SGD optimizer(params, 0.01f);
+        Tape tape;
+        tape.set_reuse_order(true);
+
+        float last = 0.0f;
+        auto before = bench::allocation_snapshot();
+        bench::Timer timer;
+        for (int i = 0; i < steps; i++) {
+            auto step = [&]() {
+                auto inputs = std::make_shared<Tensor>(data.inputs[i % data.inputs.size()]);
+                auto loss = net.forward(inputs)->log_softmax()->nll_loss(data.targets[i % data.targets.size()]);
+                optimizer.zero_grad();
+                loss->backward();
+                optimizer.step();
+                last = loss->data()(0, 0);
+            };
+            if (use_tape) {
+                TapeGuard guard(tape);
+                step();
+            } else {
+                step();
+            }
+        }
+        double ms = timer.elapsed_ms();
+        report(use_tape ? "tape" : "eager", steps, ms, before, bench::allocation_snapshot(), last);
+    };
+
+    run_eager(false);
+    run_eager(true);
+
+    Net net;
+    auto params = net.parameters();
+    for (size_t i = 0; i < params.size(); i++) params[i]->data() = initial[i]->data();
+    SGD optimizer(params, 0.01f);
+
+    auto placeholder = std::make_shared<Tensor>(Eigen::MatrixXf::Zero(784, batch_size));
+    StaticGraph graph = StaticGraph::capture(placeholder, data.targets[0],
+        [&](std::shared_ptr<Tensor> x, const std::vector<int>& t) {
+            return std::vector<std::shared_ptr<Tensor>>{net.forward(x)->log_softmax()->nll_loss(t)};
+        });
+
+    auto before = bench::allocation_snapshot();
+    bench::Timer timer;
+    for (int i = 0; i < steps; i++) {
+        optimizer.zero_grad();
+        graph.replay(data.inputs[i % data.inputs.size()], data.targets[i % data.targets.size()]);
+        optimizer.step();
+    }
+    double ms = timer.elapsed_ms();
+    report("replay", steps, ms, before, bench::allocation_snapshot(), graph.loss());
+
+    return 0;
+}
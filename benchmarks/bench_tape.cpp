@@ -0,0 +1,96 @@
+#include "bench_utils.h"
+#include "../include/tensor.h"
+#include "../include/nn.h"
+#include "../include/optim.h"
+#include "../include/tape.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// mnist-shaped training step on synthetic data, eager vs. tape
+
+struct Net {
+    Linear fc1{784, 128};
+    Linear fc2{128, 10};
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
+        return fc2.forward(fc1.forward(x, Activation::ReLU));
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() {
+        auto p = fc1.parameters();
+        auto p2 = fc2.parameters();
+        p.insert(p.end(), p2.begin(), p2.end());
+        return p;
+    }
+};
+
+struct Result {
+    double allocs_per_step;
+    double bytes_per_step;
+    double ms_per_step;
+};
+
+Result run(bool use_tape, int steps) {
+    Net net;
+    SGD optimizer(net.parameters(), 0.01f);
+    Tape tape;
+    tape.set_reuse_order(true);
+
+    const int batch_size = 64;
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(784, batch_size));
+    std::vector<int> targets(batch_size);
+    std::mt19937 gen(42);
+    for (auto& t : targets) {
+        t = static_cast<int>(gen() % 10);
+    }
+
+    auto step = [&]() {
+        auto outputs = net.forward(inputs);
+        auto loss = outputs->log_softmax()->nll_loss(targets);
+        optimizer.zero_grad();
+        loss->backward();
+        optimizer.step();
+    };
+
+    auto one_step = [&]() {
+        if (use_tape) {
+            TapeGuard guard(tape);
+            step();
+        } else {
+            step();
+        }
+    };
+
+    for (int i = 0; i < 5; i++) {
+        one_step(); // warm up the arena blocks
+    }
+
+    auto before = bench::allocation_snapshot();
+    bench::Timer timer;
+    for (int i = 0; i < steps; i++) {
+        one_step();
+    }
+    double ms = timer.elapsed_ms();
+    auto after = bench::allocation_snapshot();
+
+    return {static_cast<double>(after.allocations - before.allocations) / steps,
+            static_cast<double>(after.bytes - before.bytes) / steps,
+            ms / steps};
+}
+
+int main(int argc, char** argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    Result eager = run(false, steps);
+    Result taped = run(true, steps);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "mode   allocs/step   bytes/step   ms/step" << std::endl;
+    std::cout << "eager  " << std::setw(11) << eager.allocs_per_step << "   " << std::setw(10) << eager.bytes_per_step
+              << "   " << eager.ms_per_step << std::endl;
+    std::cout << "tape   " << std::setw(11) << taped.allocs_per_step << "   " << std::setw(10) << taped.bytes_per_step
+              << "   " << taped.ms_per_step << std::endl;
+    return 0;
+}
@@ -0,0 +1,139 @@
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+ *shared helpers for the benchmark executables; replaces the global
+ *allocation functions, so include it from exactly one file per executable
+ */
+
+namespace bench {
+
+inline std::atomic<std::size_t> allocations{0};
+inline std::atomic<std::size_t> allocated_bytes{0};
+// heap bytes currently allocated and their high-water mark (glibc only)
+inline std::atomic<std::size_t> live_heap_bytes{0};
+inline std::atomic<std::size_t> peak_heap_bytes{0};
+
+struct AllocationStats {
+    std::size_t allocations;
+    std::size_t bytes;
+};
+
+inline AllocationStats allocation_snapshot() {
+    return {allocations.load(std::memory_order_relaxed), allocated_bytes.load(std::memory_order_relaxed)};
+}
+
+inline void add_live(std::size_t bytes) {
+    std::size_t live = live_heap_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    std::size_t peak = peak_heap_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_heap_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+inline void sub_live(std::size_t bytes) {
+    live_heap_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+// restarts the high-water mark at the current live bytes; returns the peak since the last reset
+inline std::size_t reset_peak_heap() {
+    return peak_heap_bytes.exchange(live_heap_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+class Timer {
+private:
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+
+public:
+    void reset() { start_ = std::chrono::steady_clock::now(); }
+
+    double elapsed_ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+    }
+};
+
+// an idx file (the mnist format): big-endian header fields, then the raw payload
+inline void write_idx(const std::string& path, const std::vector<std::uint32_t>& header,
+                      const std::vector<unsigned char>& payload) {
+    std::ofstream file(path, std::ios::binary);
+    for (std::uint32_t field : header) {
+        unsigned char be[4] = {static_cast<unsigned char>(field >> 24), static_cast<unsigned char>(field >> 16),
+                               static_cast<unsigned char>(field >> 8), static_cast<unsigned char>(field)};
+        file.write(reinterpret_cast<char*>(be), 4);
+    }
+    file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+}
+
+} // namespace bench
+
+#if defined(__GLIBC__)
+// interpose the C allocator so eigen's storage (which bypasses operator new) is counted too
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* p, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void* p);
+std::size_t malloc_usable_size(void* p);
+
+static void* counted(void* p, std::size_t size) {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    bench::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (p) {
+        bench::add_live(malloc_usable_size(p));
+    }
+    return p;
+}
+
+void* malloc(std::size_t size) {
+    return counted(__libc_malloc(size), size);
+}
+
+void* calloc(std::size_t count, std::size_t size) {
+    return counted(__libc_calloc(count, size), count * size);
+}
+
+void* realloc(void* p, std::size_t size) {
+    std::size_t old = p ? malloc_usable_size(p) : 0;
+    void* result = __libc_realloc(p, size);
+    if (result || size == 0) {
+        bench::sub_live(old);
+    }
+    return counted(result, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) {
+    return counted(__libc_memalign(alignment, size), size);
+}
+
+void free(void* p) {
+    if (p) {
+        bench::sub_live(malloc_usable_size(p));
+    }
+    __libc_free(p);
+}
+}
+#else
+void* operator new(std::size_t size) {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    bench::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+#endif // BENCH_UTILS_H
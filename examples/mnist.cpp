@@ -2,6 +2,10 @@
 #include "../include/nn.h"
 #include "../include/optim.h"
 #include "../include/data.h"
+#include "../include/data_loader.h"
+#include "../include/parallel.h"
+#include "../include/checkpoint.h"
+#include "../include/profiler.h"
 #include <indicators/progress_bar.hpp>
 #include <indicators/cursor_control.hpp>
 #include <iostream>
@@ -9,6 +13,8 @@
 #include <chrono>
 #include <algorithm>
 #include <vector>
+#include <thread>
+#include <string>
 
 class MNISTNet : public Module {
 private:
@@ -19,9 +25,8 @@ public:
     MNISTNet() : fc1_(784, 128), fc2_(128, 10) {
     }
 
-    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
-        x = fc1_.forward(x);
-        x = x->relu();
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        x = fc1_.forward(x, Activation::ReLU);
         x = fc2_.forward(x);
         return x;
     }
@@ -58,6 +63,8 @@ void save_metrics(const std::vector<float>& train_loss,
 }
 
 float test(MNISTNet& model, const std::string& images_file, const std::string& labels_file) {
+    // evaluation builds no graph and keeps no activations alive
+    NoGradGuard no_grad;
     MNISTDataset test_data(images_file, labels_file, 1000);
     int batch_size = 100;
     int num_batches = (test_data.size() + batch_size - 1) / batch_size;
@@ -84,7 +91,7 @@ float test(MNISTNet& model, const std::string& images_file, const std::string& l
         auto [inputs, targets] = test_data.get_batch(batch_size, batch * batch_size);
         auto outputs = model.forward(inputs);
 
-        const Eigen::MatrixXf& probs = outputs->data();
+        const auto& probs = outputs->data();
         for (int i = 0; i < targets.size(); i++) {
             Eigen::MatrixXf::Index predicted;
             probs.col(i).maxCoeff(&predicted);
@@ -113,20 +120,50 @@ float test(MNISTNet& model, const std::string& images_file, const std::string& l
     return 100.0f * correct / total;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    // --profile <path> profiles the first epoch op by op and writes a chrome trace to path
+    std::string trace_path;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--profile" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--profile trace.json]" << std::endl;
+            return 1;
+        }
+    }
+
     MNISTDataset train_data("../data/mnist/train-images.idx3-ubyte", "../data/mnist/train-labels.idx1-ubyte", 10000);
 
     MNISTNet model;
-    SGD optimizer(model.parameters(), 0.01f);
+    // parameters and grads in one buffer, so the optimizer sweeps them in a single range
+    model.flatten_parameters();
+    Adam optimizer(model.parameters(), 1e-3f);
 
     int num_epochs = 5;
     int batch_size = 64;
-    int num_batches = (train_data.size() + batch_size - 1) / batch_size;
+    // batches are shuffled and assembled on a background thread while the previous step runs
+    DataLoader loader(train_data, {.batch_size = batch_size, .seed = 42});
+    int num_batches = loader.num_batches();
 
     std::vector<float> train_loss_history;
     std::vector<float> train_acc_history;
     std::vector<float> test_acc_history;
 
+    // every core runs forward/backward on a shard of the batch, each with its own tape
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    DataParallel<MNISTNet> trainer(model, num_threads,
+        [](MNISTNet& net, std::shared_ptr<Tensor> x, const std::vector<int>& t) {
+            auto outputs = net.forward(x);
+            return std::vector<std::shared_ptr<Tensor>>{outputs->cross_entropy(t), outputs};
+        });
+
+    // off by default: while it records, every op of every worker goes through its event lock;
+    // open the trace in chrome://tracing or ui.perfetto.dev
+    Profiler profiler;
+    if (!trace_path.empty()) {
+        profiler.start();
+    }
+
     for (int epoch = 0; epoch < num_epochs; epoch++) {
         float epoch_loss = 0.0f;
         int correct = 0;
@@ -146,20 +183,16 @@ int main() {
             indicators::option::MaxProgress{num_batches}
         };
 
-        for (int batch = 0; batch < num_batches; batch++) {
-            auto [inputs, targets] = train_data.get_batch(batch_size, batch * batch_size);
+        while (const auto* batch = loader.next()) {
+            ProfileScope step("step");
+            const auto& targets = batch->targets;
 
-            auto outputs = model.forward(inputs);
-            auto log_probs = outputs->log_softmax();
-            auto loss = log_probs->nll_loss(targets);
-
-            optimizer.zero_grad();
-            loss->backward();
+            float loss = trainer.step(batch->inputs, targets);
             optimizer.step();
 
-            epoch_loss += loss->data()(0, 0);
+            epoch_loss += loss;
 
-            const Eigen::MatrixXf& probs = outputs->data();
+            const Eigen::MatrixXf& probs = trainer.outputs();
             for (int i = 0; i < targets.size(); i++) {
                 Eigen::MatrixXf::Index max_row;
                 probs.col(i).maxCoeff(&max_row);
@@ -167,16 +200,23 @@ int main() {
                 total++;
             }
 
-            bar.set_option(indicators::option::PostfixText{"loss: " + std::to_string(loss->data()(0, 0))});
+            bar.set_option(indicators::option::PostfixText{"loss: " + std::to_string(loss)});
             bar.tick();
         }
 
         indicators::show_console_cursor(true);
 
+        if (epoch == 0 && !trace_path.empty()) {
+            profiler.stop();
+            profiler.print_summary(std::cout);
+            profiler.write_trace(trace_path);
+        }
+
         float train_accuracy = 100.0f * correct / total;
         std::cout << "Epoch " << epoch + 1 << "/" << num_epochs
             << ", Loss: " << epoch_loss / num_batches
-            << ", Train Accuracy: " << train_accuracy << "%" << std::endl;
+            << ", Train Accuracy: " << train_accuracy << "%"
+            << ", Peak step memory: " << trainer.peak_bytes() / 1024 << " KiB" << std::endl;
 
         train_loss_history.push_back(epoch_loss / num_batches);
         train_acc_history.push_back(train_accuracy);
@@ -190,5 +230,8 @@ int main() {
 
     save_metrics(train_loss_history, train_acc_history, test_acc_history);
 
+    // weights and optimizer state; Checkpoint("mnist.ckpt").map(model.parameters()) serves them without a copy
+    Checkpoint::save("mnist.ckpt", model.parameters(), &optimizer);
+
     return 0;
 }
@@ -0,0 +1,47 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <Eigen/Dense>
+
+/*
+ *caching allocator for Tensor storage: while enabled, op outputs and grads
+ *are taken from per-size free lists instead of the heap, and handed back
+ *when their tensor dies, so a training loop whose shapes repeat every step
+ *stops allocating after the first one
+ */
+
+struct BufferPoolStats {
+    std::size_t hits;          // acquires served from a free list
+    std::size_t misses;        // acquires that went to the heap
+    std::size_t bytes_in_use;  // held by live tensors
+    std::size_t bytes_cached;  // sitting in free lists
+    std::size_t peak_bytes;    // high-water mark of in use + cached
+};
+
+// each thread keeps a few buffers per size to itself, without locking; the rest, and a
+// thread's buffers once it exits, go to a shared list, so buffers freed on another thread
+// (a data-parallel worker, the inference server) are still found
+class BufferPool {
+public:
+    // off by default; tensors built while it is on return their buffers to the pool even
+    // if it has been switched off since
+    static void set_enabled(bool enabled);
+    static bool enabled();
+
+    // a rows x cols buffer with unspecified contents
+    static Eigen::MatrixXf acquire(Eigen::Index rows, Eigen::Index cols);
+    // gives back a buffer from acquire(); it is cached unless that would exceed the limit
+    static void release(Eigen::MatrixXf&& buffer);
+
+    // bound on cached bytes across all threads (256 MiB by default); in-use bytes are not limited
+    static void set_max_cached_bytes(std::size_t bytes);
+    // frees the calling thread's cached buffers and the shared ones
+    static void trim();
+
+    static BufferPoolStats stats();
+    // zeroes hits and misses and restarts the peak from the current footprint
+    static void reset_stats();
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,67 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "tensor.h"
+#include "optim.h"
+#include "mapped_file.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ *versioned binary checkpoint: a 64-byte header, a table of tensor shapes
+ *and payload offsets, then float32 column-major payloads aligned to 64
+ *bytes (parameters in order, then optimizer state). loading maps the file
+ *and either copies payloads into tensors or makes tensors views of them
+ */
+
+class Checkpoint {
+public:
+    static constexpr std::uint32_t version = 1;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t num_tensors;
+        std::uint32_t num_state;        // optimizer state buffers
+        std::int32_t steps;             // optimizer step count
+        std::uint64_t state_elements;   // length of each state buffer
+        std::uint64_t state_offset;
+        std::uint8_t reserved[24];
+    };
+
+    struct Entry {
+        std::uint32_t rows;
+        std::uint32_t cols;
+        std::uint64_t offset;
+    };
+
+private:
+    std::shared_ptr<MappedFile> file_;
+    Header header_;
+    std::vector<Entry> entries_;
+
+    const float* payload(std::uint64_t offset) const;
+    void check_parameters(const std::vector<std::shared_ptr<Tensor>>& parameters) const;
+
+public:
+    // writes the parameters in order and, if given, the optimizer state; the file is
+    // written next to path and renamed over it, so a crash never leaves a torn checkpoint
+    static void save(const std::string& path, const std::vector<std::shared_ptr<Tensor>>& parameters,
+                     Optimizer* optimizer = nullptr);
+
+    explicit Checkpoint(const std::string& path);
+
+    int num_tensors() const { return static_cast<int>(header_.num_tensors); }
+    bool has_optimizer_state() const { return header_.num_state > 0; }
+
+    // copies the stored values into the parameters, and the stored state into optimizer if given
+    void load(const std::vector<std::shared_ptr<Tensor>>& parameters, Optimizer* optimizer = nullptr) const;
+
+    // zero-copy load: each parameter becomes a view of its payload, and the mapping lives as long
+    // as any of them; pages are copy-on-write, so updating the weights never touches the file
+    void map(const std::vector<std::shared_ptr<Tensor>>& parameters) const;
+};
+
+#endif // CHECKPOINT_H
@@ -2,22 +2,42 @@
 #define DATA_H
 
 #include "tensor.h"
+#include "mapped_file.h"
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <utility>
 
+/*
+ *idx files are memory-mapped and pixels stay uint8; they are converted
+ *and normalized to float only when a batch is assembled
+ */
+
 class MNISTDataset {
 private:
-    Eigen::MatrixXf images_;
-    std::vector<int> labels_;
+    MappedFile images_file_;
+    MappedFile labels_file_;
+    const std::uint8_t* pixels_ = nullptr;
+    const std::uint8_t* labels_ = nullptr;
+    int num_samples_ = 0;
+    int image_size_ = 0;
 
 public:
     MNISTDataset(const std::string& images_file, const std::string& labels_file, int max_samples = -1);
 
-    int size() const { return labels_.size(); }
+    int size() const { return num_samples_; }
+    int image_size() const { return image_size_; }
+    int label(int index) const { return labels_[index]; }
+    const std::uint8_t* image(int index) const { return pixels_ + static_cast<std::size_t>(index) * image_size_; }
 
+    // inputs are image_size x batch, or batch x image_size for Layout::BatchMajor
     std::pair<std::shared_ptr<Tensor>, std::vector<int>> get_batch(
-        int batch_size, int offset);
+        int batch_size, int offset, Layout layout = Layout::FeatureMajor) const;
 };
 
-#endif // DATA_H
\ No newline at end of file
+// uint8 pixels -> float in [0, 1]; a plain loop the compiler turns into simd
+void normalize_pixels(const std::uint8_t* src, float* dst, std::size_t count);
+// same, into one (strided) row of a batch-major matrix
+void normalize_pixels(const std::uint8_t* src, int count, Eigen::Ref<Eigen::RowVectorXf, 0, Eigen::InnerStride<>> dst);
+
+#endif // DATA_H
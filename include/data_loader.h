@@ -0,0 +1,80 @@
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+
+#include "data.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+ *shuffled minibatches assembled on a producer thread into a bounded ring
+ *of reusable batch buffers, so batch preparation overlaps with compute
+ */
+
+struct DataLoaderOptions {
+    int batch_size = 64;
+    bool shuffle = true;
+    unsigned int seed = 0;  // same seed, same sequence of batches
+    bool drop_last = false; // skip the final partial batch of an epoch
+    int prefetch = 2;       // batches assembled ahead; 0 assembles on the calling thread
+    Layout layout = Layout::FeatureMajor; // of the input batches
+};
+
+class DataLoader {
+public:
+    struct Batch {
+        std::shared_ptr<Tensor> inputs;
+        std::vector<int> targets;
+    };
+
+private:
+    struct Slot {
+        std::shared_ptr<Tensor> full;
+        std::shared_ptr<Tensor> tail; // only for the final partial batch
+        Batch batch;
+    };
+
+    const MNISTDataset& dataset_;
+    DataLoaderOptions options_;
+    int num_batches_ = 0;
+    int tail_size_ = 0;
+
+    std::vector<int> order_; // touched by the producer only
+    std::mt19937 gen_;
+    std::vector<Slot> slots_;
+
+    std::thread producer_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    long long produced_ = 0; // batches written into the ring
+    long long released_ = 0; // batches the consumer is done with
+    bool stop_ = false;
+
+    long long consumed_ = 0; // batches handed out
+    int epoch_position_ = 0;
+    double stall_ms_ = 0.0;
+
+    void fill(Slot& slot, long long index);
+    void produce();
+
+public:
+    DataLoader(const MNISTDataset& dataset, DataLoaderOptions options = {});
+    ~DataLoader();
+
+    DataLoader(const DataLoader&) = delete;
+    DataLoader& operator=(const DataLoader&) = delete;
+
+    int num_batches() const { return num_batches_; }
+
+    // next batch of the current epoch, or nullptr once the epoch is over (the call after
+    // that starts the next epoch); the batch stays valid until the following call
+    const Batch* next();
+
+    // total time next() spent waiting for a batch to be ready
+    double stall_ms() const { return stall_ms_; }
+};
+
+#endif // DATA_LOADER_H
@@ -0,0 +1,110 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "tensor.h"
+#include "kernels.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+/*
+ *static graph mode: capture one forward pass of a fixed-shape model into a
+ *flat instruction list with preallocated buffers, then replay forward and
+ *backward with no allocation and no closure dispatch
+ */
+
+// thread-local hook the Tensor ops report to while a capture is running
+class GraphRecorder {
+public:
+    struct Record {
+        OpCode op;
+        std::shared_ptr<Tensor> a;
+        std::shared_ptr<Tensor> b;
+        std::shared_ptr<Tensor> c;
+        std::shared_ptr<Tensor> out;
+        const std::vector<int>* targets = nullptr;
+        Activation activation = Activation::None;
+        Layout layout = Layout::FeatureMajor; // of the op's first input
+        std::vector<int> target_values;
+    };
+
+private:
+    std::vector<Record> records_;
+    GraphRecorder* previous_;
+
+public:
+    GraphRecorder();
+    ~GraphRecorder();
+
+    GraphRecorder(const GraphRecorder&) = delete;
+    GraphRecorder& operator=(const GraphRecorder&) = delete;
+
+    void record(Record record);
+
+    const std::vector<Record>& records() const { return records_; }
+
+    static GraphRecorder* active();
+};
+
+class StaticGraph {
+public:
+    // returns the loss first, then any other tensors whose values should stay readable after replay
+    using Function = std::function<std::vector<std::shared_ptr<Tensor>>(
+        std::shared_ptr<Tensor> inputs, const std::vector<int>& targets)>;
+
+private:
+    struct Instruction {
+        OpCode op;
+        int a;
+        int b;
+        int c;
+        int out;
+        int targets;
+        Activation activation;
+        Layout layout;
+        int saved; // per-sample values the op keeps for its backward, or -1
+    };
+
+    std::vector<Eigen::MatrixXf> values_;
+    std::vector<Eigen::MatrixXf> grads_;
+    std::vector<std::shared_ptr<Tensor>> params_; // bound parameter per slot, or nullptr
+    std::vector<char> requires_grad_;
+
+    std::vector<Instruction> forward_;
+    std::vector<Instruction> backward_;
+
+    std::vector<std::vector<int>> targets_; // targets_[0] is the targets input
+    int input_slot_ = -1;
+    std::vector<int> outputs_;
+
+    kernels::MatrixRef value(int slot) {
+        return params_[slot] ? kernels::MatrixRef(params_[slot]->data()) : kernels::MatrixRef(values_[slot]);
+    }
+    kernels::MatrixRef grad(int slot) {
+        return params_[slot] ? kernels::MatrixRef(params_[slot]->grad()) : kernels::MatrixRef(grads_[slot]);
+    }
+
+public:
+    // runs fn once eagerly on (inputs, targets) and records every op it issues;
+    // leaves that require grad are bound to the live parameters, others are frozen as constants.
+    // ops without an OpCode (conv2d and the pools, in-place ops, checkpoint, fused lazy
+    // expressions) throw std::runtime_error when fn issues them
+    static StaticGraph capture(std::shared_ptr<Tensor> inputs, const std::vector<int>& targets, const Function& fn);
+
+    // copies in a new batch and runs forward + backward; parameter grads accumulate as in eager mode
+    void replay(const Eigen::MatrixXf& inputs, const std::vector<int>& targets);
+
+    void forward();
+    void backward();
+
+    // batch buffers, can be filled in place before forward()/backward()
+    Eigen::MatrixXf& inputs();
+    std::vector<int>& targets() { return targets_[0]; }
+
+    kernels::ConstMatrixRef output(int index) { return value(outputs_[index]); }
+    float loss() { return output(0)(0, 0); }
+
+    std::size_t num_instructions() const { return forward_.size(); }
+};
+
+#endif // GRAPH_H
@@ -0,0 +1,147 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+
+/*
+ *forward/backward math of every Tensor op, writing into preallocated
+ *outputs; shared by the eager closures and by StaticGraph replay so the
+ *two paths give bit-identical results
+ */
+
+enum class OpCode {
+    Matmul,
+    Add,
+    Relu,
+    LogSoftmax,
+    MseLoss,
+    NllLoss,
+    Reshape,
+    Linear,
+    CrossEntropy,
+};
+
+enum class Activation {
+    None,
+    ReLU,
+};
+
+// which axis of an activation matrix is the batch: FeatureMajor is features x batch
+// (one sample per column), BatchMajor is batch x features (one sample per row), so
+// per-sample reductions over features run down contiguous columns for the whole batch
+enum class Layout {
+    FeatureMajor,
+    BatchMajor,
+};
+
+// how conv2d is computed: Im2col unfolds the receptive fields of an image into a matrix and
+// runs one gemm per sample, Direct slides a 3x3 or 5x5 filter held in registers over the image
+// rows; Auto picks Direct for those sizes at unit stride and Im2col otherwise
+enum class ConvAlgorithm {
+    Auto,
+    Im2col,
+    Direct,
+};
+
+// geometry of a conv2d or pool2d over FeatureMajor image batches: each column is one image of
+// channels x height x width, stored channel by channel and row-major within a channel; pooling
+// keeps the channels (out_channels == channels) and takes no padding
+struct Conv2dShape {
+    int channels;
+    int height;
+    int width;
+    int out_channels;
+    int kernel;
+    int stride = 1;
+    int padding = 0;
+
+    int out_height() const { return (height + 2 * padding - kernel) / stride + 1; }
+    int out_width() const { return (width + 2 * padding - kernel) / stride + 1; }
+    int in_features() const { return channels * height * width; }
+    int out_features() const { return out_channels * out_height() * out_width(); }
+    int patch_size() const { return channels * kernel * kernel; }
+};
+
+const char* op_name(OpCode op);
+
+namespace kernels {
+
+using ConstMatrixRef = Eigen::Ref<const Eigen::MatrixXf>;
+using MatrixRef = Eigen::Ref<Eigen::MatrixXf>;
+
+void matmul(ConstMatrixRef a, ConstMatrixRef b, MatrixRef out);
+void matmul_backward_a(ConstMatrixRef grad_out, ConstMatrixRef b, MatrixRef grad_a);
+void matmul_backward_b(ConstMatrixRef a, ConstMatrixRef grad_out, MatrixRef grad_b);
+
+// b may be a single column broadcast over the columns of a, or a single row broadcast over its rows
+void add(ConstMatrixRef a, ConstMatrixRef b, MatrixRef out);
+// sums grad_out over columns (rows) when grad_x is a broadcast column (row)
+void add_backward(ConstMatrixRef grad_out, MatrixRef grad_x);
+
+void relu(ConstMatrixRef x, MatrixRef out);
+void relu_backward(ConstMatrixRef x, ConstMatrixRef grad_out, MatrixRef grad_x);
+
+// the per-sample reductions below work on the whole batch at once, never sample by sample
+void log_softmax(ConstMatrixRef x, Layout layout, MatrixRef out);
+void log_softmax_backward(ConstMatrixRef out, ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x);
+
+// mean over the batch of the per-sample squared error
+void mse_loss(ConstMatrixRef x, ConstMatrixRef target, Layout layout, MatrixRef out);
+void mse_loss_backward(ConstMatrixRef x, ConstMatrixRef target, ConstMatrixRef grad_out, Layout layout,
+                       MatrixRef grad_x);
+
+void nll_loss(ConstMatrixRef x, const int* target, Layout layout, MatrixRef out);
+void nll_loss_backward(const int* target, ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x);
+
+// log_softmax + nll_loss in one op: out = mean over the batch of log_sum_exp - x[target], where
+// the per-sample log-sum-exp is written to log_sum_exp (batch x 1) and kept for the backward
+void cross_entropy(ConstMatrixRef x, const int* target, Layout layout, MatrixRef log_sum_exp, MatrixRef out);
+// grad_x += (softmax - onehot) * grad_out / batch, with softmax recomputed from x and log_sum_exp
+void cross_entropy_backward(ConstMatrixRef x, const int* target, ConstMatrixRef log_sum_exp,
+                            ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x);
+
+// out = act(w * x + b) in one pass after the gemm, w is out x in and b an out x 1 column
+// broadcast over the batch; BatchMajor computes out = act(x * w^T + b^T) instead
+void linear(ConstMatrixRef w, ConstMatrixRef x, ConstMatrixRef b, Activation act, Layout layout, MatrixRef out);
+// backward of linear: mask grad_out into grad_pre with activation_backward (grad_pre may be
+// grad_out itself), then dw via linear_backward_weight, db via bias_backward and dx via
+// linear_backward_input, all from grad_pre
+void activation_backward(ConstMatrixRef out, Activation act, ConstMatrixRef grad_out, MatrixRef grad_pre);
+void linear_backward_weight(ConstMatrixRef grad_out, ConstMatrixRef x, Layout layout, MatrixRef grad_w);
+void linear_backward_input(ConstMatrixRef w, ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x);
+void bias_backward(ConstMatrixRef grad_out, Layout layout, MatrixRef grad_b);
+
+// the algorithm Auto stands for on this shape
+ConvAlgorithm conv2d_algorithm(ConvAlgorithm algorithm, const Conv2dShape& shape);
+// out = w (*) x + b over a batch of images x (in_features x batch): w is out_channels x patch_size,
+// each row a filter laid out like an image patch, b an out_channels x 1 column and out is
+// out_features x batch; Direct throws for kernels other than 3x3 and 5x5
+void conv2d(ConstMatrixRef x, ConstMatrixRef w, ConstMatrixRef b, const Conv2dShape& shape,
+            ConvAlgorithm algorithm, MatrixRef out);
+void conv2d_backward_weight(ConstMatrixRef x, ConstMatrixRef grad_out, const Conv2dShape& shape,
+                            ConvAlgorithm algorithm, MatrixRef grad_w);
+void conv2d_backward_input(ConstMatrixRef w, ConstMatrixRef grad_out, const Conv2dShape& shape,
+                           ConvAlgorithm algorithm, MatrixRef grad_x);
+void conv2d_backward_bias(ConstMatrixRef grad_out, const Conv2dShape& shape, MatrixRef grad_b);
+
+// max over every kernel x kernel window, stride apart, of each channel; argmax gets, per element
+// of out, the row of x the max came from, which is all the backward needs
+void max_pool2d(ConstMatrixRef x, const Conv2dShape& shape, MatrixRef out, int* argmax);
+void max_pool2d_backward(const int* argmax, ConstMatrixRef grad_out, MatrixRef grad_x);
+void avg_pool2d(ConstMatrixRef x, const Conv2dShape& shape, MatrixRef out);
+void avg_pool2d_backward(ConstMatrixRef grad_out, const Conv2dShape& shape, MatrixRef grad_x);
+
+void reshape(ConstMatrixRef x, MatrixRef out);
+void reshape_backward(ConstMatrixRef grad_out, MatrixRef grad_x);
+
+// int8 x int8 -> int32 gemm for quantized inference: out(o, b) = w row o . x column b, with w
+// row-major (rows x depth) and x and out column-major; w holds int8 values already sign-extended
+// to int16, the width sse2 multiplies at, so callers widen their weights once up front
+void gemm_s8(const std::int16_t* w, const std::int8_t* x, int rows, int depth, int cols, std::int32_t* out);
+// out = x * inv_scale rounded to nearest and saturated to [-127, 127], with NaN mapped to 0
+void quantize_s8(const float* x, float inv_scale, std::size_t n, std::int8_t* out);
+
+} // namespace kernels
+
+#endif // KERNELS_H
@@ -0,0 +1,345 @@
+#ifndef LAZY_H
+#define LAZY_H
+
+#include "tensor.h"
+#include "graph.h"
+#include "profiler.h"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ *lazy elementwise fusion: +, -, *, relu, sigmoid and tanh on lazy::leaf()
+ *tensors build an expression template instead of a node per op; it becomes
+ *one graph node when materialized (explicitly, or implicitly where a Tensor
+ *is expected, e.g. as a matmul operand), evaluated in one vectorized loop
+ *forward and one backward, with no full-size intermediate buffers
+ */
+
+namespace lazy {
+
+// the backward walks the elements in blocks this long: every node recomputes its block of
+// values and passes its block of grads down, all within l1
+constexpr Eigen::Index block_size = 256;
+using Block = Eigen::Array<float, block_size, 1>;
+
+template <typename Derived>
+class Expression;
+
+template <typename T>
+constexpr bool is_expression = std::is_base_of_v<Expression<T>, T>;
+
+template <typename E>
+std::shared_ptr<Tensor> materialize(const Expression<E>& expression);
+
+// every node provides rows(), cols(), leaves(out), flops (its per-element cost) and
+//  value(): the whole expression as one eigen array expression over the leaves, for the forward
+//  forward_block(start, n): computes the node's values for elements [start, start + n)
+//  block(start, n): those values, as left by forward_block
+//  backward_block(start, n, grad): adds grad * d(node)/d(leaf) into the leaves that require grad
+template <typename Derived>
+class Expression {
+public:
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+    std::shared_ptr<Tensor> eval() const { return materialize(*this); }
+    operator std::shared_ptr<Tensor>() const { return eval(); }
+};
+
+class Leaf : public Expression<Leaf> {
+private:
+    std::shared_ptr<Tensor> tensor_;
+
+public:
+    static constexpr int flops = 0;
+
+    explicit Leaf(std::shared_ptr<Tensor> tensor) : tensor_(std::move(tensor)) {}
+
+    Eigen::Index rows() const { return tensor_->rows(); }
+    Eigen::Index cols() const { return tensor_->cols(); }
+    auto value() const { return Eigen::Map<const Eigen::ArrayXXf>(tensor_->data().data(), rows(), cols()); }
+
+    void forward_block(Eigen::Index, Eigen::Index) const {}
+    auto block(Eigen::Index start, Eigen::Index n) const {
+        return Eigen::Map<const Eigen::ArrayXf>(tensor_->data().data() + start, n);
+    }
+    template <typename G>
+    void backward_block(Eigen::Index start, Eigen::Index n, const G& grad) const {
+        if (tensor_->requires_grad()) {
+            Eigen::Map<Eigen::ArrayXf>(tensor_->grad().data() + start, n) += grad;
+        }
+    }
+
+    void leaves(std::vector<std::shared_ptr<Tensor>>& out) const { out.push_back(tensor_); }
+};
+
+// a float broadcast to the shape of the expression it is combined with
+class Constant : public Expression<Constant> {
+private:
+    float value_;
+    Eigen::Index rows_;
+    Eigen::Index cols_;
+
+public:
+    static constexpr int flops = 0;
+
+    Constant(float value, Eigen::Index rows, Eigen::Index cols) : value_(value), rows_(rows), cols_(cols) {}
+
+    Eigen::Index rows() const { return rows_; }
+    Eigen::Index cols() const { return cols_; }
+    auto value() const { return Eigen::ArrayXXf::Constant(rows_, cols_, value_); }
+
+    void forward_block(Eigen::Index, Eigen::Index) const {}
+    auto block(Eigen::Index, Eigen::Index n) const { return Eigen::ArrayXf::Constant(n, value_); }
+    template <typename G>
+    void backward_block(Eigen::Index, Eigen::Index, const G&) const {}
+
+    void leaves(std::vector<std::shared_ptr<Tensor>>&) const {}
+};
+
+// an op node's block of values and of grads
+class Scratch {
+protected:
+    mutable Block values_;
+    mutable Block grads_;
+
+public:
+    auto block(Eigen::Index, Eigen::Index n) const { return values_.head(n); }
+};
+
+template <typename L, typename R>
+class Binary : public Scratch {
+protected:
+    L lhs_;
+    R rhs_;
+
+public:
+    Binary(L lhs, R rhs) : lhs_(std::move(lhs)), rhs_(std::move(rhs)) {
+        if (lhs_.rows() != rhs_.rows() || lhs_.cols() != rhs_.cols()) {
+            throw std::runtime_error("lazy: elementwise operands differ in shape (broadcast with Tensor::add)");
+        }
+    }
+
+    Eigen::Index rows() const { return lhs_.rows(); }
+    Eigen::Index cols() const { return lhs_.cols(); }
+
+    void leaves(std::vector<std::shared_ptr<Tensor>>& out) const {
+        lhs_.leaves(out);
+        rhs_.leaves(out);
+    }
+};
+
+template <typename L, typename R>
+class Sum : public Expression<Sum<L, R>>, public Binary<L, R> {
+public:
+    static constexpr int flops = L::flops + R::flops + 1;
+
+    using Binary<L, R>::Binary;
+
+    auto value() const { return this->lhs_.value() + this->rhs_.value(); }
+
+    void forward_block(Eigen::Index start, Eigen::Index n) const {
+        this->lhs_.forward_block(start, n);
+        this->rhs_.forward_block(start, n);
+        this->values_.head(n) = this->lhs_.block(start, n) + this->rhs_.block(start, n);
+    }
+
+    template <typename G>
+    void backward_block(Eigen::Index start, Eigen::Index n, const G& grad) const {
+        this->grads_.head(n) = grad;
+        this->lhs_.backward_block(start, n, this->grads_.head(n));
+        this->rhs_.backward_block(start, n, this->grads_.head(n));
+    }
+};
+
+template <typename L, typename R>
+class Product : public Expression<Product<L, R>>, public Binary<L, R> {
+public:
+    static constexpr int flops = L::flops + R::flops + 1;
+
+    using Binary<L, R>::Binary;
+
+    auto value() const { return this->lhs_.value() * this->rhs_.value(); }
+
+    void forward_block(Eigen::Index start, Eigen::Index n) const {
+        this->lhs_.forward_block(start, n);
+        this->rhs_.forward_block(start, n);
+        this->values_.head(n) = this->lhs_.block(start, n) * this->rhs_.block(start, n);
+    }
+
+    template <typename G>
+    void backward_block(Eigen::Index start, Eigen::Index n, const G& grad) const {
+        this->grads_.head(n) = grad;
+        this->lhs_.backward_block(start, n, this->grads_.head(n) * this->rhs_.block(start, n));
+        this->rhs_.backward_block(start, n, this->grads_.head(n) * this->lhs_.block(start, n));
+    }
+};
+
+// pointwise functions: value(x), and derivative(x, y) given the input x and the output y
+struct ReluFn {
+    static constexpr int flops = 1;
+    template <typename X> static auto value(const X& x) { return x.max(0.0f); }
+    template <typename X, typename Y> static auto derivative(const X& x, const Y&) {
+        return (x > 0.0f).template cast<float>();
+    }
+};
+
+struct SigmoidFn {
+    static constexpr int flops = 4;
+    template <typename X> static auto value(const X& x) { return x.logistic(); }
+    template <typename X, typename Y> static auto derivative(const X&, const Y& y) { return y * (1.0f - y); }
+};
+
+struct TanhFn {
+    static constexpr int flops = 4;
+    template <typename X> static auto value(const X& x) { return x.tanh(); }
+    template <typename X, typename Y> static auto derivative(const X&, const Y& y) { return 1.0f - y.square(); }
+};
+
+template <typename Fn, typename E>
+class Unary : public Expression<Unary<Fn, E>>, public Scratch {
+private:
+    E input_;
+
+public:
+    static constexpr int flops = E::flops + Fn::flops;
+
+    explicit Unary(E input) : input_(std::move(input)) {}
+
+    Eigen::Index rows() const { return input_.rows(); }
+    Eigen::Index cols() const { return input_.cols(); }
+    auto value() const { return Fn::value(input_.value()); }
+
+    void forward_block(Eigen::Index start, Eigen::Index n) const {
+        input_.forward_block(start, n);
+        values_.head(n) = Fn::value(input_.block(start, n));
+    }
+
+    template <typename G>
+    void backward_block(Eigen::Index start, Eigen::Index n, const G& grad) const {
+        grads_.head(n) = grad * Fn::derivative(input_.block(start, n), values_.head(n));
+        input_.backward_block(start, n, grads_.head(n));
+    }
+
+    void leaves(std::vector<std::shared_ptr<Tensor>>& out) const { input_.leaves(out); }
+};
+
+inline Leaf leaf(std::shared_ptr<Tensor> tensor) {
+    return Leaf(std::move(tensor));
+}
+
+// operands of the operators below: expressions, tensors and floats, with at least one expression
+template <typename T>
+constexpr bool is_operand = is_expression<T> || std::is_same_v<T, std::shared_ptr<Tensor>> || std::is_arithmetic_v<T>;
+
+template <typename L, typename R>
+concept Operands = is_operand<L> && is_operand<R> && (is_expression<L> || is_expression<R>);
+
+template <typename T, typename Like>
+auto as_expression(const T& operand, const Like& like) {
+    if constexpr (is_expression<T>) {
+        return operand;
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        return Constant(static_cast<float>(operand), like.rows(), like.cols());
+    } else {
+        return Leaf(operand);
+    }
+}
+
+template <typename L, typename R>
+auto operands(const L& lhs, const R& rhs) {
+    if constexpr (is_expression<L>) {
+        return std::pair(lhs, as_expression(rhs, lhs));
+    } else {
+        return std::pair(as_expression(lhs, rhs), rhs);
+    }
+}
+
+template <typename L, typename R> requires Operands<L, R>
+auto operator+(const L& lhs, const R& rhs) {
+    auto [a, b] = operands(lhs, rhs);
+    return Sum<decltype(a), decltype(b)>(a, b);
+}
+
+template <typename L, typename R> requires Operands<L, R>
+auto operator*(const L& lhs, const R& rhs) {
+    auto [a, b] = operands(lhs, rhs);
+    return Product<decltype(a), decltype(b)>(a, b);
+}
+
+template <typename L, typename R> requires Operands<L, R>
+auto operator-(const L& lhs, const R& rhs) {
+    auto [a, b] = operands(lhs, rhs);
+    return a + b * -1.0f;
+}
+
+template <typename E> requires is_expression<E>
+auto relu(const E& x) {
+    return Unary<ReluFn, E>(x);
+}
+
+template <typename E> requires is_expression<E>
+auto sigmoid(const E& x) {
+    return Unary<SigmoidFn, E>(x);
+}
+
+template <typename E> requires is_expression<E>
+auto tanh(const E& x) {
+    return Unary<TanhFn, E>(x);
+}
+
+// one node for the whole expression, built on the same buffers, tape and grad mode rules as
+// every other op; its parents are the expression's leaves
+template <typename E>
+std::shared_ptr<Tensor> materialize(const Expression<E>& expression) {
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("lazy: fused elementwise expressions cannot be captured into a static graph");
+    }
+    const E& expr = expression.derived();
+    ProfileScope profile("fused_elementwise", ProfilePhase::Forward);
+
+    std::vector<std::shared_ptr<Tensor>> inputs;
+    expr.leaves(inputs);
+    bool requires_grad = false;
+    Layout layout = Layout::FeatureMajor;
+    for (const auto& input : inputs) {
+        requires_grad = requires_grad || input->requires_grad();
+        layout = input->layout() == Layout::BatchMajor ? input->layout() : layout;
+    }
+    requires_grad = requires_grad && grad_enabled();
+
+    auto out = Tensor::make_result(expr.rows(), expr.cols(), requires_grad);
+    Eigen::Map<Eigen::ArrayXXf>(out->data_.data(), expr.rows(), expr.cols()) = expr.value();
+    out->layout_ = layout;
+
+    if (requires_grad) {
+        std::sort(inputs.begin(), inputs.end());
+        inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
+        out->prev_.assign(inputs.begin(), inputs.end());
+        out->op_ = "fused_elementwise";
+
+        // the values are recomputed block by block rather than kept from the forward
+        out->set_backward([expr, out=out.get()]() {
+            const Eigen::Index size = out->data_.size();
+            for (Eigen::Index start = 0; start < size; start += block_size) {
+                const Eigen::Index n = std::min(block_size, size - start);
+                expr.forward_block(start, n);
+                expr.backward_block(start, n, Eigen::Map<const Eigen::ArrayXf>(out->grad_.data() + start, n));
+            }
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(static_cast<double>(E::flops) * out->data_.size(),
+                         (out->data_.size() + out->grad_.size()) * sizeof(float), {{out->rows(), out->cols()}});
+    }
+    return out;
+}
+
+} // namespace lazy
+
+#endif // LAZY_H
@@ -0,0 +1,40 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ *read-only memory-mapped file; pages are loaded lazily by the os.
+ *on platforms without mmap the file is read into memory instead
+ */
+
+class MappedFile {
+private:
+    unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    bool writable_ = false;
+    std::vector<unsigned char> buffer_; // fallback storage when mmap is unavailable
+
+    void release();
+
+public:
+    MappedFile() = default;
+    // copy_on_write makes the mapping writable; written pages become private
+    // copies, so the file itself is never modified
+    explicit MappedFile(const std::string& path, bool copy_on_write = false);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return data_; }
+    unsigned char* mutable_data();
+    std::size_t size() const { return size_; }
+};
+
+#endif // MAPPED_FILE_H
@@ -2,6 +2,10 @@
 #define NN_H
 
 #include "tensor.h"
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 #include <memory>
 
@@ -9,20 +13,64 @@
  *this is nn library built on top of engine
  */
 
+// parameters and gradients packed back to back in two aligned buffers; the
+// parameter tensors become views into them, so whole-model sweeps are linear
+class ParameterBuffer {
+public:
+    using Vector = Eigen::Map<Eigen::VectorXf, Eigen::Aligned64>;
+
+private:
+    std::shared_ptr<float> data_;
+    std::shared_ptr<float> grad_;
+    std::size_t size_ = 0;
+
+public:
+    explicit ParameterBuffer(const std::vector<std::shared_ptr<Tensor>>& parameters);
+
+    std::size_t size() const { return size_; }
+    Vector data() { return Vector(data_.get(), size_); }
+    Vector grad() { return Vector(grad_.get(), size_); }
+
+    void zero_grad() { grad().setZero(); }
+
+    // scales the grads so their global l2 norm is at most max_norm, returns the norm before scaling
+    float clip_grad_norm(float max_norm);
+};
+
 class Module {
+private:
+    std::shared_ptr<ParameterBuffer> flat_;
+
 public:
+    virtual std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) = 0;
     virtual std::vector<std::shared_ptr<Tensor>> parameters() = 0;
 
+    // packs every parameter of the module into one ParameterBuffer; call before
+    // handing parameters() to an optimizer so it can sweep them as one range
+    ParameterBuffer& flatten_parameters() {
+        flat_ = std::make_shared<ParameterBuffer>(parameters());
+        return *flat_;
+    }
+
+    // nullptr unless flatten_parameters() was called
+    ParameterBuffer* flat_parameters() const { return flat_.get(); }
+
     void zero_grad() {
+        if (flat_) {
+            flat_->zero_grad();
+            return;
+        }
         for (auto& p : parameters()) {
             p->zero_grad();
         }
     }
 
+    float clip_grad_norm(float max_norm);
+
     virtual ~Module() = default;
 };
 
-class Linear : public Module {
+class Linear final : public Module {
 private:
     std::shared_ptr<Tensor> weight_;
     std::shared_ptr<Tensor> bias_;
@@ -32,36 +80,199 @@ private:
 public:
     Linear(int in_features, int out_features);
 
-    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x);
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override;
+    // act is fused into the same kernel, e.g. forward(x, Activation::ReLU) instead of forward(x)->relu()
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x, Activation act);
 
     std::vector<std::shared_ptr<Tensor>> parameters() override {
         return {weight_, bias_};
     }
+
+    const std::shared_ptr<Tensor>& weight() const { return weight_; }
+    const std::shared_ptr<Tensor>& bias() const { return bias_; }
+    int in_features() const { return in_features_; }
+    int out_features() const { return out_features_; }
 };
 
+class ReLU final : public Module {
+public:
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        return x->relu();
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() override {
+        return {};
+    }
+};
+
+// 2d convolution over FeatureMajor batches of in_channels x height x width images flattened
+// one per column (see Conv2dShape); its output rows are out_channels x out_height x out_width.
+// like the pooling layers below, it cannot be captured into a StaticGraph
+class Conv2d final : public Module {
+private:
+    std::shared_ptr<Tensor> weight_;
+    std::shared_ptr<Tensor> bias_;
+    Conv2dShape shape_;
+    ConvAlgorithm algorithm_;
+
+public:
+    Conv2d(int in_channels, int out_channels, int kernel_size, int height, int width, int stride = 1,
+           int padding = 0, ConvAlgorithm algorithm = ConvAlgorithm::Auto);
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override;
+
+    std::vector<std::shared_ptr<Tensor>> parameters() override {
+        return {weight_, bias_};
+    }
+
+    const std::shared_ptr<Tensor>& weight() const { return weight_; }
+    const std::shared_ptr<Tensor>& bias() const { return bias_; }
+    const Conv2dShape& shape() const { return shape_; }
+    ConvAlgorithm algorithm() const { return algorithm_; }
+    void set_algorithm(ConvAlgorithm algorithm) { algorithm_ = algorithm; }
+};
+
+// max over kernel_size x kernel_size windows of each channel, stride apart (kernel_size when 0)
+class MaxPool2d final : public Module {
+private:
+    Conv2dShape shape_;
+
+public:
+    MaxPool2d(int channels, int height, int width, int kernel_size, int stride = 0);
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        return x->max_pool2d(shape_);
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() override {
+        return {};
+    }
+
+    const Conv2dShape& shape() const { return shape_; }
+};
+
+// mean over kernel_size x kernel_size windows of each channel, stride apart (kernel_size when 0)
+class AvgPool2d final : public Module {
+private:
+    Conv2dShape shape_;
+
+public:
+    AvgPool2d(int channels, int height, int width, int kernel_size, int stride = 0);
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        return x->avg_pool2d(shape_);
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() override {
+        return {};
+    }
+
+    const Conv2dShape& shape() const { return shape_; }
+};
+
+// runs its modules in order; a Linear directly followed by a ReLU runs as one fused kernel
 class Sequential : public Module {
 private:
     std::vector<std::shared_ptr<Module>> modules_;
+    std::vector<Linear*> fused_relu_; // per module, the Linear whose ReLU is fused into it
+    int segment_layers_ = 0;
+
+    // runs modules[begin, end), fusing each Linear of fused into the ReLU after it
+    static std::shared_ptr<Tensor> forward_range(std::shared_ptr<Tensor> x,
+                                                 const std::vector<std::shared_ptr<Module>>& modules,
+                                                 const std::vector<Linear*>& fused, std::size_t begin, std::size_t end);
 
 public:
-    Sequential(const std::vector<std::shared_ptr<Module>>& modules)
-        : modules_(modules) {
-    }
+    Sequential(const std::vector<std::shared_ptr<Module>>& modules);
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override;
 
-    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x);
+    // activation checkpointing: with layers > 0, forward runs each run of that many modules as
+    // one checkpoint() segment, so backward keeps only the segment inputs and recomputes the rest
+    void set_checkpoint_segments(int layers) { segment_layers_ = layers; }
 
     std::vector<std::shared_ptr<Tensor>> parameters() override;
+
+    const std::vector<std::shared_ptr<Module>>& modules() const { return modules_; }
+};
+
+// Sequential with the pipeline fixed at compile time: layers are held by value and called
+// without virtual dispatch, so the whole chain can be inlined into forward
+template <typename... Layers>
+class StaticSequential final : public Module {
+private:
+    std::tuple<Layers...> layers_;
+
+    template <std::size_t I>
+    std::shared_ptr<Tensor> forward_from(std::shared_ptr<Tensor> x) {
+        if constexpr (I == sizeof...(Layers)) {
+            return x;
+        } else {
+            using Layer = std::tuple_element_t<I, std::tuple<Layers...>>;
+            if constexpr (I + 1 < sizeof...(Layers)) {
+                using Next = std::tuple_element_t<I + 1, std::tuple<Layers...>>;
+                if constexpr (std::is_same_v<Layer, Linear> && std::is_same_v<Next, ReLU>) {
+                    return forward_from<I + 2>(std::get<I>(layers_).forward(x, Activation::ReLU));
+                }
+            }
+            return forward_from<I + 1>(std::get<I>(layers_).Layer::forward(x));
+        }
+    }
+
+public:
+    explicit StaticSequential(Layers... layers) : layers_(std::move(layers)...) {
+    }
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        return forward_from<0>(std::move(x));
+    }
+
+    std::vector<std::shared_ptr<Tensor>> parameters() override {
+        std::vector<std::shared_ptr<Tensor>> params;
+        auto append = [&](auto& layer) {
+            auto layer_params = layer.parameters();
+            params.insert(params.end(), layer_params.begin(), layer_params.end());
+        };
+        std::apply([&](auto&... layer) { (append(layer), ...); }, layers_);
+        return params;
+    }
+
+    template <std::size_t I>
+    auto& layer() { return std::get<I>(layers_); }
 };
 
-class ReLU : public Module {
+// a module whose forward keeps only its input for backward, which re-runs the wrapped
+// module's forward to rebuild the activations (see checkpoint in tensor.h)
+template <typename M>
+class Checkpointed : public Module {
+private:
+    std::shared_ptr<M> module_;
+
 public:
-    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) {
-        return x->relu();
+    explicit Checkpointed(std::shared_ptr<M> module) : module_(std::move(module)) {
+    }
+
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) override {
+        return forward<>(std::move(x));
+    }
+
+    // extra arguments (e.g. a fused activation) are forwarded to the wrapped forward
+    template <typename... Args>
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x, Args... args) {
+        auto segment = [module=module_, args...](std::shared_ptr<Tensor> in) { return module->forward(in, args...); };
+        return ::checkpoint(segment, x, module_->parameters());
     }
 
     std::vector<std::shared_ptr<Tensor>> parameters() override {
-        return {};
+        return module_->parameters();
     }
+
+    M& module() { return *module_; }
 };
 
+template <typename M>
+std::shared_ptr<Checkpointed<M>> checkpoint(std::shared_ptr<M> module) {
+    return std::make_shared<Checkpointed<M>>(std::move(module));
+}
+
 #endif // NN_H
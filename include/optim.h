@@ -2,25 +2,60 @@
 #define OPTIM_H
 
 #include "tensor.h"
+#include <cstddef>
+#include <functional>
 #include <vector>
 #include <memory>
 
+/*
+ *optimizers see all trainable parameters as one flat index space, cut into
+ *fixed-size chunks; per-element state (momentum, moments) lives in flat
+ *buffers over that space and every step is one fused pass per chunk
+ */
+
+class ThreadPool;
+
 class Optimizer {
 protected:
     std::vector<std::shared_ptr<Tensor>> parameters_;
 
+    // elements [begin, begin + size) of one parameter, stored at offset in the flat state buffers
+    struct Chunk {
+        int parameter;
+        std::size_t begin;
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    using ChunkFn = std::function<void(float* data, const float* grad, std::size_t offset, std::size_t size)>;
+
+    std::vector<Chunk> chunks_;
+    std::size_t num_elements_ = 0;
+    bool contiguous_ = false; // parameters packed back to back (see ParameterBuffer), swept as one range
+    int steps_ = 0;
+    ThreadPool* pool_ = nullptr;
+
+    bool is_contiguous() const;
+    void build_chunks();
+
+    // runs fn on every chunk, spread over the thread pool when one is set
+    void for_each_chunk(const ChunkFn& fn);
+
 public:
-    explicit Optimizer(const std::vector<std::shared_ptr<Tensor>>& parameters)
-        : parameters_(parameters) {
-    }
+    explicit Optimizer(const std::vector<std::shared_ptr<Tensor>>& parameters);
 
     virtual void step() = 0;
 
-    void zero_grad() {
-        for (auto& p : parameters_) {
-            p->zero_grad();
-        }
-    }
+    void zero_grad();
+
+    // optional: chunks of the update are processed in parallel, nullptr runs on the calling thread
+    void set_thread_pool(ThreadPool* pool) { pool_ = pool; }
+
+    // per-element state, each buffer num_elements() long, and the step count; saved with checkpoints
+    virtual std::vector<std::vector<float>*> state_buffers() { return {}; }
+    std::size_t num_elements() const { return num_elements_; }
+    int steps() const { return steps_; }
+    void set_steps(int steps) { steps_ = steps; }
 
     virtual ~Optimizer() = default;
 };
@@ -28,13 +63,56 @@ public:
 class SGD : public Optimizer {
 private:
     float lr_;
+    float momentum_;
+    bool nesterov_;
+    float weight_decay_;
+    std::vector<float> velocity_;
+
+public:
+    std::vector<std::vector<float>*> state_buffers() override {
+        return velocity_.empty() ? std::vector<std::vector<float>*>{} : std::vector<std::vector<float>*>{&velocity_};
+    }
+
+    SGD(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate = 0.01,
+        float momentum = 0.0f, bool nesterov = false, float weight_decay = 0.0f);
+
+    void step() override;
+};
+
+// adam with l2 weight decay added to the gradient
+class Adam : public Optimizer {
+private:
+    float lr_;
+    float beta1_;
+    float beta2_;
+    float eps_;
+    float weight_decay_;
+    bool decoupled_;
+    std::vector<float> m_;
+    std::vector<float> v_;
+
+protected:
+    Adam(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate, float beta1,
+         float beta2, float eps, float weight_decay, bool decoupled);
 
 public:
-    SGD(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate = 0.01)
-        : Optimizer(parameters), lr_(learning_rate) {
+    Adam(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate = 1e-3f,
+         float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f, float weight_decay = 0.0f)
+        : Adam(parameters, learning_rate, beta1, beta2, eps, weight_decay, false) {
     }
 
+    std::vector<std::vector<float>*> state_buffers() override { return {&m_, &v_}; }
+
     void step() override;
 };
 
+// adam with weight decay applied directly to the parameters, decoupled from the moments
+class AdamW : public Adam {
+public:
+    AdamW(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate = 1e-3f,
+          float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f, float weight_decay = 0.01f)
+        : Adam(parameters, learning_rate, beta1, beta2, eps, weight_decay, true) {
+    }
+};
+
 #endif // OPTIM_H
@@ -0,0 +1,184 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "tensor.h"
+#include "tape.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+/*
+ *data-parallel training: every worker runs forward/backward over its shard
+ *of the minibatch on a replica of the model, then the gradients are
+ *tree-reduced into the master model, ready for Optimizer::step(); each
+ *worker's tape plans memory, releasing activations as backward consumes them
+ */
+
+template <typename Model>
+class DataParallel {
+public:
+    // returns the shard loss (a mean over the shard) first, optionally followed by the shard outputs
+    using LossFn = std::function<std::vector<std::shared_ptr<Tensor>>(
+        Model& model, std::shared_ptr<Tensor> inputs, const std::vector<int>& targets)>;
+    using ReplicaFactory = std::function<std::unique_ptr<Model>()>;
+
+private:
+    struct Worker {
+        Model* model = nullptr; // the master model for worker 0
+        std::unique_ptr<Model> replica;
+        std::vector<std::shared_ptr<Tensor>> params;
+        std::shared_ptr<Tensor> inputs;
+        std::vector<int> targets;
+        Eigen::MatrixXf outputs;
+        Tape tape;
+        float loss = 0.0f;
+    };
+
+    Model& model_;
+    LossFn loss_fn_;
+    ThreadPool pool_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    Eigen::MatrixXf outputs_;
+
+    void run_shard(Worker& worker, const std::shared_ptr<Tensor>& inputs, const std::vector<int>& targets,
+                   int begin, int size, int batch_size, bool is_master) {
+        if (!is_master) {
+            const auto& master = workers_[0]->params;
+            for (std::size_t i = 0; i < worker.params.size(); i++) {
+                worker.params[i]->data() = master[i]->data();
+            }
+        }
+        for (auto& p : worker.params) {
+            p->zero_grad();
+        }
+
+        const bool batch_major = inputs->layout() == Layout::BatchMajor;
+        if (!worker.inputs || worker.inputs->batch_size() != size || worker.inputs->layout() != inputs->layout()) {
+            worker.inputs = std::make_shared<Tensor>(batch_major ? Eigen::MatrixXf(inputs->data().middleRows(begin, size))
+                                                                 : Eigen::MatrixXf(inputs->data().middleCols(begin, size)));
+            worker.inputs->set_layout(inputs->layout());
+        } else if (batch_major) {
+            worker.inputs->data() = inputs->data().middleRows(begin, size);
+        } else {
+            worker.inputs->data() = inputs->data().middleCols(begin, size);
+        }
+        worker.targets.assign(targets.begin() + begin, targets.begin() + begin + size);
+
+        {
+            TapeGuard guard(worker.tape);
+            auto results = loss_fn_(*worker.model, worker.inputs, worker.targets);
+            // the tape releases activations during backward, so the outputs are copied first
+            if (results.size() > 1) {
+                worker.outputs = results[1]->data();
+            }
+            results[0]->backward();
+            worker.loss = results[0]->data()(0, 0);
+        }
+
+        // weight the shard mean by the shard's share of the batch
+        float weight = static_cast<float>(size) / batch_size;
+        for (auto& p : worker.params) {
+            p->grad() *= weight;
+        }
+        worker.loss *= weight;
+    }
+
+public:
+    DataParallel(Model& model, int num_threads, LossFn loss_fn, ReplicaFactory make_replica = nullptr)
+        : model_(model), loss_fn_(std::move(loss_fn)), pool_(num_threads) {
+        if (!make_replica) {
+            if constexpr (std::is_default_constructible_v<Model>) {
+                make_replica = []() { return std::make_unique<Model>(); };
+            } else {
+                throw std::runtime_error("DataParallel: a replica factory is required for this model");
+            }
+        }
+
+        for (int i = 0; i < pool_.size(); i++) {
+            auto worker = std::make_unique<Worker>();
+            if (i == 0) {
+                worker->model = &model_;
+            } else {
+                worker->replica = make_replica();
+                worker->model = worker->replica.get();
+            }
+            worker->params = worker->model->parameters();
+            worker->tape.set_reuse_order(true);
+            worker->tape.set_plan_memory(true);
+            workers_.push_back(std::move(worker));
+        }
+    }
+
+    int num_workers() const { return static_cast<int>(workers_.size()); }
+
+    // forward + backward over the whole batch; afterwards the master gradients hold
+    // the batch gradient (overwriting them, so zero_grad() is not needed) and the mean loss is returned
+    float step(const std::shared_ptr<Tensor>& inputs, const std::vector<int>& targets) {
+        int batch_size = inputs->batch_size();
+        if (batch_size <= 0) {
+            throw std::runtime_error("DataParallel: batch_size <= 0");
+        }
+        int n = std::min(num_workers(), batch_size);
+
+        pool_.parallel_for(n, [&](int w) {
+            int begin = static_cast<int>(static_cast<long long>(batch_size) * w / n);
+            int end = static_cast<int>(static_cast<long long>(batch_size) * (w + 1) / n);
+            run_shard(*workers_[w], inputs, targets, begin, end - begin, batch_size, w == 0);
+        });
+
+        // tree all-reduce: log2(n) rounds of pairwise sums, the result lands in worker 0 (the master)
+        for (int stride = 1; stride < n; stride *= 2) {
+            int pairs = (n + 2 * stride - 1) / (2 * stride);
+            pool_.parallel_for(pairs, [&](int k) {
+                int dst = 2 * stride * k;
+                int src = dst + stride;
+                if (src < n) {
+                    auto& dst_params = workers_[dst]->params;
+                    auto& src_params = workers_[src]->params;
+                    for (std::size_t i = 0; i < dst_params.size(); i++) {
+                        dst_params[i]->grad() += src_params[i]->grad();
+                    }
+                    workers_[dst]->loss += workers_[src]->loss;
+                }
+            });
+        }
+
+        if (workers_[0]->outputs.size() > 0) {
+            const bool batch_major = inputs->layout() == Layout::BatchMajor;
+            if (batch_major) {
+                outputs_.resize(batch_size, workers_[0]->outputs.cols());
+            } else {
+                outputs_.resize(workers_[0]->outputs.rows(), batch_size);
+            }
+            for (int w = 0; w < n; w++) {
+                int begin = static_cast<int>(static_cast<long long>(batch_size) * w / n);
+                const Eigen::MatrixXf& shard = workers_[w]->outputs;
+                if (batch_major) {
+                    outputs_.middleRows(begin, shard.rows()) = shard;
+                } else {
+                    outputs_.middleCols(begin, shard.cols()) = shard;
+                }
+            }
+        }
+
+        return workers_[0]->loss;
+    }
+
+    // bytes of activations and grads held at once during the last step, summed over the workers
+    std::size_t peak_bytes() const {
+        std::size_t total = 0;
+        for (const auto& worker : workers_) {
+            total += worker->tape.last_peak_bytes();
+        }
+        return total;
+    }
+
+    // outputs of the last step for the whole batch, in the layout of the inputs, if the loss function returned them
+    const Eigen::MatrixXf& outputs() const { return outputs_; }
+};
+
+#endif // PARALLEL_H
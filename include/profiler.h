@@ -0,0 +1,166 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/*
+ *opt-in op profiler: while a Profiler is started, every Tensor op and every
+ *backward closure records its wall time, flops, bytes allocated and input
+ *shapes; when none is, an op pays a single atomic load
+ */
+
+enum class ProfilePhase {
+    Forward,
+    Backward,
+    Scope, // a user-defined ProfileScope, e.g. a whole training step
+};
+
+struct ProfileEvent {
+    const char* name;
+    ProfilePhase phase;
+    int thread;
+    std::int64_t start_ns; // since Profiler::start()
+    std::int64_t duration_ns;
+    double flops;
+    std::size_t bytes; // op outputs and grads allocated by the op
+    int num_shapes;
+    std::array<std::array<int, 2>, 3> shapes; // rows x cols of the inputs
+};
+
+class Profiler {
+private:
+    static std::atomic<Profiler*> active_;
+    // scopes between loading active_ and registering with the profiler they found
+    static std::atomic<int> entering_;
+    // scopes of the active profiler open on the calling thread
+    static thread_local int open_on_thread_;
+
+    std::chrono::steady_clock::time_point origin_;
+    mutable std::mutex mutex_;
+    std::vector<ProfileEvent> events_;
+    std::unordered_set<std::string> names_; // events point into it, so node op names may die
+    std::atomic<int> open_scopes_{0};
+
+    // deactivates this profiler and waits for the scopes still recording into it
+    void deactivate();
+    // deactivates without waiting for the calling thread's own scopes, so it never throws
+    void detach() noexcept;
+
+    // the active profiler, registered as in use by one more scope, or nullptr
+    static Profiler* enter() {
+        if (!active_.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        entering_.fetch_add(1);
+        Profiler* profiler = active_.load();
+        if (profiler) {
+            profiler->open_scopes_.fetch_add(1);
+            open_on_thread_++;
+        }
+        entering_.fetch_sub(1);
+        return profiler;
+    }
+
+    void leave() {
+        open_on_thread_--;
+        open_scopes_.fetch_sub(1, std::memory_order_release);
+    }
+
+    friend class ProfileScope;
+
+public:
+    Profiler() = default;
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // makes this the profiler every thread records into, dropping earlier events;
+    // only one profiler records at a time
+    void start();
+    // returns once every ProfileScope open on the profiler, on any thread, has recorded its
+    // event, so the profiler may be destroyed right after; throws std::logic_error when called
+    // inside one of its scopes on the same thread, which would never close. The destructor
+    // stops without throwing, but destroying a profiler inside its own scope asserts in debug
+    // builds and leaves that scope recording into a dead profiler otherwise
+    void stop();
+
+    std::int64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count();
+    }
+    void record(const ProfileEvent& event);
+
+    std::vector<ProfileEvent> events() const;
+
+    // calls, total and mean time, share of the profiled wall time, GFLOP/s and MiB per op and
+    // phase, slowest first; scopes nest, so a checkpoint or user scope includes the ops inside it
+    void print_summary(std::ostream& out) const;
+    // chrome trace-event json, for chrome://tracing or ui.perfetto.dev
+    void write_trace(std::ostream& out) const;
+    void write_trace(const std::string& path) const;
+
+    static Profiler* active() { return active_.load(std::memory_order_relaxed); }
+};
+
+// times the enclosing block for the active profiler; a no-op when none is started. the
+// profiler cannot finish stopping while the scope is open (see Profiler::stop)
+class ProfileScope {
+private:
+    Profiler* profiler_;
+    ProfileEvent event_;
+
+public:
+    explicit ProfileScope(const char* name, ProfilePhase phase = ProfilePhase::Scope) : profiler_(Profiler::enter()) {
+        if (profiler_) {
+            event_.name = name;
+            event_.phase = phase;
+            event_.flops = 0.0;
+            event_.bytes = 0;
+            event_.num_shapes = 0;
+            event_.start_ns = profiler_->now_ns();
+        }
+    }
+
+    ~ProfileScope() {
+        if (profiler_) {
+            event_.duration_ns = profiler_->now_ns() - event_.start_ns;
+            profiler_->record(event_);
+            profiler_->leave();
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    bool enabled() const { return profiler_ != nullptr; }
+
+    // cost of the op; the first three input shapes are kept
+    void describe(double flops, std::size_t bytes, std::initializer_list<std::array<int, 2>> shapes = {}) {
+        if (!profiler_) {
+            return;
+        }
+        event_.flops = flops;
+        event_.bytes = bytes;
+        for (const auto& shape : shapes) {
+            add_shape(shape[0], shape[1]);
+        }
+    }
+
+    void add_shape(int rows, int cols) {
+        if (profiler_ && event_.num_shapes < static_cast<int>(event_.shapes.size())) {
+            event_.shapes[event_.num_shapes++] = {rows, cols};
+        }
+    }
+};
+
+#endif // PROFILER_H
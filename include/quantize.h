@@ -0,0 +1,65 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "tensor.h"
+#include "nn.h"
+#include "data.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ *post-training int8 quantization for inference: weights are stored as int8
+ *with one symmetric scale per output channel, inputs are quantized with a
+ *scale calibrated on sample batches, and the product runs as int8 x int8 ->
+ *int32 before being scaled back to float
+ */
+
+class QuantizedLinear {
+private:
+    // row-major out_features x in_features int8 values, sign-extended to int16 once here
+    // rather than on every forward, since the gemm multiplies at that width
+    std::vector<std::int16_t> weight_;
+    Eigen::VectorXf weight_scales_;   // per output channel
+    Eigen::VectorXf bias_;
+    float input_scale_;
+    int in_features_;
+    int out_features_;
+
+public:
+    // input_max is the largest |x| expected at this layer's input; larger values saturate
+    QuantizedLinear(const Linear& layer, float input_max);
+
+    // act(w * x + b) with x of in_features x batch, computed in int8
+    Eigen::MatrixXf forward(kernels::ConstMatrixRef x, Activation act = Activation::None) const;
+
+    int in_features() const { return in_features_; }
+    int out_features() const { return out_features_; }
+    float input_scale() const { return input_scale_; }
+    // footprint of the int8 weights, i.e. what serializing them would take
+    std::size_t weight_bytes() const { return weight_.size() * sizeof(std::int8_t); }
+};
+
+// a chain of quantized layers with relu between them
+class QuantizedSequential {
+private:
+    std::vector<QuantizedLinear> layers_;
+
+public:
+    // the fp32 layers are run on the calibration batches to record each layer's input range
+    QuantizedSequential(const std::vector<Linear*>& layers,
+                        const std::vector<std::shared_ptr<Tensor>>& calibration_batches);
+    // calibrates on the first num_batches batches of the dataset
+    QuantizedSequential(const std::vector<Linear*>& layers, const MNISTDataset& dataset,
+                        int num_batches = 8, int batch_size = 128);
+
+    // the Linear modules of a Sequential of Linear layers with ReLU between them, in order
+    static std::vector<Linear*> layers_of(const Sequential& model);
+
+    // result does not require grad and has the layout of x
+    std::shared_ptr<Tensor> forward(std::shared_ptr<Tensor> x) const;
+
+    const std::vector<QuantizedLinear>& layers() const { return layers_; }
+};
+
+#endif // QUANTIZE_H
@@ -0,0 +1,89 @@
+#ifndef SCALAR_H
+#define SCALAR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ *scalar autograd on a struct-of-arrays tape: a node is an index into
+ *contiguous data/grad/op/parent arrays, appended in topological order, so
+ *backward is one reverse sweep with no sort, closures or refcounts; the
+ *counterpart of Value for graphs of millions of nodes
+ */
+
+enum class ScalarOp : std::uint8_t {
+    Leaf,
+    Add,
+    Mul,
+    Tanh,
+    Exp,
+    Pow, // the exponent is a constant, as in Value::pow
+};
+
+class ScalarTape;
+
+// handle to a node of a ScalarTape; cheap to copy, valid until the tape is cleared
+struct Scalar {
+    ScalarTape* tape = nullptr;
+    std::int32_t index = -1;
+
+    double data() const;
+    double grad() const;
+
+    Scalar tanh() const;
+    Scalar exp() const;
+    Scalar pow(Scalar exponent) const;
+    Scalar pow(double exponent) const;
+};
+
+Scalar operator+(Scalar a, Scalar b);
+Scalar operator*(Scalar a, Scalar b);
+Scalar operator+(Scalar a, double b);
+Scalar operator*(Scalar a, double b);
+
+class ScalarTape {
+private:
+    std::vector<double> data_;
+    std::vector<double> grad_;
+    std::vector<ScalarOp> op_;
+    std::vector<std::int32_t> lhs_; // -1 for leaves
+    std::vector<std::int32_t> rhs_; // -1 for leaves and unary ops
+    std::unordered_map<std::int32_t, std::string> names_; // only nodes given a label
+
+public:
+    Scalar leaf(double value, std::string_view label = {});
+    Scalar push(ScalarOp op, double value, std::int32_t lhs, std::int32_t rhs = -1);
+
+    // fills the grads of every node up to root, seeded with d(root)/d(root) = 1
+    void backward(Scalar root);
+
+    // drops every node, keeping the arrays' capacity for the next graph
+    void clear();
+    void reserve(std::size_t nodes);
+    std::size_t size() const { return data_.size(); }
+
+    double data(std::int32_t index) const { return data_[index]; }
+    double grad(std::int32_t index) const { return grad_[index]; }
+    void set_data(std::int32_t index, double value) { data_[index] = value; }
+    ScalarOp op(std::int32_t index) const { return op_[index]; }
+    std::int32_t lhs(std::int32_t index) const { return lhs_[index]; }
+    std::int32_t rhs(std::int32_t index) const { return rhs_[index]; }
+
+    void set_label(Scalar node, std::string label) { names_[node.index] = std::move(label); }
+    // the node's label, or its expression over labelled nodes (unlabelled leaves print as v<index>),
+    // formatted on request only
+    std::string label(Scalar node) const;
+};
+
+inline double Scalar::data() const {
+    return tape->data(index);
+}
+
+inline double Scalar::grad() const {
+    return tape->grad(index);
+}
+
+#endif // SCALAR_H
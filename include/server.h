@@ -0,0 +1,72 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "nn.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *in-process inference with dynamic batching: single-sample requests from
+ *any thread are written into a preallocated batch buffer, and a worker runs
+ *one no-grad forward over the batch once it is full or its oldest request
+ *has waited max_delay; requests keep filling the second buffer meanwhile
+ */
+
+struct InferenceServerOptions {
+    int max_batch_size = 32;
+    std::chrono::microseconds max_delay{500}; // longest a request waits for its batch to fill
+};
+
+class InferenceServer {
+private:
+    struct Buffer {
+        std::shared_ptr<float> storage; // input_size x max_batch_size, one sample per column
+        std::vector<std::shared_ptr<Tensor>> views; // views[n - 1] holds the first n samples, made on first use
+        std::vector<std::promise<Eigen::VectorXf>> promises;
+    };
+
+    Module& model_;
+    int input_size_;
+    InferenceServerOptions options_;
+    Buffer buffers_[2];
+    int pending_ = 0; // buffer that new requests are written into
+    int count_ = 0;   // requests in it
+    std::chrono::steady_clock::time_point first_arrival_;
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable ready_;    // wakes the worker
+    std::condition_variable not_full_; // wakes submitters waiting for room
+    bool stop_ = false;
+
+    std::atomic<long long> batches_{0};
+    std::atomic<long long> requests_{0};
+
+    void serve();
+    void run_batch(Buffer& buffer, int size);
+
+public:
+    // the model is only called from the worker thread, and must map a features x batch input
+    // to an outputs x batch result; do not train it while the server is running
+    InferenceServer(Module& model, int input_size, InferenceServerOptions options = {});
+    // serves the requests already submitted, then stops
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    // thread-safe; blocks only while both buffers are full. the future holds the sample's
+    // output column, or the exception the forward threw
+    std::future<Eigen::VectorXf> submit(const Eigen::Ref<const Eigen::VectorXf>& sample);
+
+    long long batches() const { return batches_.load(std::memory_order_relaxed); }
+    long long requests() const { return requests_.load(std::memory_order_relaxed); }
+};
+
+#endif // SERVER_H
@@ -0,0 +1,153 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+#include <Eigen/Dense>
+
+class Tensor;
+
+/*
+ *per-iteration tape: graph nodes, parent lists and backward closures
+ *are bump-allocated from an arena that is rewound after each step
+ */
+
+class Arena : public std::pmr::memory_resource {
+private:
+    struct Block {
+        char* data;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    std::size_t block_size_;
+    std::size_t current_ = 0; // index of the block we bump from
+    std::size_t offset_ = 0;  // first free byte in the current block
+    std::size_t bytes_allocated_ = 0;
+    std::size_t live_allocations_ = 0;
+
+    bool fits(const Block& block, std::size_t offset, std::size_t bytes, std::size_t alignment) const;
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    explicit Arena(std::size_t block_size = 64 * 1024);
+    ~Arena() override;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // rewinds to the first block, keeping every block for reuse
+    void reset();
+
+    std::size_t bytes_allocated() const { return bytes_allocated_; }
+    std::size_t live_allocations() const { return live_allocations_; }
+    std::size_t capacity() const;
+    std::size_t num_blocks() const { return blocks_.size(); }
+};
+
+class Tape {
+private:
+    struct CachedOrder {
+        int root;
+        std::uint64_t hash;
+        std::vector<int> order; // tape indices in backward order
+    };
+
+    Arena arena_;
+    std::size_t resets_ = 0;
+    std::size_t failed_resets_ = 0;
+
+    // nodes with a backward closure in creation order, and a running hash of the
+    // graph structure (op + parent indices) up to each of them
+    std::vector<Tensor*> nodes_;
+    std::vector<std::uint64_t> prefix_hashes_;
+
+    bool reuse_order_ = false;
+    std::vector<CachedOrder> orders_;
+    std::size_t order_hits_ = 0;
+    std::size_t order_misses_ = 0;
+
+    bool plan_memory_ = false;
+    std::vector<Eigen::MatrixXf> pool_; // released buffers, kept across steps
+    std::size_t live_bytes_ = 0;
+    std::size_t peak_bytes_ = 0;
+    std::size_t last_peak_bytes_ = 0;
+
+public:
+    explicit Tape(std::size_t block_size = 64 * 1024) : arena_(block_size) {
+    }
+
+    std::pmr::memory_resource* resource() { return &arena_; }
+    const Arena& arena() const { return arena_; }
+    std::size_t resets() const { return resets_; }
+    std::size_t failed_resets() const { return failed_resets_; }
+
+    int record(Tensor* node, std::uint64_t structure_hash);
+    bool contains(const Tensor* node, int index) const {
+        return index >= 0 && index < static_cast<int>(nodes_.size()) && nodes_[index] == node;
+    }
+    Tensor* node(int index) const { return nodes_[index]; }
+    std::size_t num_nodes() const { return nodes_.size(); }
+
+    // when enabled, backward() from a root whose graph has the same structure as on
+    // an earlier step replays the stored order instead of traversing the graph
+    void set_reuse_order(bool reuse) { reuse_order_ = reuse; }
+    bool reuse_order() const { return reuse_order_; }
+    const std::vector<int>* cached_order(int root);
+    void store_order(int root, std::vector<int> order);
+    std::size_t order_hits() const { return order_hits_; }
+    std::size_t order_misses() const { return order_misses_; }
+
+    // memory planning: op outputs take their buffers from a pool kept across steps, node grads
+    // are allocated only when backward first writes them, and backward hands a node's value and
+    // grad back to the pool as soon as no remaining closure reads them; so read any value needed
+    // after backward (other than the loss) before calling it, and run backward once per graph
+    void set_plan_memory(bool plan) { plan_memory_ = plan; }
+    bool plan_memory() const { return plan_memory_; }
+    Eigen::MatrixXf acquire(Eigen::Index rows, Eigen::Index cols);
+    void recycle(Eigen::MatrixXf&& buffer);
+    std::size_t pooled_buffers() const { return pool_.size(); }
+
+    // bytes of node values and grads alive on the tape, and their high-water mark over the
+    // current step and over the last finished one
+    void track_bytes(std::size_t bytes);
+    void untrack_bytes(std::size_t bytes) { live_bytes_ -= bytes; }
+    std::size_t live_bytes() const { return live_bytes_; }
+    std::size_t peak_bytes() const { return peak_bytes_; }
+    std::size_t last_peak_bytes() const { return last_peak_bytes_; }
+
+    // rewinds the arena; returns false (and keeps the memory) if some node is still referenced,
+    // counting it in failed_resets(). The recorded nodes and cached orders are dropped either way
+    bool reset();
+
+    // tape active on the calling thread, nullptr in eager mode
+    static Tape* current();
+
+    friend class TapeGuard;
+};
+
+// activates a tape on the calling thread for the guard's lifetime and resets it on exit,
+// so declare it first in the loop body: every node of the step is released before it.
+// A node outliving the guard keeps the arena from rewinding, which asserts in debug builds
+class TapeGuard {
+private:
+    Tape& tape_;
+    Tape* previous_;
+
+public:
+    explicit TapeGuard(Tape& tape);
+    ~TapeGuard();
+
+    TapeGuard(const TapeGuard&) = delete;
+    TapeGuard& operator=(const TapeGuard&) = delete;
+};
+
+#endif // TAPE_H
@@ -1,28 +1,194 @@
 #ifndef TENSOR_H
 #define TENSOR_H
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
-#include <functional>
-#include <set>
+#include <memory_resource>
+#include <string>
+#include <utility>
 #include <Eigen/Dense>
+#include "kernels.h"
 
 /*
  *this is core engine, Tensor class
  */
 
+// type-erased backward closure, allocated from the same memory resource as its node
+class BackwardFn {
+private:
+    void* fn_ = nullptr;
+    void (*invoke_)(void*) = nullptr;
+    void (*destroy_)(void*, std::pmr::memory_resource*) = nullptr;
+    std::pmr::memory_resource* resource_ = nullptr;
+
+    void release() {
+        if (fn_) {
+            destroy_(fn_, resource_);
+            fn_ = nullptr;
+        }
+    }
+
+public:
+    BackwardFn() = default;
+
+    template <typename F>
+    BackwardFn(F&& fn, std::pmr::memory_resource* resource) : resource_(resource) {
+        using Fn = std::decay_t<F>;
+        std::pmr::polymorphic_allocator<Fn> alloc(resource);
+        Fn* p = alloc.allocate(1);
+        alloc.construct(p, std::forward<F>(fn));
+        fn_ = p;
+        invoke_ = [](void* f) { (*static_cast<Fn*>(f))(); };
+        destroy_ = [](void* f, std::pmr::memory_resource* r) {
+            std::pmr::polymorphic_allocator<Fn> a(r);
+            static_cast<Fn*>(f)->~Fn();
+            a.deallocate(static_cast<Fn*>(f), 1);
+        };
+    }
+
+    BackwardFn(BackwardFn&& other) noexcept
+        : fn_(std::exchange(other.fn_, nullptr)), invoke_(other.invoke_),
+          destroy_(other.destroy_), resource_(other.resource_) {
+    }
+
+    BackwardFn& operator=(BackwardFn&& other) noexcept {
+        if (this != &other) {
+            release();
+            fn_ = std::exchange(other.fn_, nullptr);
+            invoke_ = other.invoke_;
+            destroy_ = other.destroy_;
+            resource_ = other.resource_;
+        }
+        return *this;
+    }
+
+    BackwardFn(const BackwardFn&) = delete;
+    BackwardFn& operator=(const BackwardFn&) = delete;
+
+    ~BackwardFn() { release(); }
+
+    explicit operator bool() const { return fn_ != nullptr; }
+    void operator()() const { invoke_(fn_); }
+};
+
+// false while a NoGradGuard is alive on this thread
+bool grad_enabled();
+
+// inference mode: while alive, ops on this thread only compute values, so their
+// results have no parents, no backward closure and no grad buffer
+class NoGradGuard {
+private:
+    bool previous_;
+
+public:
+    NoGradGuard();
+    ~NoGradGuard();
+
+    NoGradGuard(const NoGradGuard&) = delete;
+    NoGradGuard& operator=(const NoGradGuard&) = delete;
+};
+
+// data and grad of a Tensor: a view over memory the tensor owns or shares. unlike the
+// MatrixXf these accessors returned before, a view cannot be resized (use Tensor::set_data)
+// and is not declared aligned: parameters packed into a ParameterBuffer start at any float
+using MatrixView = Eigen::Map<Eigen::MatrixXf>;
+
+// where the storage of an op result was taken from, so it is handed back to the same place
+enum class BufferSource {
+    Heap,
+    Pool, // BufferPool::acquire
+    Tape, // Tape::acquire on a memory-planning tape
+};
+
+class Tape;
+class Tensor;
+
+namespace lazy {
+template <typename Derived>
+class Expression;
+template <typename E>
+std::shared_ptr<Tensor> materialize(const Expression<E>& expression);
+}
+
+// a function of one tensor, e.g. a run of layers (see checkpoint)
+using SegmentFn = std::function<std::shared_ptr<Tensor>(std::shared_ptr<Tensor>)>;
+
 class Tensor : public std::enable_shared_from_this<Tensor> {
 private:
-    Eigen::MatrixXf data_;
-    Eigen::MatrixXf grad_;
+    // owned storage, released once the tensor is bound to external storage
+    Eigen::MatrixXf owned_data_;
+    Eigen::MatrixXf owned_grad_;
+    std::shared_ptr<void> storage_; // keeps external storage alive
+    MatrixView data_{nullptr, 0, 0};
+    MatrixView grad_{nullptr, 0, 0};
     bool requires_grad_;
+    Layout layout_ = Layout::FeatureMajor;
     std::string op_;
-    std::set<std::shared_ptr<Tensor>> prev_;
-    std::function<void()> backward_fn_;
+    std::pmr::vector<std::shared_ptr<Tensor>> prev_;
+    BackwardFn backward_fn_;
     std::string label_;
+    int tape_index_ = -1;
+    std::uint64_t topo_mark_ = 0;
+    bool released_ = false; // value and grad handed back by the memory planner
+    bool pooled_ = false;   // owned value and grad were taken from the BufferPool (BufferSource::Pool)
+    // bumped by every in-place op; saved_versions_ is the sum over this node and its parents
+    // when the node was built, so backward can tell that a value its closure reads has changed
+    std::uint64_t version_ = 0;
+    std::uint64_t saved_versions_ = 0;
+
+    template <typename F>
+    void set_backward(F&& fn) {
+        backward_fn_ = BackwardFn(std::forward<F>(fn), prev_.get_allocator().resource());
+        saved_versions_ = input_versions();
+        record_on_tape();
+    }
+
+    std::uint64_t input_versions() const;
+
+    void init_storage(Eigen::MatrixXf data, bool allocate_grad = true);
+    void record_on_tape();
+    static void topo_sort(Tensor* root, std::vector<Tensor*>& order);
+
+    // runs the backward closure; with a planning tape, first materializes the grads it writes
+    // and then, if release is set, hands this node's value and grad back to the tape
+    void run_backward(Tape* planner, bool release);
+    void materialize_grad(Tape& tape);
+    void release_buffers(Tape& tape);
+
+    // a fresh op result node, on the output buffers and tape every op uses (see lazy.h)
+    static std::shared_ptr<Tensor> make_result(Eigen::Index rows, Eigen::Index cols, bool requires_grad);
+
+    friend class StaticGraph;
+    template <typename E>
+    friend std::shared_ptr<Tensor> lazy::materialize(const lazy::Expression<E>& expression);
+    friend std::shared_ptr<Tensor> checkpoint(const SegmentFn&, std::shared_ptr<Tensor>,
+                                              const std::vector<std::shared_ptr<Tensor>>&);
 
 public:
     explicit Tensor(const Eigen::MatrixXf& data, bool requires_grad = false, const std::string& label = "");
+    // takes over the matrix's buffer instead of copying it
+    explicit Tensor(Eigen::MatrixXf&& data, bool requires_grad = false, const std::string& label = "");
+    // op result whose parent list and backward closure live in the given resource (see tape.h);
+    // source says where data came from: the pool of a memory-planning tape, where the grad is
+    // only allocated once backward needs it, the BufferPool, which also provides the grad and
+    // gets both back when the tensor dies, or the heap
+    Tensor(Eigen::MatrixXf data, bool requires_grad, std::pmr::memory_resource* resource,
+           BufferSource source = BufferSource::Heap);
+    ~Tensor();
+
+    // data_ and grad_ point into the tensor itself
+    Tensor(const Tensor&) = delete;
+    Tensor& operator=(const Tensor&) = delete;
+
+    // makes the tensor a view into external memory of rows * cols floats that owner keeps
+    // alive, moving the current values over unless copy_values is false (the memory already
+    // holds them, e.g. a mapped checkpoint); with a null grad the grad stays where it is
+    void bind_storage(float* data, float* grad, std::shared_ptr<void> owner, bool copy_values = true);
+    // replaces the value with data of any shape, which the tensor then owns, leaving external
+    // storage it was bound to untouched; the grad becomes zeros of the new shape
+    void set_data(Eigen::MatrixXf data);
 
     std::shared_ptr<Tensor> matmul(std::shared_ptr<Tensor> other);
     std::shared_ptr<Tensor> add(std::shared_ptr<Tensor> other);
@@ -30,20 +196,53 @@ public:
     std::shared_ptr<Tensor> log_softmax();
     std::shared_ptr<Tensor> mse_loss(std::shared_ptr<Tensor> target);
     std::shared_ptr<Tensor> nll_loss(const std::vector<int>& target);
+    // log_softmax()->nll_loss(target) as one op on these logits; the backward writes
+    // softmax - onehot straight into the logits' grad
+    std::shared_ptr<Tensor> cross_entropy(const std::vector<int>& target);
+    // fused act(weight * this + bias), bias is a column broadcast over the batch;
+    // backward masks this node's grad into a scratch buffer before computing dw, db and dx
+    std::shared_ptr<Tensor> linear(std::shared_ptr<Tensor> weight, std::shared_ptr<Tensor> bias,
+                                   Activation act = Activation::None);
+    // conv2d of this FeatureMajor batch of images (see Conv2dShape) with weight out_channels x
+    // (channels * kernel * kernel), one filter per row, and an out_channels x 1 bias; the backward
+    // runs the same algorithm as the forward
+    std::shared_ptr<Tensor> conv2d(std::shared_ptr<Tensor> weight, std::shared_ptr<Tensor> bias,
+                                   const Conv2dShape& shape, ConvAlgorithm algorithm = ConvAlgorithm::Auto);
+    // max and mean over kernel x kernel windows of each channel; max_pool2d keeps the argmax of
+    // every window for its backward, not the input
+    // conv2d, max_pool2d and avg_pool2d have no StaticGraph opcode yet, so they throw while a
+    // capture is running; run conv models eagerly, on a tape
+    std::shared_ptr<Tensor> max_pool2d(const Conv2dShape& shape);
+    std::shared_ptr<Tensor> avg_pool2d(const Conv2dShape& shape);
+
+    // in-place variants that overwrite this tensor's buffer and return it; only valid
+    // when nothing will backprop through it (inside a NoGradGuard, or no requires_grad).
+    // a graph node that already read this tensor throws from backward instead of
+    // computing its grads from the overwritten values
+    std::shared_ptr<Tensor> relu_();
+    std::shared_ptr<Tensor> log_softmax_();
 
     void backward();
+    // backward from a non-scalar output, seeding its grad with grad_output
+    void backward(kernels::ConstMatrixRef grad_output);
 
     std::shared_ptr<Tensor> reshape(int rows, int cols);
     int rows() const { return data_.rows(); }
     int cols() const { return data_.cols(); }
 
-    Eigen::MatrixXf& data() { return data_; }
-    const Eigen::MatrixXf& data() const { return data_; }
-    Eigen::MatrixXf& grad() { return grad_; }
-    const Eigen::MatrixXf& grad() const { return grad_; }
+    // how the batch is laid out, for activations; op results inherit it from their
+    // inputs (BatchMajor if any input is), while parameters keep their own shapes
+    Layout layout() const { return layout_; }
+    void set_layout(Layout layout) { layout_ = layout; }
+    int batch_size() const { return layout_ == Layout::BatchMajor ? rows() : cols(); }
+
+    MatrixView& data() { return data_; }
+    const MatrixView& data() const { return data_; }
+    MatrixView& grad() { return grad_; }
+    const MatrixView& grad() const { return grad_; }
     void zero_grad() { if (requires_grad_) grad_.setZero(); }
     bool requires_grad() const { return requires_grad_; }
-    const std::set<std::shared_ptr<Tensor>>& prev() const { return prev_; }
+    const std::pmr::vector<std::shared_ptr<Tensor>>& prev() const { return prev_; }
     const std::string& op() const { return op_; }
     void set_label(const std::string& label) { label_ = label; }
     const std::string& label() const { return label_; }
@@ -52,5 +251,16 @@ public:
 std::shared_ptr<Tensor> operator+(std::shared_ptr<Tensor> a, std::shared_ptr<Tensor> b);
 std::shared_ptr<Tensor> matmul(std::shared_ptr<Tensor> a, std::shared_ptr<Tensor> b);
 std::shared_ptr<Tensor> relu(std::shared_ptr<Tensor> x);
+std::shared_ptr<Tensor> linear(std::shared_ptr<Tensor> x, std::shared_ptr<Tensor> weight,
+                               std::shared_ptr<Tensor> bias, Activation act = Activation::None);
+std::shared_ptr<Tensor> cross_entropy(std::shared_ptr<Tensor> logits, const std::vector<int>& targets);
+std::shared_ptr<Tensor> conv2d(std::shared_ptr<Tensor> x, std::shared_ptr<Tensor> weight, std::shared_ptr<Tensor> bias,
+                               const Conv2dShape& shape, ConvAlgorithm algorithm = ConvAlgorithm::Auto);
+
+// activation checkpointing: runs segment(x) keeping none of its activations, only x; the
+// backward re-runs segment to rebuild them, trading a second forward for memory. parameters
+// are the leaves segment reads, and segment must compute the same function on every call
+std::shared_ptr<Tensor> checkpoint(const SegmentFn& segment, std::shared_ptr<Tensor> x,
+                                   const std::vector<std::shared_ptr<Tensor>>& parameters);
 
 #endif // TENSOR_H
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *fixed-size fork-join pool; the calling thread takes part in every
+ *parallel_for, so a pool of size n starts n - 1 threads
+ */
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+
+    const std::function<void(int)>* task_ = nullptr;
+    int num_tasks_ = 0;
+    std::atomic<int> next_task_{0};
+    int active_workers_ = 0;
+    std::uint64_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    void worker_loop();
+    void run_tasks();
+
+public:
+    explicit ThreadPool(int num_threads = static_cast<int>(std::thread::hardware_concurrency()));
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers_.size()) + 1; }
+
+    // runs fn(0) ... fn(n - 1) across the pool and returns once all of them are done;
+    // the first exception thrown by a task is rethrown here
+    void parallel_for(int n, const std::function<void(int)>& fn);
+};
+
+#endif // THREAD_POOL_H
@@ -1,6 +1,7 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -14,8 +15,10 @@ private:
     double grad_ = 0.0;
     std::string op_;
     std::set<std::shared_ptr<Value>> prev_;
+    std::shared_ptr<Value> exponent_; // pow's exponent, kept out of prev_ as it gets no grad
     std::string label_;
     std::function<void()> backward_;
+    std::uint64_t topo_mark_ = 0;
 
 public:
     explicit Value(double data, const std::string& label = ""); // leaf node
@@ -42,6 +45,7 @@ public:
     double get_grad() const { return grad_; }
     const std::string& get_op() const { return op_; }
     const std::set<std::shared_ptr<Value>>& get_prev() const { return prev_; }
+    const std::shared_ptr<Value>& get_exponent() const { return exponent_; }
     void set_label(std::string label) { label_ = label; }
     const std::string& get_label() const { return label_; }
     void backward() const { if (backward_) backward_(); }
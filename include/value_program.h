@@ -0,0 +1,66 @@
+#ifndef VALUE_PROGRAM_H
+#define VALUE_PROGRAM_H
+
+#include "value.h"
+#include <Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ *compiled Value expressions: lower a Value graph once into a flat opcode
+ *program over preallocated slots, then evaluate forward and gradients for new
+ *leaf values with no allocation and no closure dispatch, for one input set or
+ *for many at once, one per SIMD lane
+ */
+
+enum class ValueOpCode : std::uint8_t {
+    Add,
+    Mul,
+    Tanh,
+    Exp,
+    Pow, // b is the exponent, which gets no grad, as in Value::pow
+};
+
+class ValueProgram {
+private:
+    struct Instruction {
+        ValueOpCode op;
+        std::int32_t a;
+        std::int32_t b; // -1 for unary ops
+        std::int32_t out;
+    };
+
+    std::vector<Instruction> instructions_;
+    int num_inputs_ = 0;
+    std::int32_t root_ = 0;
+
+    // one slot per distinct node: inputs first, then constants and op results in topological order
+    std::vector<double> values_;
+    std::vector<double> grads_;
+
+    // the same slots with one row per input set (lane), so every instruction is a column op
+    Eigen::ArrayXXd lane_values_;
+    Eigen::ArrayXXd lane_grads_;
+
+public:
+    // lowers the expression rooted at root; each input becomes an argument in the given order,
+    // every other leaf, and anything computed only from such leaves, is frozen at its current value
+    static ValueProgram compile(const std::shared_ptr<Value>& root, const std::vector<std::shared_ptr<Value>>& inputs);
+
+    // evaluates the expression at the given input values and returns the root's value
+    double forward(const Eigen::Ref<const Eigen::VectorXd>& inputs);
+    // d(root)/d(input) for the last forward(); read with grad()
+    void backward();
+    double grad(int input) const { return grads_[input]; }
+
+    // one input set per row (lanes x num_inputs()); returns the root's value per lane
+    Eigen::Ref<const Eigen::ArrayXd> forward_lanes(const Eigen::Ref<const Eigen::ArrayXXd>& inputs);
+    // grads of the last forward_lanes(), lanes x num_inputs()
+    Eigen::Ref<const Eigen::ArrayXXd> backward_lanes();
+
+    int num_inputs() const { return num_inputs_; }
+    std::size_t num_instructions() const { return instructions_.size(); }
+};
+
+#endif // VALUE_PROGRAM_H
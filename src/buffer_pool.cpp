@@ -0,0 +1,154 @@
+#include "../include/buffer_pool.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+// buffers of one element count; MatrixXf keeps no spare capacity, and a buffer of the
+// same count is resized to any shape without reallocating
+using Buckets = std::unordered_map<Eigen::Index, std::vector<Eigen::MatrixXf>>;
+
+constexpr std::size_t local_buffers_per_size = 4;
+
+std::atomic<bool> pool_enabled{false};
+std::atomic<std::size_t> max_cached_bytes{std::size_t{256} << 20};
+
+std::atomic<std::size_t> hits{0};
+std::atomic<std::size_t> misses{0};
+std::atomic<std::size_t> bytes_in_use{0};
+std::atomic<std::size_t> bytes_cached{0};
+std::atomic<std::size_t> peak_bytes{0};
+
+std::size_t bytes_of(Eigen::Index size) {
+    return static_cast<std::size_t>(size) * sizeof(float);
+}
+
+void update_peak() {
+    std::size_t total = bytes_in_use.load(std::memory_order_relaxed) + bytes_cached.load(std::memory_order_relaxed);
+    std::size_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (total > peak && !peak_bytes.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {
+    }
+}
+
+struct SharedBuckets {
+    std::mutex mutex;
+    Buckets buckets;
+};
+
+SharedBuckets& shared() {
+    static SharedBuckets instance;
+    return instance;
+}
+
+bool take(Buckets& buckets, Eigen::Index size, Eigen::MatrixXf& buffer) {
+    auto it = buckets.find(size);
+    if (it == buckets.end() || it->second.empty()) {
+        return false;
+    }
+    buffer = std::move(it->second.back());
+    it->second.pop_back();
+    return true;
+}
+
+void drop_all(Buckets& buckets) {
+    for (auto& [size, buffers] : buckets) {
+        bytes_cached -= bytes_of(size) * buffers.size();
+    }
+    buckets.clear();
+}
+
+// the calling thread's free lists, handed to the shared list when the thread exits
+struct LocalBuckets {
+    Buckets buckets;
+
+    ~LocalBuckets() {
+        SharedBuckets& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        for (auto& [size, buffers] : buckets) {
+            auto& list = pool.buckets[size];
+            for (auto& buffer : buffers) {
+                list.push_back(std::move(buffer));
+            }
+        }
+    }
+};
+
+thread_local LocalBuckets local;
+}
+
+void BufferPool::set_enabled(bool enabled) {
+    pool_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool BufferPool::enabled() {
+    return pool_enabled.load(std::memory_order_relaxed);
+}
+
+Eigen::MatrixXf BufferPool::acquire(Eigen::Index rows, Eigen::Index cols) {
+    const Eigen::Index size = rows * cols;
+    Eigen::MatrixXf buffer;
+    bool hit = take(local.buckets, size, buffer);
+    if (!hit) {
+        SharedBuckets& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        hit = take(pool.buckets, size, buffer);
+    }
+
+    bytes_in_use += bytes_of(size);
+    if (hit) {
+        hits++;
+        bytes_cached -= bytes_of(size);
+        buffer.resize(rows, cols); // same size, so no reallocation
+    } else {
+        misses++;
+        buffer.resize(rows, cols);
+        update_peak();
+    }
+    return buffer;
+}
+
+void BufferPool::release(Eigen::MatrixXf&& buffer) {
+    const Eigen::Index size = buffer.size();
+    if (size == 0) {
+        return;
+    }
+    bytes_in_use -= bytes_of(size);
+    if (!enabled() || bytes_cached.load(std::memory_order_relaxed) + bytes_of(size) > max_cached_bytes.load()) {
+        buffer = Eigen::MatrixXf();
+        return;
+    }
+
+    bytes_cached += bytes_of(size);
+    auto& list = local.buckets[size];
+    if (list.size() < local_buffers_per_size) {
+        list.push_back(std::move(buffer));
+        return;
+    }
+    SharedBuckets& pool = shared();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.buckets[size].push_back(std::move(buffer));
+}
+
+void BufferPool::set_max_cached_bytes(std::size_t bytes) {
+    max_cached_bytes.store(bytes);
+}
+
+void BufferPool::trim() {
+    drop_all(local.buckets);
+    SharedBuckets& pool = shared();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    drop_all(pool.buckets);
+}
+
+BufferPoolStats BufferPool::stats() {
+    return {hits.load(), misses.load(), bytes_in_use.load(), bytes_cached.load(), peak_bytes.load()};
+}
+
+void BufferPool::reset_stats() {
+    hits = 0;
+    misses = 0;
+    peak_bytes = bytes_in_use.load() + bytes_cached.load();
+}
@@ -0,0 +1,160 @@
+#include "../include/checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr char magic[8] = {'K', 'R', 'Y', 'K', 'C', 'K', 'P', 'T'};
+constexpr std::uint64_t alignment = 64;
+
+static_assert(sizeof(Checkpoint::Header) == 64, "checkpoint header must stay 64 bytes");
+static_assert(sizeof(Checkpoint::Entry) == 16, "checkpoint entry must stay 16 bytes");
+
+std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+void write_at(std::ofstream& file, std::uint64_t offset, const void* data, std::size_t bytes) {
+    // pads with zeros up to offset
+    static const char zeros[alignment] = {};
+    std::uint64_t position = static_cast<std::uint64_t>(file.tellp());
+    while (position < offset) {
+        std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(offset - position, alignment));
+        file.write(zeros, n);
+        position += n;
+    }
+    file.write(static_cast<const char*>(data), bytes);
+}
+}
+
+void Checkpoint::save(const std::string& path, const std::vector<std::shared_ptr<Tensor>>& parameters,
+                      Optimizer* optimizer) {
+    std::vector<std::vector<float>*> state;
+    if (optimizer) {
+        state = optimizer->state_buffers();
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.num_tensors = static_cast<std::uint32_t>(parameters.size());
+    header.num_state = static_cast<std::uint32_t>(state.size());
+    header.steps = optimizer ? optimizer->steps() : 0;
+    header.state_elements = optimizer ? optimizer->num_elements() : 0;
+
+    std::vector<Entry> entries;
+    std::uint64_t offset = align_up(sizeof(Header) + parameters.size() * sizeof(Entry));
+    for (const auto& p : parameters) {
+        entries.push_back({static_cast<std::uint32_t>(p->rows()), static_cast<std::uint32_t>(p->cols()), offset});
+        offset = align_up(offset + p->data().size() * sizeof(float));
+    }
+    header.state_offset = offset;
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("cannot write checkpoint: " + path);
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+        for (std::size_t i = 0; i < parameters.size(); i++) {
+            write_at(file, entries[i].offset, parameters[i]->data().data(), parameters[i]->data().size() * sizeof(float));
+        }
+        for (std::size_t k = 0; k < state.size(); k++) {
+            std::uint64_t stride = align_up(header.state_elements * sizeof(float));
+            write_at(file, header.state_offset + k * stride, state[k]->data(), header.state_elements * sizeof(float));
+        }
+        if (!file) {
+            throw std::runtime_error("cannot write checkpoint: " + path);
+        }
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+Checkpoint::Checkpoint(const std::string& path)
+    : file_(std::make_shared<MappedFile>(path, true)) {
+    if (file_->size() < sizeof(Header)) {
+        throw std::runtime_error("not a checkpoint: " + path);
+    }
+    std::memcpy(&header_, file_->data(), sizeof(Header));
+    if (std::memcmp(header_.magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error("not a checkpoint: " + path);
+    }
+    if (header_.version != version) {
+        throw std::runtime_error("unsupported checkpoint version " + std::to_string(header_.version) + ": " + path);
+    }
+
+    std::uint64_t table_end = sizeof(Header) + static_cast<std::uint64_t>(header_.num_tensors) * sizeof(Entry);
+    if (table_end > file_->size()) {
+        throw std::runtime_error("truncated checkpoint: " + path);
+    }
+    entries_.resize(header_.num_tensors);
+    std::memcpy(entries_.data(), file_->data() + sizeof(Header), entries_.size() * sizeof(Entry));
+
+    for (const auto& entry : entries_) {
+        std::uint64_t bytes = static_cast<std::uint64_t>(entry.rows) * entry.cols * sizeof(float);
+        if (entry.offset % alignment != 0 || entry.offset + bytes > file_->size()) {
+            throw std::runtime_error("truncated checkpoint: " + path);
+        }
+    }
+    if (header_.num_state > 0) {
+        std::uint64_t state_end = header_.state_offset +
+                                  (header_.num_state - 1) * align_up(header_.state_elements * sizeof(float)) +
+                                  header_.state_elements * sizeof(float);
+        if (state_end > file_->size()) {
+            throw std::runtime_error("truncated checkpoint: " + path);
+        }
+    }
+}
+
+const float* Checkpoint::payload(std::uint64_t offset) const {
+    return reinterpret_cast<const float*>(file_->data() + offset);
+}
+
+void Checkpoint::check_parameters(const std::vector<std::shared_ptr<Tensor>>& parameters) const {
+    if (parameters.size() != entries_.size()) {
+        throw std::runtime_error("checkpoint holds " + std::to_string(entries_.size()) + " tensors, model has " +
+                                 std::to_string(parameters.size()));
+    }
+    for (std::size_t i = 0; i < parameters.size(); i++) {
+        if (parameters[i]->rows() != static_cast<int>(entries_[i].rows) ||
+            parameters[i]->cols() != static_cast<int>(entries_[i].cols)) {
+            throw std::runtime_error("checkpoint tensor " + std::to_string(i) + " has a different shape");
+        }
+    }
+}
+
+void Checkpoint::load(const std::vector<std::shared_ptr<Tensor>>& parameters, Optimizer* optimizer) const {
+    check_parameters(parameters);
+
+    if (optimizer) {
+        std::vector<std::vector<float>*> state = optimizer->state_buffers();
+        if (state.size() != header_.num_state || optimizer->num_elements() != header_.state_elements) {
+            throw std::runtime_error("checkpoint optimizer state does not match the optimizer");
+        }
+        for (std::size_t k = 0; k < state.size(); k++) {
+            const float* src = payload(header_.state_offset + k * align_up(header_.state_elements * sizeof(float)));
+            std::memcpy(state[k]->data(), src, header_.state_elements * sizeof(float));
+        }
+        optimizer->set_steps(header_.steps);
+    }
+
+    for (std::size_t i = 0; i < parameters.size(); i++) {
+        parameters[i]->data() = Eigen::Map<const Eigen::MatrixXf>(payload(entries_[i].offset), entries_[i].rows,
+                                                                 entries_[i].cols);
+    }
+}
+
+void Checkpoint::map(const std::vector<std::shared_ptr<Tensor>>& parameters) const {
+    check_parameters(parameters);
+
+    float* base = reinterpret_cast<float*>(file_->mutable_data());
+    for (std::size_t i = 0; i < parameters.size(); i++) {
+        parameters[i]->bind_storage(base + entries_[i].offset / sizeof(float), nullptr, file_, false);
+    }
+}
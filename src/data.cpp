@@ -1,7 +1,8 @@
 #include "../include/data.h"
 
-#include <fstream>
+#include <cstring>
 #include <stdexcept>
+#include <utility>
 #include <iostream>
 
 uint32_t swap_endian(uint32_t val) {
@@ -12,22 +13,35 @@ uint32_t swap_endian(uint32_t val) {
            ((val >> 24) & 0x000000FF);
 }
 
-MNISTDataset::MNISTDataset(const std::string& images_file, const std::string& labels_file, int max_samples) {
-    std::ifstream img_file(images_file, std::ios::binary);
-    if (!img_file) {
-        throw std::runtime_error("Cannot open file: " + images_file);
+namespace {
+uint32_t read_header_field(const MappedFile& file, std::size_t index) {
+    uint32_t value;
+    std::memcpy(&value, file.data() + 4 * index, 4);
+    return swap_endian(value);
+}
+}
+
+void normalize_pixels(const std::uint8_t* src, float* dst, std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<float>(src[i]) / 255.0f;
     }
+}
 
-    uint32_t magic, num_images, rows, cols;
-    img_file.read(reinterpret_cast<char*>(&magic), 4);
-    img_file.read(reinterpret_cast<char*>(&num_images), 4);
-    img_file.read(reinterpret_cast<char*>(&rows), 4);
-    img_file.read(reinterpret_cast<char*>(&cols), 4);
+void normalize_pixels(const std::uint8_t* src, int count, Eigen::Ref<Eigen::RowVectorXf, 0, Eigen::InnerStride<>> dst) {
+    dst = Eigen::Map<const Eigen::Matrix<std::uint8_t, 1, Eigen::Dynamic>>(src, count).cast<float>() / 255.0f;
+}
+
+MNISTDataset::MNISTDataset(const std::string& images_file, const std::string& labels_file, int max_samples)
+    : images_file_(images_file), labels_file_(labels_file) {
+
+    if (images_file_.size() < 16) {
+        throw std::runtime_error("invalid MNIST image file format");
+    }
 
-    magic = swap_endian(magic);
-    num_images = swap_endian(num_images);
-    rows = swap_endian(rows);
-    cols = swap_endian(cols);
+    uint32_t magic = read_header_field(images_file_, 0);
+    uint32_t num_images = read_header_field(images_file_, 1);
+    uint32_t rows = read_header_field(images_file_, 2);
+    uint32_t cols = read_header_field(images_file_, 3);
 
     if (magic != 0x803) {
         throw std::runtime_error("invalid MNIST image file format");
@@ -37,57 +51,56 @@ MNISTDataset::MNISTDataset(const std::string& images_file, const std::string& la
         num_images = max_samples;
     }
 
-    int img_size = rows * cols;
-    images_.resize(img_size, num_images);
-
-    std::vector<unsigned char> buffer(img_size);
-    for (uint32_t i = 0; i < num_images; i++) {
-        img_file.read(reinterpret_cast<char*>(buffer.data()), img_size);
-        for (int j = 0; j < img_size; j++) {
-            images_(j, i) = static_cast<float>(buffer[j]) / 255.0f; // normalize
-        }
+    image_size_ = rows * cols;
+    if (images_file_.size() < 16 + static_cast<std::size_t>(num_images) * image_size_) {
+        throw std::runtime_error("truncated MNIST image file: " + images_file);
     }
+    pixels_ = images_file_.data() + 16;
 
-    std::ifstream label_file(labels_file, std::ios::binary);
-    if (!label_file) {
-        throw std::runtime_error("cannot open file: " + labels_file);
+    if (labels_file_.size() < 8) {
+        throw std::runtime_error("invalid MNIST label file format");
     }
 
-    uint32_t label_magic, num_labels;
-    label_file.read(reinterpret_cast<char*>(&label_magic), 4);
-    label_file.read(reinterpret_cast<char*>(&num_labels), 4);
-
-    label_magic = swap_endian(label_magic);
-    num_labels = swap_endian(num_labels);
+    uint32_t label_magic = read_header_field(labels_file_, 0);
+    uint32_t num_labels = read_header_field(labels_file_, 1);
 
     if (label_magic != 0x801) {
         throw std::runtime_error("invalid MNIST label file format");
     }
 
-    if (num_labels < num_images) {
+    if (num_labels < num_images || labels_file_.size() < 8 + static_cast<std::size_t>(num_images)) {
         throw std::runtime_error("number of labels is less than number of images");
     }
+    labels_ = labels_file_.data() + 8;
 
-    labels_.resize(num_images);
-    for (uint32_t i = 0; i < num_images; i++) {
-        unsigned char label;
-        label_file.read(reinterpret_cast<char*>(&label), 1);
-        labels_[i] = static_cast<int>(label);
-    }
+    num_samples_ = static_cast<int>(num_images);
 }
 
 std::pair<std::shared_ptr<Tensor>, std::vector<int>> MNISTDataset::get_batch(
-    int batch_size, int offset) {
+    int batch_size, int offset, Layout layout) const {
 
-    int actual_batch_size = std::min(batch_size, static_cast<int>(labels_.size() - offset));
+    int actual_batch_size = std::min(batch_size, num_samples_ - offset);
 
     if (actual_batch_size <= 0) {
         throw std::runtime_error("invalid batch: offset out of range or batch_size <= 0");
     }
 
-    Eigen::MatrixXf batch_images = images_.block(0, offset, images_.rows(), actual_batch_size);
-    std::vector<int> batch_labels(labels_.begin() + offset,
-                                 labels_.begin() + offset + actual_batch_size);
+    // samples are contiguous in the file, so a feature-major batch is one conversion pass
+    Eigen::MatrixXf batch_images;
+    if (layout == Layout::BatchMajor) {
+        batch_images.resize(actual_batch_size, image_size_);
+        for (int i = 0; i < actual_batch_size; i++) {
+            normalize_pixels(image(offset + i), image_size_, batch_images.row(i));
+        }
+    } else {
+        batch_images.resize(image_size_, actual_batch_size);
+        normalize_pixels(image(offset), batch_images.data(),
+                         static_cast<std::size_t>(image_size_) * actual_batch_size);
+    }
 
-    return {std::make_shared<Tensor>(batch_images), batch_labels};
-}
\ No newline at end of file
+    std::vector<int> batch_labels(labels_ + offset, labels_ + offset + actual_batch_size);
+
+    auto inputs = std::make_shared<Tensor>(std::move(batch_images));
+    inputs->set_layout(layout);
+    return {inputs, std::move(batch_labels)};
+}
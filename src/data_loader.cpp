@@ -0,0 +1,132 @@
+#include "../include/data_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+
+DataLoader::DataLoader(const MNISTDataset& dataset, DataLoaderOptions options)
+    : dataset_(dataset), options_(options), gen_(options.seed) {
+    if (options_.batch_size <= 0) {
+        throw std::runtime_error("invalid batch_size for DataLoader");
+    }
+
+    num_batches_ = dataset_.size() / options_.batch_size;
+    int remainder = dataset_.size() % options_.batch_size;
+    if (remainder > 0 && !options_.drop_last) {
+        num_batches_++;
+        tail_size_ = remainder;
+    }
+
+    order_.resize(dataset_.size());
+    std::iota(order_.begin(), order_.end(), 0);
+
+    // one slot is held by the consumer while the others are being prefetched
+    slots_.resize(std::max(options_.prefetch, 0) + 1);
+    auto make_buffer = [&](int size) {
+        bool batch_major = options_.layout == Layout::BatchMajor;
+        auto buffer = std::make_shared<Tensor>(batch_major ? Eigen::MatrixXf(size, dataset_.image_size())
+                                                           : Eigen::MatrixXf(dataset_.image_size(), size));
+        buffer->set_layout(options_.layout);
+        return buffer;
+    };
+    for (auto& slot : slots_) {
+        slot.full = make_buffer(options_.batch_size);
+        if (tail_size_ > 0) {
+            slot.tail = make_buffer(tail_size_);
+        }
+        slot.batch.targets.reserve(options_.batch_size);
+    }
+
+    if (options_.prefetch > 0 && num_batches_ > 0) {
+        producer_ = std::thread([this]() { produce(); });
+    }
+}
+
+DataLoader::~DataLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (producer_.joinable()) {
+        producer_.join();
+    }
+}
+
+void DataLoader::fill(Slot& slot, long long index) {
+    int position = static_cast<int>(index % num_batches_);
+    if (position == 0 && options_.shuffle) {
+        std::shuffle(order_.begin(), order_.end(), gen_);
+    }
+
+    bool is_tail = tail_size_ > 0 && position == num_batches_ - 1;
+    int size = is_tail ? tail_size_ : options_.batch_size;
+    slot.batch.inputs = is_tail ? slot.tail : slot.full;
+    slot.batch.targets.resize(size);
+
+    auto& inputs = slot.batch.inputs->data();
+    const int image_size = dataset_.image_size();
+    for (int j = 0; j < size; j++) {
+        int sample = order_[position * options_.batch_size + j];
+        if (options_.layout == Layout::BatchMajor) {
+            normalize_pixels(dataset_.image(sample), image_size, inputs.row(j));
+        } else {
+            normalize_pixels(dataset_.image(sample), inputs.data() + static_cast<std::size_t>(j) * image_size,
+                             image_size);
+        }
+        slot.batch.targets[j] = dataset_.label(sample);
+    }
+}
+
+void DataLoader::produce() {
+    const long long capacity = static_cast<long long>(slots_.size());
+    while (true) {
+        long long index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&]() { return stop_ || produced_ - released_ < capacity; });
+            if (stop_) {
+                return;
+            }
+            index = produced_;
+        }
+
+        fill(slots_[index % capacity], index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            produced_++;
+        }
+        cv_.notify_all();
+    }
+}
+
+const DataLoader::Batch* DataLoader::next() {
+    const long long capacity = static_cast<long long>(slots_.size());
+    auto start = std::chrono::steady_clock::now();
+
+    if (producer_.joinable()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_ = consumed_; // the previously returned batch may be overwritten now
+        cv_.notify_all();
+        if (epoch_position_ == num_batches_) {
+            epoch_position_ = 0;
+            return nullptr;
+        }
+        cv_.wait(lock, [&]() { return produced_ > consumed_; });
+    } else {
+        if (epoch_position_ == num_batches_) {
+            epoch_position_ = 0;
+            return nullptr;
+        }
+        fill(slots_[consumed_ % capacity], consumed_);
+    }
+
+    stall_ms_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const Batch* batch = &slots_[consumed_ % capacity].batch;
+    consumed_++;
+    epoch_position_++;
+    return batch;
+}
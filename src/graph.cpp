@@ -0,0 +1,237 @@
+#include "../include/graph.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+thread_local GraphRecorder* active_recorder = nullptr;
+}
+
+GraphRecorder::GraphRecorder() : previous_(active_recorder) {
+    active_recorder = this;
+}
+
+GraphRecorder::~GraphRecorder() {
+    active_recorder = previous_;
+}
+
+void GraphRecorder::record(Record record) {
+    if (record.targets) {
+        record.target_values = *record.targets;
+    }
+    records_.push_back(std::move(record));
+}
+
+GraphRecorder* GraphRecorder::active() {
+    return active_recorder;
+}
+
+StaticGraph StaticGraph::capture(std::shared_ptr<Tensor> inputs, const std::vector<int>& targets,
+                                 const Function& fn) {
+    GraphRecorder recorder;
+    std::vector<std::shared_ptr<Tensor>> results = fn(inputs, targets);
+    if (results.empty() || results[0]->rows() != 1 || results[0]->cols() != 1) {
+        throw std::runtime_error("static graph capture: the first result must be a scalar loss");
+    }
+
+    StaticGraph graph;
+    graph.targets_.push_back(targets);
+    std::unordered_map<const Tensor*, int> slots;
+    std::unordered_map<const Tensor*, int> producers;
+
+    auto add_slot = [&](const std::shared_ptr<Tensor>& t, std::shared_ptr<Tensor> param) {
+        int slot = static_cast<int>(graph.values_.size());
+        graph.values_.push_back(param ? Eigen::MatrixXf() : t->data());
+        graph.grads_.push_back(t->requires_grad() && !param
+                                   ? Eigen::MatrixXf::Zero(t->rows(), t->cols())
+                                   : Eigen::MatrixXf());
+        graph.params_.push_back(std::move(param));
+        graph.requires_grad_.push_back(t->requires_grad());
+        slots[t.get()] = slot;
+        return slot;
+    };
+
+    // leaf tensors: the batch input, bound parameters or frozen constants
+    auto slot_of = [&](const std::shared_ptr<Tensor>& t) {
+        if (!t) {
+            return -1;
+        }
+        auto it = slots.find(t.get());
+        if (it != slots.end()) {
+            return it->second;
+        }
+        if (t == inputs) {
+            graph.input_slot_ = add_slot(t, nullptr);
+            return graph.input_slot_;
+        }
+        return add_slot(t, t->requires_grad() ? t : nullptr);
+    };
+
+    for (const auto& record : recorder.records()) {
+        Instruction instruction{record.op, slot_of(record.a), slot_of(record.b), slot_of(record.c),
+                                -1, -1, record.activation, record.layout, -1};
+        if (record.op == OpCode::NllLoss || record.op == OpCode::CrossEntropy) {
+            if (record.targets == &targets) {
+                instruction.targets = 0;
+            } else {
+                instruction.targets = static_cast<int>(graph.targets_.size());
+                graph.targets_.push_back(record.target_values);
+            }
+        }
+        if (record.op == OpCode::CrossEntropy) {
+            instruction.saved = static_cast<int>(graph.values_.size());
+            graph.values_.push_back(Eigen::MatrixXf::Zero(record.a->batch_size(), 1));
+            graph.grads_.emplace_back();
+            graph.params_.push_back(nullptr);
+            graph.requires_grad_.push_back(false);
+        }
+        instruction.out = add_slot(record.out, nullptr);
+        producers[record.out.get()] = static_cast<int>(graph.forward_.size());
+        graph.forward_.push_back(instruction);
+    }
+
+    for (const auto& result : results) {
+        auto it = slots.find(result.get());
+        if (it == slots.end()) {
+            throw std::runtime_error("static graph capture: result was not produced by a recorded op");
+        }
+        graph.outputs_.push_back(it->second);
+    }
+
+    // backward follows the same order as Tensor::backward, so accumulation matches eager mode
+    std::vector<Tensor*> topo;
+    Tensor::topo_sort(results[0].get(), topo);
+    for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
+        auto producer = producers.find(*it);
+        if (producer != producers.end() && (*it)->requires_grad()) {
+            graph.backward_.push_back(graph.forward_[producer->second]);
+        }
+    }
+
+    return graph;
+}
+
+Eigen::MatrixXf& StaticGraph::inputs() {
+    if (input_slot_ < 0) {
+        throw std::runtime_error("static graph: the captured function does not read its inputs");
+    }
+    return values_[input_slot_];
+}
+
+void StaticGraph::replay(const Eigen::MatrixXf& inputs, const std::vector<int>& targets) {
+    Eigen::MatrixXf& input = this->inputs();
+    if (inputs.rows() != input.rows() || inputs.cols() != input.cols()) {
+        throw std::runtime_error("static graph: input shape differs from the captured one");
+    }
+    if (targets.size() != targets_[0].size()) {
+        throw std::runtime_error("static graph: target count differs from the captured one");
+    }
+
+    input = inputs;
+    std::copy(targets.begin(), targets.end(), targets_[0].begin());
+
+    forward();
+    backward();
+}
+
+void StaticGraph::forward() {
+    for (const auto& in : forward_) {
+        switch (in.op) {
+            case OpCode::Matmul:
+                kernels::matmul(value(in.a), value(in.b), value(in.out));
+                break;
+            case OpCode::Add:
+                kernels::add(value(in.a), value(in.b), value(in.out));
+                break;
+            case OpCode::Relu:
+                kernels::relu(value(in.a), value(in.out));
+                break;
+            case OpCode::LogSoftmax:
+                kernels::log_softmax(value(in.a), in.layout, value(in.out));
+                break;
+            case OpCode::MseLoss:
+                kernels::mse_loss(value(in.a), value(in.b), in.layout, value(in.out));
+                break;
+            case OpCode::NllLoss:
+                kernels::nll_loss(value(in.a), targets_[in.targets].data(), in.layout, value(in.out));
+                break;
+            case OpCode::Reshape:
+                kernels::reshape(value(in.a), value(in.out));
+                break;
+            case OpCode::Linear:
+                kernels::linear(value(in.b), value(in.a), value(in.c), in.activation, in.layout, value(in.out));
+                break;
+            case OpCode::CrossEntropy:
+                kernels::cross_entropy(value(in.a), targets_[in.targets].data(), in.layout, value(in.saved),
+                                       value(in.out));
+                break;
+        }
+    }
+}
+
+void StaticGraph::backward() {
+    if (!requires_grad_[outputs_[0]]) {
+        throw std::runtime_error("static graph: the captured loss does not require grad");
+    }
+
+    for (std::size_t slot = 0; slot < grads_.size(); slot++) {
+        if (!params_[slot] && requires_grad_[slot]) {
+            grads_[slot].setZero();
+        }
+    }
+    grad(outputs_[0])(0, 0) = 1.0f;
+
+    for (const auto& in : backward_) {
+        switch (in.op) {
+            case OpCode::Matmul:
+                if (requires_grad_[in.a]) {
+                    kernels::matmul_backward_a(grad(in.out), value(in.b), grad(in.a));
+                }
+                if (requires_grad_[in.b]) {
+                    kernels::matmul_backward_b(value(in.a), grad(in.out), grad(in.b));
+                }
+                break;
+            case OpCode::Add:
+                if (requires_grad_[in.a]) {
+                    kernels::add_backward(grad(in.out), grad(in.a));
+                }
+                if (requires_grad_[in.b]) {
+                    kernels::add_backward(grad(in.out), grad(in.b));
+                }
+                break;
+            case OpCode::Relu:
+                kernels::relu_backward(value(in.a), grad(in.out), grad(in.a));
+                break;
+            case OpCode::LogSoftmax:
+                kernels::log_softmax_backward(value(in.out), grad(in.out), in.layout, grad(in.a));
+                break;
+            case OpCode::MseLoss:
+                kernels::mse_loss_backward(value(in.a), value(in.b), grad(in.out), in.layout, grad(in.a));
+                break;
+            case OpCode::NllLoss:
+                kernels::nll_loss_backward(targets_[in.targets].data(), grad(in.out), in.layout, grad(in.a));
+                break;
+            case OpCode::Reshape:
+                kernels::reshape_backward(grad(in.out), grad(in.a));
+                break;
+            case OpCode::Linear:
+                // the output's grad is internal to the graph, so it is masked in place
+                kernels::activation_backward(value(in.out), in.activation, grad(in.out), grad(in.out));
+                if (requires_grad_[in.b]) {
+                    kernels::linear_backward_weight(grad(in.out), value(in.a), in.layout, grad(in.b));
+                }
+                if (requires_grad_[in.c]) {
+                    kernels::bias_backward(grad(in.out), in.layout, grad(in.c));
+                }
+                if (requires_grad_[in.a]) {
+                    kernels::linear_backward_input(value(in.b), grad(in.out), in.layout, grad(in.a));
+                }
+                break;
+            case OpCode::CrossEntropy:
+                kernels::cross_entropy_backward(value(in.a), targets_[in.targets].data(), value(in.saved),
+                                                grad(in.out), in.layout, grad(in.a));
+                break;
+        }
+    }
+}
@@ -0,0 +1,859 @@
+#include "../include/kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+const char* op_name(OpCode op) {
+    switch (op) {
+        case OpCode::Matmul: return "matmul";
+        case OpCode::Add: return "add";
+        case OpCode::Relu: return "relu";
+        case OpCode::LogSoftmax: return "log_softmax";
+        case OpCode::MseLoss: return "mse_loss";
+        case OpCode::NllLoss: return "nll_loss";
+        case OpCode::Reshape: return "reshape";
+        case OpCode::Linear: return "linear";
+        case OpCode::CrossEntropy: return "cross_entropy";
+    }
+    return "unknown";
+}
+
+namespace kernels {
+
+void matmul(ConstMatrixRef a, ConstMatrixRef b, MatrixRef out) {
+    out.noalias() = a * b;
+}
+
+void matmul_backward_a(ConstMatrixRef grad_out, ConstMatrixRef b, MatrixRef grad_a) {
+    grad_a.noalias() += grad_out * b.transpose();
+}
+
+void matmul_backward_b(ConstMatrixRef a, ConstMatrixRef grad_out, MatrixRef grad_b) {
+    grad_b.noalias() += a.transpose() * grad_out;
+}
+
+void add(ConstMatrixRef a, ConstMatrixRef b, MatrixRef out) {
+    if (a.rows() == b.rows() && a.cols() == b.cols()) {
+        out = a + b;
+    } else if (a.rows() == b.rows() && b.cols() == 1) {
+        out = a.colwise() + b.col(0);
+    } else if (a.rows() == b.rows() && a.cols() == 1) {
+        out = b.colwise() + a.col(0);
+    } else if (a.cols() == b.cols() && b.rows() == 1) {
+        out = a.rowwise() + b.row(0);
+    } else if (a.cols() == b.cols() && a.rows() == 1) {
+        out = b.rowwise() + a.row(0);
+    } else {
+        throw std::runtime_error("add: shape mismatch");
+    }
+}
+
+void add_backward(ConstMatrixRef grad_out, MatrixRef grad_x) {
+    if (grad_x.rows() == grad_out.rows() && grad_x.cols() == grad_out.cols()) {
+        grad_x += grad_out;
+    } else if (grad_x.rows() == grad_out.rows()) {
+        grad_x.col(0) += grad_out.rowwise().sum();
+    } else {
+        grad_x.row(0) += grad_out.colwise().sum();
+    }
+}
+
+void relu(ConstMatrixRef x, MatrixRef out) {
+    out = x.array().max(0.0f);
+}
+
+void relu_backward(ConstMatrixRef x, ConstMatrixRef grad_out, MatrixRef grad_x) {
+    grad_x.array() += (x.array() > 0.0f).select(grad_out.array(), 0.0f);
+}
+
+namespace {
+// per-thread buffers for per-sample statistics, so the batch reductions do not allocate per call
+Eigen::VectorXf& sample_buffer(int index, Eigen::Index size) {
+    thread_local Eigen::VectorXf buffers[2];
+    buffers[index].resize(size);
+    return buffers[index];
+}
+
+Eigen::Index batch_size(ConstMatrixRef x, Layout layout) {
+    return layout == Layout::BatchMajor ? x.rows() : x.cols();
+}
+}
+
+void log_softmax(ConstMatrixRef x, Layout layout, MatrixRef out) {
+    // out may alias x (log_softmax_): every sample's max is taken before out is written
+    Eigen::VectorXf& max_logit = sample_buffer(0, batch_size(x, layout));
+    Eigen::VectorXf& log_sum = sample_buffer(1, batch_size(x, layout));
+    if (layout == Layout::BatchMajor) {
+        max_logit = x.rowwise().maxCoeff();
+        out = x.colwise() - max_logit;
+        log_sum = out.array().exp().rowwise().sum().log().matrix();
+        out.colwise() -= log_sum;
+    } else {
+        max_logit = x.colwise().maxCoeff().transpose();
+        out = x.rowwise() - max_logit.transpose();
+        log_sum = out.array().exp().colwise().sum().log().matrix().transpose();
+        out.rowwise() -= log_sum.transpose();
+    }
+}
+
+void log_softmax_backward(ConstMatrixRef out, ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x) {
+    // softmax is recovered from the output instead of being kept alive
+    Eigen::VectorXf& sum_grad = sample_buffer(0, batch_size(grad_out, layout));
+    if (layout == Layout::BatchMajor) {
+        sum_grad = grad_out.rowwise().sum();
+        grad_x.array() += grad_out.array() - out.array().exp().colwise() * sum_grad.array();
+    } else {
+        sum_grad = grad_out.colwise().sum().transpose();
+        grad_x.array() += grad_out.array() - out.array().exp().rowwise() * sum_grad.transpose().array();
+    }
+}
+
+void mse_loss(ConstMatrixRef x, ConstMatrixRef target, Layout layout, MatrixRef out) {
+    out(0, 0) = (x - target).array().square().sum() / batch_size(x, layout);
+}
+
+void mse_loss_backward(ConstMatrixRef x, ConstMatrixRef target, ConstMatrixRef grad_out, Layout layout,
+                       MatrixRef grad_x) {
+    grad_x += 2.0f * (x - target) * (grad_out(0, 0) / batch_size(x, layout));
+}
+
+void nll_loss(ConstMatrixRef x, const int* target, Layout layout, MatrixRef out) {
+    const Eigen::Index n = batch_size(x, layout);
+    out(0, 0) = 0.0f;
+    for (Eigen::Index i = 0; i < n; i++) {
+        out(0, 0) -= layout == Layout::BatchMajor ? x(i, target[i]) : x(target[i], i);
+    }
+    out(0, 0) /= n;
+}
+
+void nll_loss_backward(const int* target, ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x) {
+    const Eigen::Index n = batch_size(grad_x, layout);
+    float scale = grad_out(0, 0) / n;
+    for (Eigen::Index i = 0; i < n; i++) {
+        if (layout == Layout::BatchMajor) {
+            grad_x(i, target[i]) -= scale;
+        } else {
+            grad_x(target[i], i) -= scale;
+        }
+    }
+}
+
+void cross_entropy(ConstMatrixRef x, const int* target, Layout layout, MatrixRef log_sum_exp, MatrixRef out) {
+    // the exp is reduced as it is computed, no batch-sized matrix is materialized
+    const Eigen::Index n = batch_size(x, layout);
+    Eigen::VectorXf& max_logit = sample_buffer(0, n);
+    float picked = 0.0f;
+    if (layout == Layout::BatchMajor) {
+        // one class column at a time, so the sum stays vectorized over the batch
+        Eigen::VectorXf& sum_exp = sample_buffer(1, n);
+        max_logit = x.rowwise().maxCoeff();
+        sum_exp.setZero();
+        for (Eigen::Index j = 0; j < x.cols(); j++) {
+            sum_exp.array() += (x.col(j) - max_logit).array().exp();
+        }
+        log_sum_exp.col(0) = sum_exp.array().log().matrix() + max_logit;
+        for (Eigen::Index i = 0; i < n; i++) {
+            picked += x(i, target[i]);
+        }
+    } else {
+        max_logit = x.colwise().maxCoeff().transpose();
+        log_sum_exp.col(0) = (x.rowwise() - max_logit.transpose()).array().exp().colwise().sum().log().matrix().transpose()
+                             + max_logit;
+        for (Eigen::Index i = 0; i < n; i++) {
+            picked += x(target[i], i);
+        }
+    }
+    out(0, 0) = (log_sum_exp.sum() - picked) / n;
+}
+
+void cross_entropy_backward(ConstMatrixRef x, const int* target, ConstMatrixRef log_sum_exp,
+                            ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x) {
+    const Eigen::Index n = batch_size(x, layout);
+    const float scale = grad_out(0, 0) / n;
+    if (layout == Layout::BatchMajor) {
+        grad_x.array() += scale * (x.colwise() - log_sum_exp.col(0)).array().exp();
+        for (Eigen::Index i = 0; i < n; i++) {
+            grad_x(i, target[i]) -= scale;
+        }
+    } else {
+        grad_x.array() += scale * (x.rowwise() - log_sum_exp.col(0).transpose()).array().exp();
+        for (Eigen::Index i = 0; i < n; i++) {
+            grad_x(target[i], i) -= scale;
+        }
+    }
+}
+
+void linear(ConstMatrixRef w, ConstMatrixRef x, ConstMatrixRef b, Activation act, Layout layout, MatrixRef out) {
+    if (layout == Layout::BatchMajor) {
+        out.noalias() = x * w.transpose();
+        if (act == Activation::ReLU) {
+            out.array() = (out.array().rowwise() + b.col(0).transpose().array()).max(0.0f);
+        } else {
+            out.rowwise() += b.col(0).transpose();
+        }
+        return;
+    }
+
+    out.noalias() = w * x;
+    if (act == Activation::ReLU) {
+        out.array() = (out.array().colwise() + b.col(0).array()).max(0.0f);
+    } else {
+        out.colwise() += b.col(0);
+    }
+}
+
+void activation_backward(ConstMatrixRef out, Activation act, ConstMatrixRef grad_out, MatrixRef grad_pre) {
+    if (act == Activation::ReLU) {
+        // out > 0 exactly where the pre-activation was positive
+        grad_pre.array() = (out.array() > 0.0f).select(grad_out.array(), 0.0f);
+    } else if (grad_pre.data() != grad_out.data()) {
+        grad_pre = grad_out;
+    }
+}
+
+void linear_backward_weight(ConstMatrixRef grad_out, ConstMatrixRef x, Layout layout, MatrixRef grad_w) {
+    if (layout == Layout::BatchMajor) {
+        grad_w.noalias() += grad_out.transpose() * x;
+    } else {
+        matmul_backward_a(grad_out, x, grad_w);
+    }
+}
+
+void linear_backward_input(ConstMatrixRef w, ConstMatrixRef grad_out, Layout layout, MatrixRef grad_x) {
+    if (layout == Layout::BatchMajor) {
+        grad_x.noalias() += grad_out * w;
+    } else {
+        matmul_backward_b(w, grad_out, grad_x);
+    }
+}
+
+void bias_backward(ConstMatrixRef grad_out, Layout layout, MatrixRef grad_b) {
+    if (layout == Layout::BatchMajor) {
+        grad_b.col(0) += grad_out.colwise().sum().transpose();
+    } else {
+        grad_b.col(0) += grad_out.rowwise().sum();
+    }
+}
+
+namespace {
+// per-thread scratch of the conv kernels (patches, padded images, filters, grads); it only
+// grows, so layers of different sizes share it without reallocating
+float* conv_scratch(int index, Eigen::Index size) {
+    thread_local std::vector<float> buffers[5];
+    if (static_cast<Eigen::Index>(buffers[index].size()) < size) {
+        buffers[index].resize(size);
+    }
+    return buffers[index].data();
+}
+
+Eigen::Index positions(const Conv2dShape& s) {
+    return static_cast<Eigen::Index>(s.out_height()) * s.out_width();
+}
+
+// unfolds one image into a positions x patch_size matrix whose row p is the receptive field of
+// output pixel p, zero where it covers the padding; written column by column
+void im2col(const float* image, const Conv2dShape& s, float* patches) {
+    const int out_h = s.out_height();
+    const int out_w = s.out_width();
+    for (int c = 0; c < s.channels; c++) {
+        for (int ky = 0; ky < s.kernel; ky++) {
+            for (int kx = 0; kx < s.kernel; kx++) {
+                float* column = patches + ((c * s.kernel + ky) * s.kernel + kx) * positions(s);
+                for (int y = 0; y < out_h; y++) {
+                    float* dst = column + y * out_w;
+                    const int iy = y * s.stride + ky - s.padding;
+                    if (iy < 0 || iy >= s.height) {
+                        std::fill(dst, dst + out_w, 0.0f);
+                        continue;
+                    }
+                    const float* src = image + (c * s.height + iy) * s.width;
+                    for (int x = 0; x < out_w; x++) {
+                        const int ix = x * s.stride + kx - s.padding;
+                        dst[x] = ix >= 0 && ix < s.width ? src[ix] : 0.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// the transpose of im2col: adds every patch entry onto the image pixel it was read from
+void col2im(const float* patches, const Conv2dShape& s, float* image) {
+    const int out_h = s.out_height();
+    const int out_w = s.out_width();
+    for (int c = 0; c < s.channels; c++) {
+        for (int ky = 0; ky < s.kernel; ky++) {
+            for (int kx = 0; kx < s.kernel; kx++) {
+                const float* column = patches + ((c * s.kernel + ky) * s.kernel + kx) * positions(s);
+                for (int y = 0; y < out_h; y++) {
+                    const int iy = y * s.stride + ky - s.padding;
+                    if (iy < 0 || iy >= s.height) {
+                        continue;
+                    }
+                    const float* src = column + y * out_w;
+                    float* dst = image + (c * s.height + iy) * s.width;
+                    for (int x = 0; x < out_w; x++) {
+                        const int ix = x * s.stride + kx - s.padding;
+                        if (ix >= 0 && ix < s.width) {
+                            dst[ix] += src[x];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void im2col_forward(ConstMatrixRef x, ConstMatrixRef w, ConstMatrixRef b, const Conv2dShape& s, MatrixRef out) {
+    Eigen::Map<Eigen::MatrixXf> patches(conv_scratch(0, positions(s) * s.patch_size()), positions(s), s.patch_size());
+    for (Eigen::Index n = 0; n < x.cols(); n++) {
+        im2col(x.col(n).data(), s, patches.data());
+        // positions x out_channels, column-major: exactly the channel-major layout of the output image
+        Eigen::Map<Eigen::MatrixXf> image(out.col(n).data(), positions(s), s.out_channels);
+        image.noalias() = patches * w.transpose();
+        image.rowwise() += b.col(0).transpose();
+    }
+}
+
+void im2col_backward_weight(ConstMatrixRef x, ConstMatrixRef grad_out, const Conv2dShape& s, MatrixRef grad_w) {
+    Eigen::Map<Eigen::MatrixXf> patches(conv_scratch(0, positions(s) * s.patch_size()), positions(s), s.patch_size());
+    for (Eigen::Index n = 0; n < x.cols(); n++) {
+        im2col(x.col(n).data(), s, patches.data());
+        Eigen::Map<const Eigen::MatrixXf> grad(grad_out.col(n).data(), positions(s), s.out_channels);
+        grad_w.noalias() += grad.transpose() * patches;
+    }
+}
+
+void im2col_backward_input(ConstMatrixRef w, ConstMatrixRef grad_out, const Conv2dShape& s, MatrixRef grad_x) {
+    Eigen::Map<Eigen::MatrixXf> patches(conv_scratch(0, positions(s) * s.patch_size()), positions(s), s.patch_size());
+    for (Eigen::Index n = 0; n < grad_out.cols(); n++) {
+        Eigen::Map<const Eigen::MatrixXf> grad(grad_out.col(n).data(), positions(s), s.out_channels);
+        patches.noalias() = grad * w;
+        col2im(patches.data(), s, grad_x.col(n).data());
+    }
+}
+
+// the image inside a zero border of padding pixels, so the direct kernels read every tap without
+// bounds checks; the image itself when there is no padding
+const float* pad_image(const float* image, const Conv2dShape& s, float* padded) {
+    if (s.padding == 0) {
+        return image;
+    }
+    const int h = s.height + 2 * s.padding;
+    const int w = s.width + 2 * s.padding;
+    std::fill(padded, padded + static_cast<Eigen::Index>(s.channels) * h * w, 0.0f);
+    for (int c = 0; c < s.channels; c++) {
+        for (int y = 0; y < s.height; y++) {
+            const float* src = image + (c * s.height + y) * s.width;
+            std::copy(src, src + s.width, padded + (c * h + y + s.padding) * w + s.padding);
+        }
+    }
+    return padded;
+}
+
+// the filters transposed to patch_size x out_channels, so the taps of filter o over channel c
+// are the K * K floats at col(o).data() + c * K * K
+Eigen::Map<Eigen::MatrixXf> transposed_filters(ConstMatrixRef w) {
+    Eigen::Map<Eigen::MatrixXf> filters(conv_scratch(2, w.size()), w.cols(), w.rows());
+    filters = w.transpose();
+    return filters;
+}
+
+// correlates one input plane with a K x K filter at unit stride and adds the result onto out,
+// whose rows are in_stride apart like the input's: output pixel (y, x) sits at y * in_stride + x,
+// so all rows run as one flat loop that vectorizes, with the taps held in registers and every
+// output loaded and stored once; the in_stride - out_w trailing columns of each row are garbage
+template <int K>
+void direct_plane(const float* in, int in_stride, const float* taps, int out_h, int out_w, float* out) {
+    float w[K * K];
+    std::copy(taps, taps + K * K, w);
+    const Eigen::Index length = static_cast<Eigen::Index>(out_h - 1) * in_stride + out_w;
+    for (Eigen::Index i = 0; i < length; i++) {
+        float acc = 0.0f;
+        for (int ky = 0; ky < K; ky++) {
+            for (int kx = 0; kx < K; kx++) {
+                acc += w[ky * K + kx] * in[i + ky * in_stride + kx];
+            }
+        }
+        out[i] += acc;
+    }
+}
+
+// the same for strided convs, row by row into a compact output plane
+template <int K>
+void direct_plane_strided(const float* in, int in_stride, const float* taps, int stride, int out_h, int out_w,
+                          float* out) {
+    float w[K * K];
+    std::copy(taps, taps + K * K, w);
+    for (int y = 0; y < out_h; y++) {
+        const float* rows = in + y * stride * in_stride;
+        float* dst = out + y * out_w;
+        for (int x = 0; x < out_w; x++) {
+            float acc = 0.0f;
+            for (int ky = 0; ky < K; ky++) {
+                for (int kx = 0; kx < K; kx++) {
+                    acc += w[ky * K + kx] * rows[ky * in_stride + x * stride + kx];
+                }
+            }
+            dst[x] += acc;
+        }
+    }
+}
+
+template <int K>
+void direct_forward(ConstMatrixRef x, ConstMatrixRef w, ConstMatrixRef b, const Conv2dShape& s, MatrixRef out) {
+    const int in_h = s.height + 2 * s.padding;
+    const int in_w = s.width + 2 * s.padding;
+    const int out_h = s.out_height();
+    const int out_w = s.out_width();
+    auto filters = transposed_filters(w);
+    float* padded = conv_scratch(1, static_cast<Eigen::Index>(s.channels) * in_h * in_w);
+    float* wide = conv_scratch(3, static_cast<Eigen::Index>(out_h) * in_w);
+    for (Eigen::Index n = 0; n < x.cols(); n++) {
+        const float* image = pad_image(x.col(n).data(), s, padded);
+        for (int o = 0; o < s.out_channels; o++) {
+            float* plane = out.col(n).data() + o * positions(s);
+            if (s.stride != 1) {
+                std::fill(plane, plane + positions(s), b(o, 0));
+                for (int c = 0; c < s.channels; c++) {
+                    direct_plane_strided<K>(image + c * in_h * in_w, in_w, filters.col(o).data() + c * K * K,
+                                            s.stride, out_h, out_w, plane);
+                }
+                continue;
+            }
+            std::fill(wide, wide + static_cast<Eigen::Index>(out_h) * in_w, b(o, 0));
+            for (int c = 0; c < s.channels; c++) {
+                direct_plane<K>(image + c * in_h * in_w, in_w, filters.col(o).data() + c * K * K, out_h, out_w, wide);
+            }
+            for (int y = 0; y < out_h; y++) {
+                std::copy(wide + y * in_w, wide + y * in_w + out_w, plane + y * out_w);
+            }
+        }
+    }
+}
+
+// dw of a filter tap is the output grad dotted with the input shifted by the tap: at unit stride
+// the grads are laid out with the input's row stride and zeros in the extra columns, so each tap
+// is one long dot; strided convs keep a row of partial sums per tap instead, reduced once per
+// filter and channel
+template <int K>
+void direct_backward_weight(ConstMatrixRef x, ConstMatrixRef grad_out, const Conv2dShape& s, MatrixRef grad_w) {
+    using Vector = Eigen::Map<const Eigen::VectorXf>;
+    const int in_h = s.height + 2 * s.padding;
+    const int in_w = s.width + 2 * s.padding;
+    const int out_h = s.out_height();
+    const int out_w = s.out_width();
+    Eigen::Map<Eigen::MatrixXf> filters(conv_scratch(2, grad_w.size()), s.patch_size(), s.out_channels);
+    filters.setZero();
+    float* padded = conv_scratch(1, static_cast<Eigen::Index>(s.channels) * in_h * in_w);
+    const Eigen::Index wide_plane = static_cast<Eigen::Index>(out_h) * in_w;
+    const Eigen::Index length = wide_plane - (in_w - out_w);
+    float* wide = nullptr;
+    float* partial = nullptr;
+    if (s.stride == 1) {
+        // the extra columns stay zero, only the grads are rewritten per sample
+        wide = conv_scratch(3, s.out_channels * wide_plane);
+        std::fill(wide, wide + s.out_channels * wide_plane, 0.0f);
+    } else {
+        partial = conv_scratch(3, K * K * out_w);
+    }
+
+    for (Eigen::Index n = 0; n < x.cols(); n++) {
+        const float* image = pad_image(x.col(n).data(), s, padded);
+        if (s.stride == 1) {
+            for (int o = 0; o < s.out_channels; o++) {
+                for (int y = 0; y < out_h; y++) {
+                    const float* src = grad_out.col(n).data() + (o * out_h + y) * out_w;
+                    std::copy(src, src + out_w, wide + o * wide_plane + y * in_w);
+                }
+            }
+        }
+        for (int o = 0; o < s.out_channels; o++) {
+            const float* grad = grad_out.col(n).data() + o * positions(s);
+            for (int c = 0; c < s.channels; c++) {
+                const float* in = image + c * in_h * in_w;
+                float* taps = filters.col(o).data() + c * K * K;
+                if (s.stride == 1) {
+                    Vector grad_plane(wide + o * wide_plane, length);
+                    for (int ky = 0; ky < K; ky++) {
+                        for (int kx = 0; kx < K; kx++) {
+                            taps[ky * K + kx] += grad_plane.dot(Vector(in + ky * in_w + kx, length));
+                        }
+                    }
+                    continue;
+                }
+                std::fill(partial, partial + K * K * out_w, 0.0f);
+                for (int y = 0; y < out_h; y++) {
+                    const float* grad_row = grad + y * out_w;
+                    for (int ky = 0; ky < K; ky++) {
+                        const float* row = in + (y * s.stride + ky) * in_w;
+                        for (int kx = 0; kx < K; kx++) {
+                            float* sums = partial + (ky * K + kx) * out_w;
+                            for (int x = 0; x < out_w; x++) {
+                                sums[x] += grad_row[x] * row[x * s.stride + kx];
+                            }
+                        }
+                    }
+                }
+                for (int t = 0; t < K * K; t++) {
+                    taps[t] += Vector(partial + t * out_w, out_w).sum();
+                }
+            }
+        }
+    }
+    grad_w += filters.transpose();
+}
+
+// at unit stride dx is the output grad, zero-padded by K - 1, correlated with the flipped filters,
+// so it runs on direct_plane and only the unpadded part is added to grad_x; strided convs scatter
+// every output grad back through the taps as axpys on the padded input rows instead
+template <int K>
+void direct_backward_input(ConstMatrixRef w, ConstMatrixRef grad_out, const Conv2dShape& s, MatrixRef grad_x) {
+    const int in_h = s.height + 2 * s.padding;
+    const int in_w = s.width + 2 * s.padding;
+    const int out_h = s.out_height();
+    const int out_w = s.out_width();
+    const int grad_h = out_h + 2 * (K - 1);
+    const int grad_w = out_w + 2 * (K - 1);
+    const Eigen::Index grad_plane = static_cast<Eigen::Index>(grad_h) * grad_w;
+    auto filters = transposed_filters(w);
+    float* padded = conv_scratch(1, static_cast<Eigen::Index>(s.channels) * in_h * in_w);
+    float* grads = nullptr;
+    float* wide = nullptr;
+    if (s.stride == 1) {
+        // the border stays zero, only the interior is rewritten per sample
+        grads = conv_scratch(3, s.out_channels * grad_plane);
+        std::fill(grads, grads + s.out_channels * grad_plane, 0.0f);
+        wide = conv_scratch(4, static_cast<Eigen::Index>(in_h) * grad_w);
+    }
+    float flipped[K * K];
+
+    for (Eigen::Index n = 0; n < grad_out.cols(); n++) {
+        const float* grad = grad_out.col(n).data();
+        float* dx = grad_x.col(n).data();
+
+        if (s.stride == 1) {
+            for (int o = 0; o < s.out_channels; o++) {
+                for (int y = 0; y < out_h; y++) {
+                    const float* src = grad + (o * out_h + y) * out_w;
+                    std::copy(src, src + out_w, grads + o * grad_plane + (y + K - 1) * grad_w + K - 1);
+                }
+            }
+            for (int c = 0; c < s.channels; c++) {
+                std::fill(wide, wide + static_cast<Eigen::Index>(in_h) * grad_w, 0.0f);
+                for (int o = 0; o < s.out_channels; o++) {
+                    const float* taps = filters.col(o).data() + c * K * K;
+                    std::reverse_copy(taps, taps + K * K, flipped);
+                    direct_plane<K>(grads + o * grad_plane, grad_w, flipped, in_h, in_w, wide);
+                }
+                for (int y = 0; y < s.height; y++) {
+                    const float* src = wide + (y + s.padding) * grad_w + s.padding;
+                    float* dst = dx + (c * s.height + y) * s.width;
+                    for (int x = 0; x < s.width; x++) {
+                        dst[x] += src[x];
+                    }
+                }
+            }
+            continue;
+        }
+
+        float* image = s.padding ? padded : dx;
+        if (s.padding) {
+            std::fill(padded, padded + static_cast<Eigen::Index>(s.channels) * in_h * in_w, 0.0f);
+        }
+        for (int o = 0; o < s.out_channels; o++) {
+            for (int c = 0; c < s.channels; c++) {
+                float* plane = image + c * in_h * in_w;
+                const float* taps = filters.col(o).data() + c * K * K;
+                for (int y = 0; y < out_h; y++) {
+                    const float* grad_row = grad + (o * out_h + y) * out_w;
+                    for (int ky = 0; ky < K; ky++) {
+                        float* row = plane + (y * s.stride + ky) * in_w;
+                        for (int kx = 0; kx < K; kx++) {
+                            const float tap = taps[ky * K + kx];
+                            for (int x = 0; x < out_w; x++) {
+                                row[x * s.stride + kx] += tap * grad_row[x];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (s.padding) {
+            for (int c = 0; c < s.channels; c++) {
+                for (int y = 0; y < s.height; y++) {
+                    const float* src = padded + (c * in_h + y + s.padding) * in_w + s.padding;
+                    float* dst = dx + (c * s.height + y) * s.width;
+                    for (int x = 0; x < s.width; x++) {
+                        dst[x] += src[x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// true if the direct kernels run this conv, which they only do for 3x3 and 5x5 filters
+bool use_direct(ConvAlgorithm algorithm, const Conv2dShape& shape) {
+    if (conv2d_algorithm(algorithm, shape) != ConvAlgorithm::Direct) {
+        return false;
+    }
+    if (shape.kernel != 3 && shape.kernel != 5) {
+        throw std::runtime_error("conv2d: the direct kernel only handles 3x3 and 5x5 filters");
+    }
+    return true;
+}
+}
+
+ConvAlgorithm conv2d_algorithm(ConvAlgorithm algorithm, const Conv2dShape& shape) {
+    if (algorithm != ConvAlgorithm::Auto) {
+        return algorithm;
+    }
+    // strided direct convs lose the flat unit-stride loops and run slower than the gemm (bench_conv)
+    const bool direct = (shape.kernel == 3 || shape.kernel == 5) && shape.stride == 1;
+    return direct ? ConvAlgorithm::Direct : ConvAlgorithm::Im2col;
+}
+
+void conv2d(ConstMatrixRef x, ConstMatrixRef w, ConstMatrixRef b, const Conv2dShape& shape,
+            ConvAlgorithm algorithm, MatrixRef out) {
+    if (!use_direct(algorithm, shape)) {
+        im2col_forward(x, w, b, shape, out);
+    } else if (shape.kernel == 3) {
+        direct_forward<3>(x, w, b, shape, out);
+    } else {
+        direct_forward<5>(x, w, b, shape, out);
+    }
+}
+
+void conv2d_backward_weight(ConstMatrixRef x, ConstMatrixRef grad_out, const Conv2dShape& shape,
+                            ConvAlgorithm algorithm, MatrixRef grad_w) {
+    if (!use_direct(algorithm, shape)) {
+        im2col_backward_weight(x, grad_out, shape, grad_w);
+    } else if (shape.kernel == 3) {
+        direct_backward_weight<3>(x, grad_out, shape, grad_w);
+    } else {
+        direct_backward_weight<5>(x, grad_out, shape, grad_w);
+    }
+}
+
+void conv2d_backward_input(ConstMatrixRef w, ConstMatrixRef grad_out, const Conv2dShape& shape,
+                           ConvAlgorithm algorithm, MatrixRef grad_x) {
+    if (!use_direct(algorithm, shape)) {
+        im2col_backward_input(w, grad_out, shape, grad_x);
+    } else if (shape.kernel == 3) {
+        direct_backward_input<3>(w, grad_out, shape, grad_x);
+    } else {
+        direct_backward_input<5>(w, grad_out, shape, grad_x);
+    }
+}
+
+void conv2d_backward_bias(ConstMatrixRef grad_out, const Conv2dShape& shape, MatrixRef grad_b) {
+    for (Eigen::Index n = 0; n < grad_out.cols(); n++) {
+        Eigen::Map<const Eigen::MatrixXf> grad(grad_out.col(n).data(), positions(shape), shape.out_channels);
+        grad_b.col(0) += grad.colwise().sum().transpose();
+    }
+}
+
+void max_pool2d(ConstMatrixRef x, const Conv2dShape& shape, MatrixRef out, int* argmax) {
+    const int out_h = shape.out_height();
+    const int out_w = shape.out_width();
+    for (Eigen::Index n = 0; n < x.cols(); n++) {
+        const float* image = x.col(n).data();
+        int* arg = argmax + n * out.rows();
+        Eigen::Index k = 0;
+        for (int c = 0; c < shape.channels; c++) {
+            for (int y = 0; y < out_h; y++) {
+                for (int xo = 0; xo < out_w; xo++, k++) {
+                    int best = (c * shape.height + y * shape.stride) * shape.width + xo * shape.stride;
+                    for (int ky = 0; ky < shape.kernel; ky++) {
+                        const int row = (c * shape.height + y * shape.stride + ky) * shape.width + xo * shape.stride;
+                        for (int kx = 0; kx < shape.kernel; kx++) {
+                            if (image[row + kx] > image[best]) {
+                                best = row + kx;
+                            }
+                        }
+                    }
+                    out(k, n) = image[best];
+                    arg[k] = best;
+                }
+            }
+        }
+    }
+}
+
+void max_pool2d_backward(const int* argmax, ConstMatrixRef grad_out, MatrixRef grad_x) {
+    for (Eigen::Index n = 0; n < grad_out.cols(); n++) {
+        const int* arg = argmax + n * grad_out.rows();
+        for (Eigen::Index k = 0; k < grad_out.rows(); k++) {
+            grad_x(arg[k], n) += grad_out(k, n);
+        }
+    }
+}
+
+void avg_pool2d(ConstMatrixRef x, const Conv2dShape& shape, MatrixRef out) {
+    const int out_h = shape.out_height();
+    const int out_w = shape.out_width();
+    const float scale = 1.0f / (shape.kernel * shape.kernel);
+    for (Eigen::Index n = 0; n < x.cols(); n++) {
+        const float* image = x.col(n).data();
+        Eigen::Index k = 0;
+        for (int c = 0; c < shape.channels; c++) {
+            for (int y = 0; y < out_h; y++) {
+                for (int xo = 0; xo < out_w; xo++, k++) {
+                    float sum = 0.0f;
+                    for (int ky = 0; ky < shape.kernel; ky++) {
+                        const float* row = image + (c * shape.height + y * shape.stride + ky) * shape.width
+                                           + xo * shape.stride;
+                        for (int kx = 0; kx < shape.kernel; kx++) {
+                            sum += row[kx];
+                        }
+                    }
+                    out(k, n) = sum * scale;
+                }
+            }
+        }
+    }
+}
+
+void avg_pool2d_backward(ConstMatrixRef grad_out, const Conv2dShape& shape, MatrixRef grad_x) {
+    const int out_h = shape.out_height();
+    const int out_w = shape.out_width();
+    const float scale = 1.0f / (shape.kernel * shape.kernel);
+    for (Eigen::Index n = 0; n < grad_out.cols(); n++) {
+        float* image = grad_x.col(n).data();
+        Eigen::Index k = 0;
+        for (int c = 0; c < shape.channels; c++) {
+            for (int y = 0; y < out_h; y++) {
+                for (int xo = 0; xo < out_w; xo++, k++) {
+                    const float grad = grad_out(k, n) * scale;
+                    for (int ky = 0; ky < shape.kernel; ky++) {
+                        float* row = image + (c * shape.height + y * shape.stride + ky) * shape.width
+                                     + xo * shape.stride;
+                        for (int kx = 0; kx < shape.kernel; kx++) {
+                            row[kx] += grad;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void reshape(ConstMatrixRef x, MatrixRef out) {
+    out = Eigen::Map<const Eigen::MatrixXf>(x.data(), out.rows(), out.cols());
+}
+
+void reshape_backward(ConstMatrixRef grad_out, MatrixRef grad_x) {
+    grad_x += Eigen::Map<const Eigen::MatrixXf>(grad_out.data(), grad_x.rows(), grad_x.cols());
+}
+
+void quantize_s8(const float* x, float inv_scale, std::size_t n, std::int8_t* out) {
+    std::size_t k = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    // NaN -> 0 and clamp in float, where cvtps would turn both NaN and out-of-range values into
+    // INT_MIN, then round to nearest (the default mxcsr mode) and pack 32 -> 16 -> 8 bits
+    const __m128 scale = _mm_set1_ps(inv_scale);
+    const __m128 highest = _mm_set1_ps(127.0f);
+    const __m128 lowest = _mm_set1_ps(-127.0f);
+    auto convert = [&](const float* p) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(p), scale);
+        v = _mm_and_ps(v, _mm_cmpord_ps(v, v));
+        return _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(v, highest), lowest));
+    };
+    for (; k + 16 <= n; k += 16) {
+        __m128i lo = _mm_packs_epi32(convert(x + k), convert(x + k + 4));
+        __m128i hi = _mm_packs_epi32(convert(x + k + 8), convert(x + k + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), _mm_packs_epi16(lo, hi));
+    }
+#endif
+    for (; k < n; k++) {
+        float v = x[k] * inv_scale;
+        v = std::isnan(v) ? 0.0f : std::clamp(v, -127.0f, 127.0f);
+        out[k] = static_cast<std::int8_t>(std::nearbyint(v));
+    }
+}
+
+namespace {
+std::int32_t dot_s8(const std::int16_t* w, const std::int16_t* x, int begin, int end) {
+    std::int32_t sum = 0;
+    for (int k = begin; k < end; k++) {
+        sum += w[k] * x[k];
+    }
+    return sum;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+std::int32_t horizontal_sum(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+#endif
+}
+
+void gemm_s8(const std::int16_t* w, const std::int8_t* x, int rows, int depth, int cols, std::int32_t* out) {
+    // w comes pre-widened, so only x columns are widened here, two at a time into a per-thread
+    // scratch; each 8-wide chunk of 4 weight rows is used for both, with products pairwise
+    // summed into int32 lanes by madd
+    thread_local std::vector<std::int16_t> widened;
+    if (widened.size() < static_cast<std::size_t>(depth) * 2) {
+        widened.resize(static_cast<std::size_t>(depth) * 2);
+    }
+    const int full = depth / 8 * 8;
+
+    for (int j = 0; j < cols; j += 2) {
+        const int n = std::min(2, cols - j);
+        for (int c = 0; c < 2; c++) {
+            // a missing second column repeats the first, its results are not stored
+            const std::int8_t* xj = x + static_cast<std::size_t>(j + (c < n ? c : 0)) * depth;
+            for (int k = 0; k < depth; k++) {
+                widened[static_cast<std::size_t>(c) * depth + k] = xj[k];
+            }
+        }
+        const std::int16_t* x0 = widened.data();
+        const std::int16_t* x1 = widened.data() + depth;
+
+        int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i + 4 <= rows; i += 4) {
+            __m128i acc0[4], acc1[4];
+            for (int r = 0; r < 4; r++) {
+                acc0[r] = _mm_setzero_si128();
+                acc1[r] = _mm_setzero_si128();
+            }
+            for (int k = 0; k < full; k += 8) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x0 + k));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x1 + k));
+                for (int r = 0; r < 4; r++) {
+                    __m128i wr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + static_cast<std::size_t>(i + r) * depth + k));
+                    acc0[r] = _mm_add_epi32(acc0[r], _mm_madd_epi16(wr, a));
+                    acc1[r] = _mm_add_epi32(acc1[r], _mm_madd_epi16(wr, b));
+                }
+            }
+            for (int r = 0; r < 4; r++) {
+                const std::int16_t* wr = w + static_cast<std::size_t>(i + r) * depth;
+                out[static_cast<std::size_t>(j) * rows + i + r] = horizontal_sum(acc0[r]) + dot_s8(wr, x0, full, depth);
+                if (n == 2) {
+                    out[static_cast<std::size_t>(j + 1) * rows + i + r] = horizontal_sum(acc1[r]) + dot_s8(wr, x1, full, depth);
+                }
+            }
+        }
+#endif
+        for (; i < rows; i++) {
+            const std::int16_t* wr = w + static_cast<std::size_t>(i) * depth;
+            out[static_cast<std::size_t>(j) * rows + i] = dot_s8(wr, x0, 0, depth);
+            if (n == 2) {
+                out[static_cast<std::size_t>(j + 1) * rows + i] = dot_s8(wr, x1, 0, depth);
+            }
+        }
+    }
+}
+
+} // namespace kernels
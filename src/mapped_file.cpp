@@ -0,0 +1,93 @@
+#include "../include/mapped_file.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define KRYKHITGRAD_HAS_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string& path, bool copy_on_write) : writable_(copy_on_write) {
+#ifdef KRYKHITGRAD_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open file: " + path);
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot stat file: " + path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+
+    if (size_ > 0) {
+        int protection = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* p = ::mmap(nullptr, size_, protection, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("cannot map file: " + path);
+        }
+        data_ = static_cast<unsigned char*>(p);
+        mapped_ = true;
+    }
+    ::close(fd); // the mapping keeps the file alive
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("cannot open file: " + path);
+    }
+    size_ = static_cast<std::size_t>(file.tellg());
+    buffer_.resize(size_);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(buffer_.data()), size_);
+    data_ = buffer_.data();
+#endif
+}
+
+void MappedFile::release() {
+#ifdef KRYKHITGRAD_HAS_MMAP
+    if (mapped_) {
+        ::munmap(data_, size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    writable_ = false;
+    buffer_.clear();
+}
+
+unsigned char* MappedFile::mutable_data() {
+    if (!writable_) {
+        throw std::runtime_error("mapped file was not opened copy-on-write");
+    }
+    return data_;
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+      mapped_(std::exchange(other.mapped_, false)), writable_(std::exchange(other.writable_, false)),
+      buffer_(std::move(other.buffer_)) {
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        mapped_ = std::exchange(other.mapped_, false);
+        writable_ = std::exchange(other.writable_, false);
+        buffer_ = std::move(other.buffer_);
+    }
+    return *this;
+}
@@ -1,44 +1,182 @@
 #include "../include/nn.h"
+#include <algorithm>
+#include <cmath>
+#include <new>
 #include <random>
+#include <unordered_set>
+#include <utility>
 
-Linear::Linear(int in_features, int out_features)
-    : in_features_(in_features), out_features_(out_features) {
+namespace {
+std::shared_ptr<float> allocate_aligned(std::size_t size) {
+    constexpr std::align_val_t alignment{64};
+    float* data = static_cast<float*>(::operator new(std::max<std::size_t>(size, 1) * sizeof(float), alignment));
+    return std::shared_ptr<float>(data, [alignment](float* p) { ::operator delete(p, alignment); });
+}
 
-    float std_dev = std::sqrt(2.0f / (in_features + out_features)); // xavier init
+// rows x cols weights drawn from a normal with xavier's variance 2 / (fan_in + fan_out)
+Eigen::MatrixXf xavier_init(int rows, int cols, int fan_in, int fan_out) {
+    float std_dev = std::sqrt(2.0f / (fan_in + fan_out));
 
     std::random_device rd;
     std::mt19937 gen(rd());
     std::normal_distribution<float> dist(0.0f, std_dev);
 
-    Eigen::MatrixXf w(out_features, in_features);
-    for (int i = 0; i < out_features; ++i) {
-        for (int j = 0; j < in_features; ++j) {
+    Eigen::MatrixXf w(rows, cols);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
             w(i, j) = dist(gen);
         }
     }
+    return w;
+}
+
+float clip_scale(float norm, float max_norm) {
+    return norm > max_norm ? max_norm / (norm + 1e-6f) : 1.0f;
+}
+}
+
+ParameterBuffer::ParameterBuffer(const std::vector<std::shared_ptr<Tensor>>& parameters) {
+    std::unordered_set<const Tensor*> seen; // shared parameters are packed once
+    std::vector<Tensor*> unique;
+    for (const auto& p : parameters) {
+        if (seen.insert(p.get()).second) {
+            unique.push_back(p.get());
+            size_ += p->data().size();
+        }
+    }
+
+    data_ = allocate_aligned(size_);
+    grad_ = allocate_aligned(size_);
+    grad().setZero();
+
+    // the tensors keep both buffers alive, even if the ParameterBuffer goes away
+    auto owner = std::make_shared<std::pair<std::shared_ptr<float>, std::shared_ptr<float>>>(data_, grad_);
+    std::size_t offset = 0;
+    for (Tensor* p : unique) {
+        p->bind_storage(data_.get() + offset, p->requires_grad() ? grad_.get() + offset : nullptr, owner);
+        offset += p->data().size();
+    }
+}
+
+float ParameterBuffer::clip_grad_norm(float max_norm) {
+    float norm = grad().norm();
+    float scale = clip_scale(norm, max_norm);
+    if (scale < 1.0f) {
+        grad() *= scale;
+    }
+    return norm;
+}
+
+float Module::clip_grad_norm(float max_norm) {
+    if (flat_) {
+        return flat_->clip_grad_norm(max_norm);
+    }
+
+    auto params = parameters();
+    float squared = 0.0f;
+    for (auto& p : params) {
+        if (p->requires_grad()) {
+            squared += p->grad().squaredNorm();
+        }
+    }
+    float norm = std::sqrt(squared);
+    float scale = clip_scale(norm, max_norm);
+    if (scale < 1.0f) {
+        for (auto& p : params) {
+            if (p->requires_grad()) {
+                p->grad() *= scale;
+            }
+        }
+    }
+    return norm;
+}
+
+Linear::Linear(int in_features, int out_features)
+    : in_features_(in_features), out_features_(out_features) {
 
-    weight_ = std::make_shared<Tensor>(w, true, "weight");
+    weight_ = std::make_shared<Tensor>(xavier_init(out_features, in_features, in_features, out_features), true, "weight");
 
     Eigen::MatrixXf b = Eigen::MatrixXf::Zero(out_features, 1);
     bias_ = std::make_shared<Tensor>(b, true, "bias");
 }
 
 std::shared_ptr<Tensor> Linear::forward(std::shared_ptr<Tensor> x) {
-    auto out = weight_->matmul(x);
+    return x->linear(weight_, bias_, Activation::None);
+}
+
+std::shared_ptr<Tensor> Linear::forward(std::shared_ptr<Tensor> x, Activation act) {
+    return x->linear(weight_, bias_, act);
+}
+
+Conv2d::Conv2d(int in_channels, int out_channels, int kernel_size, int height, int width, int stride, int padding,
+               ConvAlgorithm algorithm)
+    : shape_{in_channels, height, width, out_channels, kernel_size, stride, padding}, algorithm_(algorithm) {
+
+    // each output sees channels * kernel^2 inputs, and each input feeds out_channels * kernel^2 outputs
+    const int fan_in = in_channels * kernel_size * kernel_size;
+    const int fan_out = out_channels * kernel_size * kernel_size;
+    weight_ = std::make_shared<Tensor>(xavier_init(out_channels, fan_in, fan_in, fan_out), true, "weight");
+
+    Eigen::MatrixXf b = Eigen::MatrixXf::Zero(out_channels, 1);
+    bias_ = std::make_shared<Tensor>(b, true, "bias");
+}
+
+std::shared_ptr<Tensor> Conv2d::forward(std::shared_ptr<Tensor> x) {
+    return x->conv2d(weight_, bias_, shape_, algorithm_);
+}
+
+MaxPool2d::MaxPool2d(int channels, int height, int width, int kernel_size, int stride)
+    : shape_{channels, height, width, channels, kernel_size, stride > 0 ? stride : kernel_size} {
+}
 
-    Eigen::MatrixXf expanded_bias = bias_->data().replicate(1, x->data().cols());
-    auto bias_tensor = std::make_shared<Tensor>(expanded_bias);
+AvgPool2d::AvgPool2d(int channels, int height, int width, int kernel_size, int stride)
+    : shape_{channels, height, width, channels, kernel_size, stride > 0 ? stride : kernel_size} {
+}
 
-    return out->add(bias_tensor);
+Sequential::Sequential(const std::vector<std::shared_ptr<Module>>& modules)
+    : modules_(modules), fused_relu_(modules.size(), nullptr) {
+    // resolved once here, so forward does no casts
+    for (std::size_t i = 0; i + 1 < modules_.size(); i++) {
+        if (dynamic_cast<ReLU*>(modules_[i + 1].get())) {
+            fused_relu_[i] = dynamic_cast<Linear*>(modules_[i].get());
+        }
+    }
+}
+
+std::shared_ptr<Tensor> Sequential::forward_range(std::shared_ptr<Tensor> x,
+                                                  const std::vector<std::shared_ptr<Module>>& modules,
+                                                  const std::vector<Linear*>& fused, std::size_t begin, std::size_t end) {
+    auto out = x;
+    for (std::size_t i = begin; i < end; i++) {
+        if (fused[i] && i + 1 < end) {
+            out = fused[i]->forward(out, Activation::ReLU);
+            i++;
+        } else {
+            out = modules[i]->forward(out);
+        }
+    }
+    return out;
 }
 
 std::shared_ptr<Tensor> Sequential::forward(std::shared_ptr<Tensor> x) {
+    if (segment_layers_ <= 0) {
+        return forward_range(x, modules_, fused_relu_, 0, modules_.size());
+    }
+
     auto out = x;
-    for (auto& module : modules_) {
-        out = std::dynamic_pointer_cast<Linear>(module)->forward(out);
-        if (module != modules_.back()) {
-            out = out->relu();
+    for (std::size_t begin = 0; begin < modules_.size(); begin += segment_layers_) {
+        std::size_t end = std::min(begin + segment_layers_, modules_.size());
+        std::vector<std::shared_ptr<Tensor>> params;
+        for (std::size_t i = begin; i < end; i++) {
+            auto module_params = modules_[i]->parameters();
+            params.insert(params.end(), module_params.begin(), module_params.end());
         }
+        // the segment owns its layers, so the recompute in backward outlives this Sequential
+        std::vector<std::shared_ptr<Module>> layers(modules_.begin() + begin, modules_.begin() + end);
+        std::vector<Linear*> fused(fused_relu_.begin() + begin, fused_relu_.begin() + end);
+        out = checkpoint([layers=std::move(layers), fused=std::move(fused)](std::shared_ptr<Tensor> in) {
+            return forward_range(in, layers, fused, 0, layers.size());
+        }, out, params);
     }
     return out;
 }
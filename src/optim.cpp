@@ -1,7 +1,171 @@
 #include "../include/optim.h"
+#include "../include/thread_pool.h"
 
-void SGD::step() {
-    for (auto& param : parameters_) {
-        param->data() -= lr_ * param->grad();
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+// small enough that a chunk of every buffer an update touches stays in l1/l2 between
+// its vectorized passes, large enough to amortize the per-chunk dispatch
+constexpr std::size_t chunk_size = 4096;
+
+using Array = Eigen::Map<Eigen::ArrayXf>;
+using ConstArray = Eigen::Map<const Eigen::ArrayXf>;
+}
+
+Optimizer::Optimizer(const std::vector<std::shared_ptr<Tensor>>& parameters)
+    : parameters_(parameters) {
+    build_chunks();
+}
+
+bool Optimizer::is_contiguous() const {
+    if (parameters_.empty()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < parameters_.size(); i++) {
+        const Tensor& p = *parameters_[i];
+        if (!p.requires_grad()) {
+            return false;
+        }
+        if (i > 0) {
+            const Tensor& prev = *parameters_[i - 1];
+            if (p.data().data() != prev.data().data() + prev.data().size() ||
+                p.grad().data() != prev.grad().data() + prev.grad().size()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Optimizer::build_chunks() {
+    // state offsets are the same in both layouts, so rebuilding keeps the state valid
+    chunks_.clear();
+    num_elements_ = 0;
+    contiguous_ = is_contiguous();
+
+    if (contiguous_) {
+        // chunks of one range starting at the first parameter
+        for (const auto& p : parameters_) {
+            num_elements_ += p->data().size();
+        }
+        for (std::size_t begin = 0; begin < num_elements_; begin += chunk_size) {
+            chunks_.push_back({0, begin, begin, std::min(chunk_size, num_elements_ - begin)});
+        }
+        return;
+    }
+
+    for (int i = 0; i < static_cast<int>(parameters_.size()); i++) {
+        if (!parameters_[i]->requires_grad()) {
+            continue;
+        }
+        std::size_t size = parameters_[i]->data().size();
+        for (std::size_t begin = 0; begin < size; begin += chunk_size) {
+            chunks_.push_back({i, begin, num_elements_ + begin, std::min(chunk_size, size - begin)});
+        }
+        num_elements_ += size;
+    }
+}
+
+void Optimizer::zero_grad() {
+    if (contiguous_ && is_contiguous()) {
+        Array(parameters_[0]->grad().data(), num_elements_).setZero();
+        return;
+    }
+    for (auto& p : parameters_) {
+        p->zero_grad();
+    }
+}
+
+void Optimizer::for_each_chunk(const ChunkFn& fn) {
+    // parameters may have been rebound since (flattened, or mapped from a checkpoint)
+    if (contiguous_ != is_contiguous()) {
+        build_chunks();
+    }
+
+    auto run = [&](int i) {
+        const Chunk& chunk = chunks_[i];
+        Tensor& param = *parameters_[chunk.parameter];
+        fn(param.data().data() + chunk.begin, param.grad().data() + chunk.begin, chunk.offset, chunk.size);
+    };
+
+    if (pool_) {
+        pool_->parallel_for(static_cast<int>(chunks_.size()), run);
+    } else {
+        for (int i = 0; i < static_cast<int>(chunks_.size()); i++) {
+            run(i);
+        }
     }
-}
\ No newline at end of file
+}
+
+SGD::SGD(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate,
+         float momentum, bool nesterov, float weight_decay)
+    : Optimizer(parameters), lr_(learning_rate), momentum_(momentum), nesterov_(nesterov),
+      weight_decay_(weight_decay) {
+    if (nesterov_ && momentum_ <= 0.0f) {
+        throw std::runtime_error("nesterov momentum requires momentum > 0");
+    }
+    if (momentum_ != 0.0f) {
+        velocity_.assign(num_elements_, 0.0f);
+    }
+}
+
+void SGD::step() {
+    steps_++;
+    for_each_chunk([this](float* data, const float* grad, std::size_t offset, std::size_t size) {
+        Array p(data, size);
+        ConstArray g(grad, size);
+
+        if (momentum_ == 0.0f && weight_decay_ == 0.0f) {
+            p -= lr_ * g;
+            return;
+        }
+
+        Array v(velocity_.data() + offset, size);
+        if (momentum_ == 0.0f) {
+            p -= lr_ * (g + weight_decay_ * p);
+        } else if (nesterov_) {
+            v = momentum_ * v + (g + weight_decay_ * p);
+            p -= lr_ * (g + weight_decay_ * p + momentum_ * v);
+        } else {
+            v = momentum_ * v + (g + weight_decay_ * p);
+            p -= lr_ * v;
+        }
+    });
+}
+
+Adam::Adam(const std::vector<std::shared_ptr<Tensor>>& parameters, float learning_rate, float beta1,
+           float beta2, float eps, float weight_decay, bool decoupled)
+    : Optimizer(parameters), lr_(learning_rate), beta1_(beta1), beta2_(beta2), eps_(eps),
+      weight_decay_(weight_decay), decoupled_(decoupled),
+      m_(num_elements_, 0.0f), v_(num_elements_, 0.0f) {
+}
+
+void Adam::step() {
+    steps_++;
+    // bias corrections folded into two scalars, so the per-element work is one pass
+    const float step_size = lr_ / (1.0f - std::pow(beta1_, static_cast<float>(steps_)));
+    const float inv_sqrt_correction = 1.0f / std::sqrt(1.0f - std::pow(beta2_, static_cast<float>(steps_)));
+    const float l2 = decoupled_ ? 0.0f : weight_decay_;
+    const float decay = decoupled_ ? 1.0f - lr_ * weight_decay_ : 1.0f;
+
+    for_each_chunk([&](float* data, const float* grad, std::size_t offset, std::size_t size) {
+        Array p(data, size);
+        ConstArray g(grad, size);
+        Array m(m_.data() + offset, size);
+        Array v(v_.data() + offset, size);
+
+        if (l2 != 0.0f) {
+            m = beta1_ * m + (1.0f - beta1_) * (g + l2 * p);
+            v = beta2_ * v + (1.0f - beta2_) * (g + l2 * p).square();
+        } else {
+            m = beta1_ * m + (1.0f - beta1_) * g;
+            v = beta2_ * v + (1.0f - beta2_) * g.square();
+        }
+        if (decay != 1.0f) {
+            p *= decay;
+        }
+        p -= step_size * m / (v.sqrt() * inv_sqrt_correction + eps_);
+    });
+}
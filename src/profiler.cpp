@@ -0,0 +1,199 @@
+#include "../include/profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+std::atomic<Profiler*> Profiler::active_{nullptr};
+std::atomic<int> Profiler::entering_{0};
+thread_local int Profiler::open_on_thread_ = 0;
+
+namespace {
+// serializes start and stop, so a start that loses to another profiler touches nothing
+std::mutex activation_mutex;
+
+// small per-thread ids for the trace, in order of first use
+int thread_index() {
+    static std::atomic<int> next{0};
+    thread_local int index = next++;
+    return index;
+}
+
+const char* phase_name(ProfilePhase phase) {
+    switch (phase) {
+        case ProfilePhase::Forward: return "forward";
+        case ProfilePhase::Backward: return "backward";
+        case ProfilePhase::Scope: return "scope";
+    }
+    return "unknown";
+}
+
+// a json string body: quotes, backslashes and control characters escaped
+void write_escaped(std::ostream& out, const char* text) {
+    for (const char* c = text; *c; c++) {
+        switch (*c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(*c) < 0x20) {
+                    const char* digits = "0123456789abcdef";
+                    out << "\\u00" << digits[(*c >> 4) & 0xf] << digits[*c & 0xf];
+                } else {
+                    out << *c;
+                }
+        }
+    }
+}
+}
+
+Profiler::~Profiler() {
+    std::lock_guard<std::mutex> activation(activation_mutex);
+    if (active_.load() == this) {
+        assert(open_on_thread_ == 0 && "Profiler destroyed inside one of its own scopes");
+        detach();
+    }
+}
+
+void Profiler::start() {
+    std::lock_guard<std::mutex> activation(activation_mutex);
+    Profiler* current = active_.load();
+    if (current && current != this) {
+        throw std::runtime_error("Profiler::start: another profiler is already recording");
+    }
+    // a restart first waits out the scopes still timing against the old origin
+    if (current == this) {
+        deactivate();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.clear();
+        origin_ = std::chrono::steady_clock::now();
+    }
+    active_.store(this);
+}
+
+void Profiler::stop() {
+    std::lock_guard<std::mutex> activation(activation_mutex);
+    if (active_.load() == this) {
+        deactivate();
+    }
+}
+
+void Profiler::deactivate() {
+    if (open_on_thread_ > 0) {
+        throw std::logic_error("Profiler::stop: called inside one of the profiler's own scopes");
+    }
+    detach();
+}
+
+void Profiler::detach() noexcept {
+    active_.store(nullptr);
+    // a scope that found this profiler registers before entering_ drops back, and new scopes
+    // see nullptr, so once both counts reach zero nothing can touch the profiler any more
+    while (entering_.load() != 0 || open_scopes_.load(std::memory_order_acquire) > open_on_thread_) {
+        std::this_thread::yield();
+    }
+}
+
+void Profiler::record(const ProfileEvent& event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(event);
+    ProfileEvent& stored = events_.back();
+    stored.name = names_.insert(event.name).first->c_str();
+    stored.thread = thread_index();
+}
+
+std::vector<ProfileEvent> Profiler::events() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return events_;
+}
+
+void Profiler::print_summary(std::ostream& out) const {
+    struct Row {
+        long long calls = 0;
+        std::int64_t total_ns = 0;
+        double flops = 0.0;
+        std::size_t bytes = 0;
+    };
+
+    std::vector<ProfileEvent> events = this->events();
+    std::map<std::pair<std::string, ProfilePhase>, Row> rows;
+    std::int64_t begin = events.empty() ? 0 : events.front().start_ns;
+    std::int64_t end = begin;
+    for (const auto& event : events) {
+        Row& row = rows[{event.name, event.phase}];
+        row.calls++;
+        row.total_ns += event.duration_ns;
+        row.flops += event.flops;
+        row.bytes += event.bytes;
+        begin = std::min(begin, event.start_ns);
+        end = std::max(end, event.start_ns + event.duration_ns);
+    }
+
+    std::vector<std::pair<const std::pair<std::string, ProfilePhase>*, const Row*>> sorted;
+    for (const auto& [key, row] : rows) {
+        sorted.push_back({&key, &row});
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second->total_ns > b.second->total_ns;
+    });
+
+    const double wall_ns = std::max<std::int64_t>(end - begin, 1);
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::left << std::setw(16) << "op" << std::setw(10) << "phase" << std::right
+        << std::setw(9) << "calls" << std::setw(12) << "total ms" << std::setw(11) << "mean us"
+        << std::setw(9) << "% wall" << std::setw(10) << "GFLOP/s" << std::setw(11) << "MiB" << "\n";
+    out << std::fixed;
+    for (const auto& [key, row] : sorted) {
+        out << std::left << std::setw(16) << key->first << std::setw(10) << phase_name(key->second) << std::right
+            << std::setw(9) << row->calls
+            << std::setprecision(3) << std::setw(12) << row->total_ns / 1e6
+            << std::setw(11) << row->total_ns / 1e3 / row->calls
+            << std::setprecision(1) << std::setw(9) << 100.0 * row->total_ns / wall_ns
+            << std::setprecision(2) << std::setw(10) << (row->total_ns > 0 ? row->flops / row->total_ns : 0.0)
+            << std::setw(11) << row->bytes / (1024.0 * 1024.0) << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void Profiler::write_trace(std::ostream& out) const {
+    std::vector<ProfileEvent> events = this->events();
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[";
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const ProfileEvent& event = events[i];
+        // complete ("X") events, timestamps in microseconds
+        out << (i ? ",\n" : "\n") << "{\"name\":\"";
+        write_escaped(out, event.name);
+        out << "\",\"cat\":\"" << phase_name(event.phase)
+            << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+            << ",\"ts\":" << event.start_ns / 1000.0 << ",\"dur\":" << event.duration_ns / 1000.0
+            << ",\"args\":{\"flops\":" << event.flops << ",\"bytes\":" << event.bytes << ",\"shapes\":\"";
+        for (int s = 0; s < event.num_shapes; s++) {
+            out << (s ? " " : "") << event.shapes[s][0] << "x" << event.shapes[s][1];
+        }
+        out << "\"}}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void Profiler::write_trace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Profiler::write_trace: cannot open " + path);
+    }
+    write_trace(file);
+}
@@ -0,0 +1,139 @@
+#include "../include/quantize.h"
+#include "../include/kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+constexpr float int8_max = 127.0f;
+
+float scale_for(float max_abs) {
+    return max_abs > 0.0f ? max_abs / int8_max : 1.0f;
+}
+
+std::vector<float> calibrate(const std::vector<Linear*>& layers,
+                             const std::vector<std::shared_ptr<Tensor>>& batches) {
+    if (batches.empty()) {
+        throw std::runtime_error("quantization needs at least one calibration batch");
+    }
+
+    NoGradGuard no_grad;
+    std::vector<float> input_max(layers.size(), 0.0f);
+    for (const auto& batch : batches) {
+        auto x = batch;
+        for (std::size_t i = 0; i < layers.size(); i++) {
+            input_max[i] = std::max(input_max[i], x->data().cwiseAbs().maxCoeff());
+            x = layers[i]->forward(x, i + 1 < layers.size() ? Activation::ReLU : Activation::None);
+        }
+    }
+    return input_max;
+}
+}
+
+QuantizedLinear::QuantizedLinear(const Linear& layer, float input_max)
+    : weight_(static_cast<std::size_t>(layer.out_features()) * layer.in_features()),
+      weight_scales_(layer.out_features()),
+      bias_(layer.bias()->data().col(0)),
+      input_scale_(scale_for(input_max)),
+      in_features_(layer.in_features()),
+      out_features_(layer.out_features()) {
+    const auto& w = layer.weight()->data();
+    for (int i = 0; i < out_features_; i++) {
+        float scale = scale_for(w.row(i).cwiseAbs().maxCoeff());
+        weight_scales_(i) = scale;
+        for (int j = 0; j < in_features_; j++) {
+            float q = std::round(w(i, j) / scale);
+            weight_[static_cast<std::size_t>(i) * in_features_ + j] = static_cast<std::int16_t>(std::clamp(q, -int8_max, int8_max));
+        }
+    }
+}
+
+Eigen::MatrixXf QuantizedLinear::forward(kernels::ConstMatrixRef x, Activation act) const {
+    if (x.rows() != in_features_) {
+        throw std::runtime_error("quantized linear: input has the wrong number of features");
+    }
+
+    using MatrixS8 = Eigen::Matrix<std::int8_t, Eigen::Dynamic, Eigen::Dynamic>;
+    using MatrixS32 = Eigen::Matrix<std::int32_t, Eigen::Dynamic, Eigen::Dynamic>;
+
+    // the quantizer reads x as one flat array, so a strided block (e.g. middleRows of a batch) is packed first
+    Eigen::MatrixXf packed;
+    const float* values = x.data();
+    if (x.innerStride() != 1 || x.outerStride() != x.rows()) {
+        packed = x;
+        values = packed.data();
+    }
+    MatrixS8 xq(in_features_, x.cols());
+    kernels::quantize_s8(values, 1.0f / input_scale_, static_cast<std::size_t>(x.size()), xq.data());
+    MatrixS32 acc(out_features_, x.cols());
+    kernels::gemm_s8(weight_.data(), xq.data(), out_features_, in_features_, static_cast<int>(x.cols()), acc.data());
+
+    // dequantize with the product of both scales, add the bias and apply act in one pass
+    Eigen::VectorXf scales = weight_scales_ * input_scale_;
+    Eigen::MatrixXf out(out_features_, x.cols());
+    out.array() = (acc.cast<float>().array().colwise() * scales.array()).colwise() + bias_.array();
+    if (act == Activation::ReLU) {
+        out.array() = out.array().max(0.0f);
+    }
+    return out;
+}
+
+QuantizedSequential::QuantizedSequential(const std::vector<Linear*>& layers,
+                                         const std::vector<std::shared_ptr<Tensor>>& calibration_batches) {
+    std::vector<float> input_max = calibrate(layers, calibration_batches);
+    for (std::size_t i = 0; i < layers.size(); i++) {
+        layers_.emplace_back(*layers[i], input_max[i]);
+    }
+}
+
+QuantizedSequential::QuantizedSequential(const std::vector<Linear*>& layers, const MNISTDataset& dataset,
+                                         int num_batches, int batch_size)
+    : QuantizedSequential(layers, [&]() {
+          std::vector<std::shared_ptr<Tensor>> batches;
+          for (int b = 0; b < num_batches && b * batch_size < dataset.size(); b++) {
+              batches.push_back(dataset.get_batch(batch_size, b * batch_size).first);
+          }
+          return batches;
+      }()) {
+}
+
+std::vector<Linear*> QuantizedSequential::layers_of(const Sequential& model) {
+    // linear, relu, linear, ..., linear
+    const auto& modules = model.modules();
+    bool valid = modules.size() % 2 == 1;
+    std::vector<Linear*> layers;
+    for (std::size_t i = 0; valid && i < modules.size(); i++) {
+        if (i % 2 == 1) {
+            valid = dynamic_cast<ReLU*>(modules[i].get()) != nullptr;
+        } else if (auto* linear = dynamic_cast<Linear*>(modules[i].get())) {
+            layers.push_back(linear);
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid) {
+        throw std::runtime_error("quantization supports Sequential models of Linear layers with ReLU between them only");
+    }
+    return layers;
+}
+
+std::shared_ptr<Tensor> QuantizedSequential::forward(std::shared_ptr<Tensor> x) const {
+    // the int8 gemm reads samples as contiguous columns, so a batch-major input is transposed once
+    const bool batch_major = x->layout() == Layout::BatchMajor;
+    Eigen::MatrixXf out;
+    for (std::size_t i = 0; i < layers_.size(); i++) {
+        Activation act = i + 1 < layers_.size() ? Activation::ReLU : Activation::None;
+        if (i > 0) {
+            out = layers_[i].forward(out, act);
+        } else if (batch_major) {
+            out = layers_[i].forward(x->data().transpose(), act);
+        } else {
+            out = layers_[i].forward(x->data(), act);
+        }
+    }
+
+    auto result = std::make_shared<Tensor>(batch_major ? Eigen::MatrixXf(out.transpose()) : out);
+    result->set_layout(x->layout());
+    return result;
+}
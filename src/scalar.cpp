@@ -0,0 +1,157 @@
+#include "../include/scalar.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+ScalarTape& tape_of(Scalar a, Scalar b) {
+    if (a.tape != b.tape) {
+        throw std::runtime_error("Scalar: operands belong to different tapes");
+    }
+    return *a.tape;
+}
+}
+
+Scalar operator+(Scalar a, Scalar b) {
+    return tape_of(a, b).push(ScalarOp::Add, a.data() + b.data(), a.index, b.index);
+}
+
+Scalar operator*(Scalar a, Scalar b) {
+    return tape_of(a, b).push(ScalarOp::Mul, a.data() * b.data(), a.index, b.index);
+}
+
+Scalar operator+(Scalar a, double b) {
+    return a + a.tape->leaf(b);
+}
+
+Scalar operator*(Scalar a, double b) {
+    return a * a.tape->leaf(b);
+}
+
+Scalar Scalar::tanh() const {
+    return tape->push(ScalarOp::Tanh, std::tanh(data()), index);
+}
+
+Scalar Scalar::exp() const {
+    return tape->push(ScalarOp::Exp, std::exp(data()), index);
+}
+
+Scalar Scalar::pow(Scalar exponent) const {
+    return tape_of(*this, exponent).push(ScalarOp::Pow, std::pow(data(), exponent.data()), index, exponent.index);
+}
+
+Scalar Scalar::pow(double exponent) const {
+    return pow(tape->leaf(exponent));
+}
+
+Scalar ScalarTape::leaf(double value, std::string_view label) {
+    Scalar node = push(ScalarOp::Leaf, value, -1);
+    if (!label.empty()) {
+        names_.emplace(node.index, std::string(label));
+    }
+    return node;
+}
+
+Scalar ScalarTape::push(ScalarOp op, double value, std::int32_t lhs, std::int32_t rhs) {
+    data_.push_back(value);
+    grad_.push_back(0.0);
+    op_.push_back(op);
+    lhs_.push_back(lhs);
+    rhs_.push_back(rhs);
+    return {this, static_cast<std::int32_t>(data_.size() - 1)};
+}
+
+void ScalarTape::backward(Scalar root) {
+    // parents always precede their consumers, so a reverse sweep from the root visits every
+    // node after all of its consumers; nodes the root does not depend on just pass on zeros
+    std::fill(grad_.begin(), grad_.begin() + root.index + 1, 0.0);
+    grad_[root.index] = 1.0;
+
+    for (std::int32_t i = root.index; i >= 0; i--) {
+        const double g = grad_[i];
+        if (g == 0.0) {
+            continue;
+        }
+        const std::int32_t a = lhs_[i];
+        const std::int32_t b = rhs_[i];
+        switch (op_[i]) {
+            case ScalarOp::Leaf:
+                break;
+            case ScalarOp::Add:
+                grad_[a] += g;
+                grad_[b] += g;
+                break;
+            case ScalarOp::Mul:
+                grad_[a] += data_[b] * g;
+                grad_[b] += data_[a] * g;
+                break;
+            case ScalarOp::Tanh:
+                grad_[a] += (1.0 - data_[i] * data_[i]) * g;
+                break;
+            case ScalarOp::Exp:
+                grad_[a] += data_[i] * g;
+                break;
+            case ScalarOp::Pow:
+                grad_[a] += data_[b] * std::pow(data_[a], data_[b] - 1.0) * g;
+                break;
+        }
+    }
+}
+
+void ScalarTape::clear() {
+    data_.clear();
+    grad_.clear();
+    op_.clear();
+    lhs_.clear();
+    rhs_.clear();
+    names_.clear();
+}
+
+void ScalarTape::reserve(std::size_t nodes) {
+    data_.reserve(nodes);
+    grad_.reserve(nodes);
+    op_.reserve(nodes);
+    lhs_.reserve(nodes);
+    rhs_.reserve(nodes);
+}
+
+std::string ScalarTape::label(Scalar node) const {
+    // post-order over the expression with an explicit stack, so deep graphs cannot overflow
+    std::unordered_map<std::int32_t, std::string> formatted;
+    std::vector<std::pair<std::int32_t, bool>> stack = {{node.index, false}};
+    while (!stack.empty()) {
+        auto [i, expanded] = stack.back();
+        stack.pop_back();
+        if (formatted.count(i)) {
+            continue;
+        }
+        if (auto name = names_.find(i); name != names_.end()) {
+            formatted.emplace(i, name->second);
+            continue;
+        }
+        if (op_[i] == ScalarOp::Leaf) {
+            formatted.emplace(i, "v" + std::to_string(i));
+            continue;
+        }
+        if (!expanded) {
+            stack.push_back({i, true});
+            stack.push_back({lhs_[i], false});
+            if (rhs_[i] >= 0) {
+                stack.push_back({rhs_[i], false});
+            }
+            continue;
+        }
+
+        const std::string& a = formatted.at(lhs_[i]);
+        switch (op_[i]) {
+            case ScalarOp::Add: formatted.emplace(i, "(" + a + "+" + formatted.at(rhs_[i]) + ")"); break;
+            case ScalarOp::Mul: formatted.emplace(i, "(" + a + "*" + formatted.at(rhs_[i]) + ")"); break;
+            case ScalarOp::Tanh: formatted.emplace(i, "tanh(" + a + ")"); break;
+            case ScalarOp::Exp: formatted.emplace(i, "exp(" + a + ")"); break;
+            case ScalarOp::Pow: formatted.emplace(i, "pow(" + a + "," + formatted.at(rhs_[i]) + ")"); break;
+            case ScalarOp::Leaf: break;
+        }
+    }
+    return formatted.at(node.index);
+}
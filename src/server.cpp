@@ -0,0 +1,108 @@
+#include "../include/server.h"
+
+#include <stdexcept>
+
+InferenceServer::InferenceServer(Module& model, int input_size, InferenceServerOptions options)
+    : model_(model), input_size_(input_size), options_(options) {
+    if (options_.max_batch_size <= 0 || input_size_ <= 0) {
+        throw std::runtime_error("invalid max_batch_size or input_size for InferenceServer");
+    }
+
+    for (auto& buffer : buffers_) {
+        buffer.storage = std::shared_ptr<float>(new float[static_cast<std::size_t>(input_size_) * options_.max_batch_size],
+                                                std::default_delete<float[]>());
+        buffer.views.resize(options_.max_batch_size);
+        buffer.promises.resize(options_.max_batch_size);
+    }
+
+    worker_ = std::thread([this]() { serve(); });
+}
+
+InferenceServer::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    ready_.notify_all();
+    not_full_.notify_all();
+    worker_.join();
+}
+
+std::future<Eigen::VectorXf> InferenceServer::submit(const Eigen::Ref<const Eigen::VectorXf>& sample) {
+    if (sample.size() != input_size_) {
+        throw std::runtime_error("InferenceServer::submit: sample size differs from the model's input size");
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&]() { return stop_ || count_ < options_.max_batch_size; });
+    if (stop_) {
+        throw std::runtime_error("InferenceServer::submit: the server is shutting down");
+    }
+
+    Buffer& buffer = buffers_[pending_];
+    Eigen::Map<Eigen::VectorXf>(buffer.storage.get() + static_cast<std::size_t>(count_) * input_size_, input_size_) = sample;
+    buffer.promises[count_] = std::promise<Eigen::VectorXf>();
+    auto future = buffer.promises[count_].get_future();
+
+    // the worker sleeps until a batch is started or filled
+    if (++count_ == 1) {
+        first_arrival_ = std::chrono::steady_clock::now();
+        ready_.notify_one();
+    } else if (count_ == options_.max_batch_size) {
+        ready_.notify_one();
+    }
+    return future;
+}
+
+void InferenceServer::serve() {
+    NoGradGuard no_grad;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        ready_.wait(lock, [&]() { return stop_ || count_ > 0; });
+        if (count_ == 0) {
+            return; // stopped and drained
+        }
+        ready_.wait_until(lock, first_arrival_ + options_.max_delay,
+                          [&]() { return stop_ || count_ == options_.max_batch_size; });
+
+        // swap buffers, so requests arriving during the forward fill the other one
+        Buffer& buffer = buffers_[pending_];
+        int size = count_;
+        pending_ ^= 1;
+        count_ = 0;
+        lock.unlock();
+        not_full_.notify_all();
+
+        // counted before the promises are fulfilled, so a client that has its result sees its batch
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        requests_.fetch_add(size, std::memory_order_relaxed);
+        run_batch(buffer, size);
+        lock.lock();
+    }
+}
+
+void InferenceServer::run_batch(Buffer& buffer, int size) {
+    // the first size columns of the buffer are contiguous, so each batch size gets one view
+    auto& inputs = buffer.views[size - 1];
+    if (!inputs) {
+        inputs = std::make_shared<Tensor>(Eigen::MatrixXf(input_size_, size));
+        inputs->bind_storage(buffer.storage.get(), nullptr, buffer.storage, false);
+    }
+
+    std::shared_ptr<Tensor> outputs;
+    try {
+        outputs = model_.forward(inputs);
+        if (outputs->cols() != size) {
+            throw std::runtime_error("InferenceServer: model output has a different batch size than its input");
+        }
+    } catch (...) {
+        for (int i = 0; i < size; i++) {
+            buffer.promises[i].set_exception(std::current_exception());
+        }
+        return;
+    }
+
+    for (int i = 0; i < size; i++) {
+        buffer.promises[i].set_value(outputs->data().col(i));
+    }
+}
@@ -0,0 +1,159 @@
+#include "../include/tape.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+namespace {
+thread_local Tape* current_tape = nullptr;
+
+std::size_t align_up(std::uintptr_t address, std::size_t alignment) {
+    return (address + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+}
+}
+
+Arena::Arena(std::size_t block_size) : block_size_(block_size) {
+}
+
+Arena::~Arena() {
+    for (auto& block : blocks_) {
+        ::operator delete(block.data, std::align_val_t{alignof(std::max_align_t)});
+    }
+}
+
+bool Arena::fits(const Block& block, std::size_t offset, std::size_t bytes, std::size_t alignment) const {
+    auto base = reinterpret_cast<std::uintptr_t>(block.data);
+    std::size_t start = align_up(base + offset, alignment) - base;
+    return start + bytes <= block.size;
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    // move on to the next retained block before asking the system for a new one
+    while (current_ < blocks_.size() && !fits(blocks_[current_], offset_, bytes, alignment)) {
+        current_++;
+        offset_ = 0;
+    }
+
+    if (current_ == blocks_.size()) {
+        std::size_t size = std::max(block_size_, bytes + alignment);
+        char* data = static_cast<char*>(::operator new(size, std::align_val_t{alignof(std::max_align_t)}));
+        blocks_.push_back({data, size});
+    }
+
+    Block& block = blocks_[current_];
+    auto base = reinterpret_cast<std::uintptr_t>(block.data);
+    std::size_t start = align_up(base + offset_, alignment) - base;
+    offset_ = start + bytes;
+
+    bytes_allocated_ += bytes;
+    live_allocations_++;
+    return block.data + start;
+}
+
+void Arena::do_deallocate(void*, std::size_t, std::size_t) {
+    // memory is only reclaimed by reset()
+    live_allocations_--;
+}
+
+void Arena::reset() {
+    current_ = 0;
+    offset_ = 0;
+    bytes_allocated_ = 0;
+}
+
+std::size_t Arena::capacity() const {
+    std::size_t total = 0;
+    for (const auto& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+int Tape::record(Tensor* node, std::uint64_t structure_hash) {
+    std::uint64_t prefix = prefix_hashes_.empty() ? 0xcbf29ce484222325ull : prefix_hashes_.back();
+    prefix = (prefix ^ structure_hash) * 0x100000001b3ull;
+
+    nodes_.push_back(node);
+    prefix_hashes_.push_back(prefix);
+    return static_cast<int>(nodes_.size()) - 1;
+}
+
+const std::vector<int>* Tape::cached_order(int root) {
+    for (const auto& cached : orders_) {
+        if (cached.root == root && cached.hash == prefix_hashes_[root]) {
+            order_hits_++;
+            return &cached.order;
+        }
+    }
+    order_misses_++;
+    return nullptr;
+}
+
+void Tape::store_order(int root, std::vector<int> order) {
+    for (auto& cached : orders_) {
+        if (cached.root == root) {
+            cached.hash = prefix_hashes_[root];
+            cached.order = std::move(order);
+            return;
+        }
+    }
+    orders_.push_back({root, prefix_hashes_[root], std::move(order)});
+}
+
+Eigen::MatrixXf Tape::acquire(Eigen::Index rows, Eigen::Index cols) {
+    for (auto& buffer : pool_) {
+        if (buffer.size() == rows * cols) {
+            Eigen::MatrixXf taken = std::move(buffer);
+            buffer = std::move(pool_.back());
+            pool_.pop_back();
+            taken.resize(rows, cols); // same size, so no reallocation
+            return taken;
+        }
+    }
+    return Eigen::MatrixXf(rows, cols);
+}
+
+void Tape::recycle(Eigen::MatrixXf&& buffer) {
+    if (buffer.size() > 0) {
+        pool_.push_back(std::move(buffer));
+    }
+}
+
+void Tape::track_bytes(std::size_t bytes) {
+    live_bytes_ += bytes;
+    peak_bytes_ = std::max(peak_bytes_, live_bytes_);
+}
+
+bool Tape::reset() {
+    // the recorded nodes belong to the finished step either way; a node kept alive past
+    // it is no longer on the tape, so it just misses the cached orders
+    nodes_.clear();
+    prefix_hashes_.clear();
+    if (arena_.live_allocations() != 0) {
+        orders_.clear();
+        failed_resets_++;
+        return false;
+    }
+    arena_.reset();
+    resets_++;
+
+    last_peak_bytes_ = peak_bytes_;
+    live_bytes_ = 0;
+    peak_bytes_ = 0;
+    return true;
+}
+
+Tape* Tape::current() {
+    return current_tape;
+}
+
+TapeGuard::TapeGuard(Tape& tape) : tape_(tape), previous_(current_tape) {
+    current_tape = &tape_;
+}
+
+TapeGuard::~TapeGuard() {
+    current_tape = previous_;
+    [[maybe_unused]] bool rewound = tape_.reset();
+    assert(rewound && "TapeGuard: a node of the step outlived the guard, so the arena was not rewound");
+}
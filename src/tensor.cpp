@@ -1,229 +1,848 @@
 #include "../include/tensor.h"
+#include "../include/tape.h"
+#include "../include/buffer_pool.h"
+#include "../include/kernels.h"
+#include "../include/graph.h"
+#include "../include/profiler.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <iostream>
-#include <unordered_set>
+#include <new>
+#include <stdexcept>
+
+namespace {
+thread_local bool grad_mode = true;
+
+bool planning_memory() {
+    Tape* tape = Tape::current();
+    return tape && tape->plan_memory();
+}
+
+// an op's output buffer, tagged with where it came from so its tensor gives it back there
+struct OpBuffer {
+    Eigen::MatrixXf data;
+    BufferSource source;
+};
+
+// output buffer of an op, recycled from the active tape's pool when it plans memory, or
+// from the BufferPool when that is enabled
+OpBuffer new_buffer(Eigen::Index rows, Eigen::Index cols) {
+    if (planning_memory()) {
+        return {Tape::current()->acquire(rows, cols), BufferSource::Tape};
+    }
+    if (BufferPool::enabled()) {
+        return {BufferPool::acquire(rows, cols), BufferSource::Pool};
+    }
+    return {Eigen::MatrixXf(rows, cols), BufferSource::Heap};
+}
+
+// op results, built on a buffer from new_buffer, go to the active tape's arena, or to the
+// heap in eager mode; the buffer is moved in, never copied
+std::shared_ptr<Tensor> make_node(OpBuffer buffer, bool requires_grad) {
+    Tape* tape = Tape::current();
+    if (!tape) {
+        return std::make_shared<Tensor>(std::move(buffer.data), requires_grad, std::pmr::get_default_resource(),
+                                        buffer.source);
+    }
+    std::pmr::memory_resource* resource = tape->resource();
+    return std::allocate_shared<Tensor>(std::pmr::polymorphic_allocator<Tensor>(resource),
+                                        std::move(buffer.data), requires_grad, resource, buffer.source);
+}
+
+// reports the op to a running StaticGraph capture
+void record_op(OpCode op, Tensor& a, const std::shared_ptr<Tensor>& b,
+               const std::shared_ptr<Tensor>& out, const std::vector<int>* targets = nullptr,
+               const std::shared_ptr<Tensor>& c = nullptr, Activation activation = Activation::None) {
+    if (GraphRecorder* recorder = GraphRecorder::active()) {
+        recorder->record({op, a.shared_from_this(), b, c, out, targets, activation, a.layout(), {}});
+    }
+}
+
+Layout joint_layout(const Tensor& a, const Tensor& b) {
+    return a.layout() == Layout::BatchMajor ? a.layout() : b.layout();
+}
+
+std::array<int, 2> shape(const MatrixView& m) {
+    return {static_cast<int>(m.rows()), static_cast<int>(m.cols())};
+}
+
+// conv and pool ops read FeatureMajor batches of images of the geometry's size
+void check_images(const Tensor& x, const Conv2dShape& geometry, const std::string& op) {
+    if (x.layout() == Layout::BatchMajor) {
+        throw std::runtime_error(op + ": images must be FeatureMajor, one per column");
+    }
+    if (x.rows() != geometry.in_features()) {
+        throw std::runtime_error(op + ": input rows differ from channels * height * width");
+    }
+    if (geometry.kernel <= 0 || geometry.stride <= 0 || geometry.padding < 0 || geometry.height + 2 * geometry.padding < geometry.kernel
+        || geometry.width + 2 * geometry.padding < geometry.kernel) {
+        throw std::runtime_error(op + ": the window does not fit the image");
+    }
+}
+
+void check_pool(const Tensor& x, const Conv2dShape& geometry, const std::string& op) {
+    check_images(x, geometry, op);
+    if (geometry.out_channels != geometry.channels || geometry.padding != 0) {
+        throw std::runtime_error(op + ": pooling keeps the channels and takes no padding");
+    }
+}
+
+// grad of a fused op's pre-activation; the mask goes to a per-thread scratch buffer, so the
+// output's own grad stays d(loss)/d(out)
+Eigen::Map<const Eigen::MatrixXf> pre_activation_grad(const MatrixView& out, const MatrixView& grad, Activation act) {
+    if (act == Activation::None) {
+        return {grad.data(), grad.rows(), grad.cols()};
+    }
+    thread_local Eigen::MatrixXf masked;
+    masked.resize(grad.rows(), grad.cols());
+    kernels::activation_backward(out, act, grad, masked);
+    return {masked.data(), masked.rows(), masked.cols()};
+}
+
+// bytes a new node holds: its value, and its grad unless the memory planner defers it
+std::size_t node_bytes(const Tensor& node) {
+    return (node.data().size() + node.grad().size()) * sizeof(float);
+}
+
+// flops of a node's backward closure, for the profiler
+double backward_flops(const Tensor& node) {
+    const auto& prev = node.prev();
+    const std::string& op = node.op();
+    const double size = prev[0]->data().size();
+    if (op == "matmul") {
+        const double gemm = 2.0 * prev[0]->data().rows() * prev[0]->data().cols() * prev[1]->data().cols();
+        return gemm * (prev[0]->requires_grad() + prev[1]->requires_grad());
+    }
+    if (op == "linear") {
+        const double out = node.data().size();
+        const double gemm = 2.0 * prev[1]->data().size() * node.batch_size();
+        return out + gemm * (prev[0]->requires_grad() + prev[1]->requires_grad()) + out * prev[2]->requires_grad();
+    }
+    if (op == "conv2d") {
+        const double out = node.data().size();
+        const double gemm = 2.0 * out * prev[1]->data().cols();
+        return gemm * (prev[0]->requires_grad() + prev[1]->requires_grad()) + out * prev[2]->requires_grad();
+    }
+    if (op == "log_softmax" || op == "cross_entropy") {
+        return 3.0 * size;
+    }
+    if (op == "checkpoint") {
+        return 0.0; // the recomputed ops are recorded on their own
+    }
+    return size;
+}
+}
+
+bool grad_enabled() {
+    return grad_mode;
+}
+
+NoGradGuard::NoGradGuard() : previous_(grad_mode) {
+    grad_mode = false;
+}
+
+NoGradGuard::~NoGradGuard() {
+    grad_mode = previous_;
+}
 
 Tensor::Tensor(const Eigen::MatrixXf& data, bool requires_grad, const std::string& label)
-    : data_(data), requires_grad_(requires_grad), label_(label) {
-    if (requires_grad) {
-        grad_ = Eigen::MatrixXf::Zero(data.rows(), data.cols());
+    : requires_grad_(requires_grad), label_(label) {
+    init_storage(data);
+}
+
+Tensor::Tensor(Eigen::MatrixXf&& data, bool requires_grad, const std::string& label)
+    : requires_grad_(requires_grad), label_(label) {
+    init_storage(std::move(data));
+}
+
+Tensor::Tensor(Eigen::MatrixXf data, bool requires_grad, std::pmr::memory_resource* resource, BufferSource source)
+    : requires_grad_(requires_grad), prev_(resource) {
+    pooled_ = source == BufferSource::Pool;
+    init_storage(std::move(data), source != BufferSource::Tape);
+}
+
+Tensor::~Tensor() {
+    if (pooled_) {
+        BufferPool::release(std::move(owned_data_));
+        BufferPool::release(std::move(owned_grad_));
+    }
+}
+
+std::shared_ptr<Tensor> Tensor::make_result(Eigen::Index rows, Eigen::Index cols, bool requires_grad) {
+    return make_node(new_buffer(rows, cols), requires_grad);
+}
+
+void Tensor::init_storage(Eigen::MatrixXf data, bool allocate_grad) {
+    owned_data_ = std::move(data);
+    new (&data_) MatrixView(owned_data_.data(), owned_data_.rows(), owned_data_.cols());
+    if (requires_grad_ && allocate_grad) {
+        if (pooled_) {
+            owned_grad_ = BufferPool::acquire(owned_data_.rows(), owned_data_.cols());
+            owned_grad_.setZero();
+        } else {
+            owned_grad_ = Eigen::MatrixXf::Zero(owned_data_.rows(), owned_data_.cols());
+        }
+        new (&grad_) MatrixView(owned_grad_.data(), owned_data_.rows(), owned_data_.cols());
     }
 }
 
+void Tensor::bind_storage(float* data, float* grad, std::shared_ptr<void> owner, bool copy_values) {
+    const int rows = data_.rows();
+    const int cols = data_.cols();
+    if (copy_values && data != data_.data()) {
+        MatrixView(data, rows, cols) = data_;
+    }
+    new (&data_) MatrixView(data, rows, cols);
+    if (pooled_) {
+        BufferPool::release(std::move(owned_data_));
+    }
+    owned_data_ = Eigen::MatrixXf();
+
+    if (requires_grad_ && grad) {
+        if (copy_values && grad != grad_.data()) {
+            MatrixView(grad, rows, cols) = grad_;
+        }
+        new (&grad_) MatrixView(grad, rows, cols);
+        if (pooled_) {
+            BufferPool::release(std::move(owned_grad_));
+        }
+        owned_grad_ = Eigen::MatrixXf();
+    } else if (requires_grad_ && storage_ && grad_.data() != owned_grad_.data()) {
+        // the grad stays in the previous external storage, which must outlive the tensor too
+        owner = std::make_shared<std::pair<std::shared_ptr<void>, std::shared_ptr<void>>>(std::move(owner),
+                                                                                           std::move(storage_));
+    }
+
+    storage_ = std::move(owner);
+}
+
+void Tensor::set_data(Eigen::MatrixXf data) {
+    if (pooled_) {
+        BufferPool::release(std::move(owned_data_));
+        BufferPool::release(std::move(owned_grad_));
+        pooled_ = false;
+    }
+    storage_.reset();
+    owned_grad_ = Eigen::MatrixXf();
+    new (&grad_) MatrixView(nullptr, 0, 0);
+    init_storage(std::move(data));
+    version_++;
+}
+
 std::shared_ptr<Tensor> Tensor::matmul(std::shared_ptr<Tensor> other) {
-    Eigen::MatrixXf result = data_ * other->data_;
-    auto out = std::make_shared<Tensor>(result, requires_grad_ || other->requires_grad_);
+    ProfileScope profile("matmul", ProfilePhase::Forward);
+    OpBuffer result = new_buffer(data_.rows(), other->data_.cols());
+    kernels::matmul(data_, other->data_, result.data);
+    bool requires_grad = grad_enabled() && (requires_grad_ || other->requires_grad_);
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = joint_layout(*this, *other);
 
-    if (requires_grad_ || other->requires_grad_) {
+    if (requires_grad) {
         out->prev_ = {shared_from_this(), other};
         out->op_ = "matmul";
 
-        out->backward_fn_ = [self=shared_from_this(), other, out]() {
+        out->set_backward([self=shared_from_this(), other, out=out.get()]() {
             if (self->requires_grad_) {
-                self->grad_ += out->grad_ * other->data_.transpose();
+                kernels::matmul_backward_a(out->grad_, other->data_, self->grad_);
             }
             if (other->requires_grad_) {
-                other->grad_ += self->data_.transpose() * out->grad_;
+                kernels::matmul_backward_b(self->data_, out->grad_, other->grad_);
             }
-        };
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(2.0 * data_.rows() * data_.cols() * other->data_.cols(), node_bytes(*out), {shape(data_), shape(other->data_)});
     }
 
+    record_op(OpCode::Matmul, *this, other, out);
     return out;
 }
 
 std::shared_ptr<Tensor> Tensor::add(std::shared_ptr<Tensor> other) {
-    Eigen::MatrixXf result = data_ + other->data_;
-    auto out = std::make_shared<Tensor>(result, requires_grad_ || other->requires_grad_);
+    ProfileScope profile("add", ProfilePhase::Forward);
+    // a single-column (or single-row) operand, e.g. a bias, is broadcast over the batch
+    OpBuffer result = new_buffer(std::max(data_.rows(), other->data_.rows()),
+                                        std::max(data_.cols(), other->data_.cols()));
+    kernels::add(data_, other->data_, result.data);
+    bool requires_grad = grad_enabled() && (requires_grad_ || other->requires_grad_);
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = joint_layout(*this, *other);
 
-    if (requires_grad_ || other->requires_grad_) {
+    if (requires_grad) {
         out->prev_ = {shared_from_this(), other};
         out->op_ = "add";
 
-        out->backward_fn_ = [self=shared_from_this(), other, out]() {
+        out->set_backward([self=shared_from_this(), other, out=out.get()]() {
             if (self->requires_grad_) {
-                if (self->data_.rows() == out->grad_.rows() && self->data_.cols() == out->grad_.cols()) {
-                    self->grad_ += out->grad_;
-                } else {
-                    Eigen::MatrixXf sum = Eigen::MatrixXf::Zero(self->data_.rows(), self->data_.cols());
-                    for (int i = 0; i < out->grad_.cols(); i++) {
-                        sum += out->grad_.col(i);
-                    }
-                    self->grad_ += sum;
-                }
+                kernels::add_backward(out->grad_, self->grad_);
             }
-
             if (other->requires_grad_) {
-                if (other->data_.rows() == out->grad_.rows() && other->data_.cols() == out->grad_.cols()) {
-                    other->grad_ += out->grad_;
-                } else {
-                    Eigen::MatrixXf sum = Eigen::MatrixXf::Zero(other->data_.rows(), other->data_.cols());
-                    for (int i = 0; i < out->grad_.cols(); i++) {
-                        sum += out->grad_.col(i);
-                    }
-                    other->grad_ += sum;
-                }
+                kernels::add_backward(out->grad_, other->grad_);
             }
-        };
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(out->data_.size(), node_bytes(*out), {shape(data_), shape(other->data_)});
     }
 
+    record_op(OpCode::Add, *this, other, out);
     return out;
 }
 
 std::shared_ptr<Tensor> Tensor::relu() {
-    Eigen::MatrixXf result = data_.array().max(0.0f);
-    auto out = std::make_shared<Tensor>(result, requires_grad_);
+    ProfileScope profile("relu", ProfilePhase::Forward);
+    OpBuffer result = new_buffer(data_.rows(), data_.cols());
+    kernels::relu(data_, result.data);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = layout_;
 
-    if (requires_grad_) {
+    if (requires_grad) {
         out->prev_ = {shared_from_this()};
         out->op_ = "relu";
 
-        out->backward_fn_ = [self=shared_from_this(), out]() {
-            Eigen::MatrixXf mask = (self->data_.array() > 0.0f).cast<float>();
-            self->grad_ += (mask.array() * out->grad_.array()).matrix();
-        };
+        out->set_backward([self=shared_from_this(), out=out.get()]() {
+            kernels::relu_backward(self->data_, out->grad_, self->grad_);
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(data_.size(), node_bytes(*out), {shape(data_)});
     }
 
+    record_op(OpCode::Relu, *this, nullptr, out);
     return out;
 }
 
-std::shared_ptr<Tensor> Tensor::log_softmax() {
-    Eigen::MatrixXf logits = data_;
-    Eigen::VectorXf max_logits = logits.colwise().maxCoeff();
-
-    for (int i = 0; i < logits.cols(); i++) {
-        logits.col(i).array() -= max_logits(i);
+std::shared_ptr<Tensor> Tensor::relu_() {
+    if (grad_enabled() && requires_grad_) {
+        throw std::runtime_error("relu_: in-place op on a tensor that requires grad");
     }
-
-    Eigen::MatrixXf exp_logits = logits.array().exp();
-    Eigen::VectorXf sum_exp = exp_logits.colwise().sum();
-
-    Eigen::MatrixXf log_softmax_out = logits;
-    for (int i = 0; i < logits.cols(); i++) {
-        log_softmax_out.col(i).array() -= std::log(sum_exp(i));
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("relu_: in-place ops cannot be captured into a static graph");
     }
+    ProfileScope profile("relu_", ProfilePhase::Forward);
+    profile.describe(data_.size(), 0, {shape(data_)});
+    kernels::relu(data_, data_);
+    version_++;
+    return shared_from_this();
+}
 
-    auto out = std::make_shared<Tensor>(log_softmax_out, requires_grad_);
+std::shared_ptr<Tensor> Tensor::log_softmax() {
+    ProfileScope profile("log_softmax", ProfilePhase::Forward);
+    OpBuffer result = new_buffer(data_.rows(), data_.cols());
+    kernels::log_softmax(data_, layout_, result.data);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = layout_;
 
-    if (requires_grad_) {
+    if (requires_grad) {
         out->prev_ = {shared_from_this()};
         out->op_ = "log_softmax";
 
-        out->backward_fn_ = [self=shared_from_this(), out, exp_logits, sum_exp]() {
-            Eigen::MatrixXf softmax = exp_logits;
-            for (int i = 0; i < softmax.cols(); i++) {
-                softmax.col(i) /= sum_exp(i);
-            }
+        out->set_backward([self=shared_from_this(), out=out.get()]() {
+            kernels::log_softmax_backward(out->data_, out->grad_, self->layout_, self->grad_);
+        });
+    }
 
-            for (int i = 0; i < out->grad_.cols(); i++) {
-                float sum_grad = out->grad_.col(i).sum();
-                self->grad_.col(i) += out->grad_.col(i) - softmax.col(i) * sum_grad;
-            }
-        };
+    if (profile.enabled()) {
+        profile.describe(4.0 * data_.size(), node_bytes(*out), {shape(data_)});
     }
 
+    record_op(OpCode::LogSoftmax, *this, nullptr, out);
     return out;
 }
 
 std::shared_ptr<Tensor> Tensor::mse_loss(std::shared_ptr<Tensor> target) {
-    int batch_size = data_.cols();
-    Eigen::MatrixXf diff = data_ - target->data_;
-    Eigen::MatrixXf result(1, 1);
-    result(0, 0) = diff.array().square().sum() / batch_size;
-
-    auto out = std::make_shared<Tensor>(result, requires_grad_);
+    ProfileScope profile("mse_loss", ProfilePhase::Forward);
+    OpBuffer result = new_buffer(1, 1);
+    kernels::mse_loss(data_, target->data_, layout_, result.data);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(std::move(result), requires_grad);
 
-    if (requires_grad_) {
+    if (requires_grad) {
         out->prev_ = {shared_from_this(), target};
         out->op_ = "mse_loss";
 
-        out->backward_fn_ = [self=shared_from_this(), target, diff, batch_size, out]() {
-            self->grad_ += 2.0f * diff * (out->grad_(0, 0) / batch_size);
-        };
+        out->set_backward([self=shared_from_this(), target, out=out.get()]() {
+            kernels::mse_loss_backward(self->data_, target->data_, out->grad_, self->layout_, self->grad_);
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(3.0 * data_.size(), node_bytes(*out), {shape(data_), shape(target->data_)});
     }
 
+    record_op(OpCode::MseLoss, *this, target, out);
     return out;
 }
 
 std::shared_ptr<Tensor> Tensor::nll_loss(const std::vector<int>& target) {
-    int batch_size = data_.cols();
-    Eigen::MatrixXf result(1, 1);
-    result(0, 0) = 0.0f;
+    ProfileScope profile("nll_loss", ProfilePhase::Forward);
+    OpBuffer result = new_buffer(1, 1);
+    kernels::nll_loss(data_, target.data(), layout_, result.data);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(std::move(result), requires_grad);
 
-    for (int i = 0; i < batch_size; i++) {
-        result(0, 0) -= data_(target[i], i);
+    if (requires_grad) {
+        out->prev_ = {shared_from_this()};
+        out->op_ = "nll_loss";
+
+        std::pmr::vector<int> saved_target(target.begin(), target.end(), out->prev_.get_allocator().resource());
+        out->set_backward([self=shared_from_this(), target=std::move(saved_target), out=out.get()]() {
+            kernels::nll_loss_backward(target.data(), out->grad_, self->layout_, self->grad_);
+        });
     }
-    result(0, 0) /= batch_size;
 
-    auto out = std::make_shared<Tensor>(result, requires_grad_);
+    if (profile.enabled()) {
+        profile.describe(batch_size(), node_bytes(*out), {shape(data_)});
+    }
+
+    record_op(OpCode::NllLoss, *this, nullptr, out, &target);
+    return out;
+}
+
+std::shared_ptr<Tensor> Tensor::cross_entropy(const std::vector<int>& target) {
+    ProfileScope profile("cross_entropy", ProfilePhase::Forward);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(new_buffer(1, 1), requires_grad);
+    std::pmr::memory_resource* resource = out->prev_.get_allocator().resource();
 
-    if (requires_grad_) {
+    // only a log-sum-exp per sample is kept for the backward, not the softmax
+    std::pmr::vector<float> log_sum_exp(batch_size(), resource);
+    Eigen::Map<Eigen::MatrixXf> saved(log_sum_exp.data(), batch_size(), 1);
+    kernels::cross_entropy(data_, target.data(), layout_, saved, out->data_);
+
+    if (requires_grad) {
         out->prev_ = {shared_from_this()};
-        out->op_ = "nll_loss";
+        out->op_ = "cross_entropy";
+
+        std::pmr::vector<int> saved_target(target.begin(), target.end(), resource);
+        out->set_backward([self=shared_from_this(), target=std::move(saved_target),
+                           log_sum_exp=std::move(log_sum_exp), out=out.get()]() {
+            Eigen::Map<const Eigen::MatrixXf> saved(log_sum_exp.data(), log_sum_exp.size(), 1);
+            kernels::cross_entropy_backward(self->data_, target.data(), saved, out->grad_, self->layout_, self->grad_);
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(4.0 * data_.size(), node_bytes(*out) + batch_size() * sizeof(float), {shape(data_)});
+    }
+
+    record_op(OpCode::CrossEntropy, *this, nullptr, out, &target);
+    return out;
+}
 
-        out->backward_fn_ = [self=shared_from_this(), target, batch_size, out]() {
-            Eigen::MatrixXf grad = Eigen::MatrixXf::Zero(self->data_.rows(), self->data_.cols());
+std::shared_ptr<Tensor> Tensor::linear(std::shared_ptr<Tensor> weight, std::shared_ptr<Tensor> bias, Activation act) {
+    ProfileScope profile("linear", ProfilePhase::Forward);
+    // no replicated bias, no separate add/relu activations and no relu mask
+    OpBuffer result = layout_ == Layout::BatchMajor ? new_buffer(data_.rows(), weight->data_.rows())
+                                                           : new_buffer(weight->data_.rows(), data_.cols());
+    kernels::linear(weight->data_, data_, bias->data_, act, layout_, result.data);
+    bool requires_grad = grad_enabled() && (requires_grad_ || weight->requires_grad_ || bias->requires_grad_);
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = layout_;
 
-            for (int i = 0; i < batch_size; i++) {
-                grad(target[i], i) = -1.0f;
+    if (requires_grad) {
+        out->prev_ = {shared_from_this(), weight, bias};
+        out->op_ = "linear";
+
+        out->set_backward([self=shared_from_this(), weight, bias, act, out=out.get()]() {
+            auto grad_pre = pre_activation_grad(out->data_, out->grad_, act);
+            if (weight->requires_grad_) {
+                kernels::linear_backward_weight(grad_pre, self->data_, self->layout_, weight->grad_);
+            }
+            if (bias->requires_grad_) {
+                kernels::bias_backward(grad_pre, self->layout_, bias->grad_);
             }
+            if (self->requires_grad_) {
+                kernels::linear_backward_input(weight->data_, grad_pre, self->layout_, self->grad_);
+            }
+        });
+    }
 
-            self->grad_ += grad * (out->grad_(0, 0) / batch_size);
-        };
+    if (profile.enabled()) {
+        profile.describe(2.0 * weight->data_.size() * batch_size() + 2.0 * out->data_.size(), node_bytes(*out),
+                         {shape(data_), shape(weight->data_), shape(bias->data_)});
     }
 
+    record_op(OpCode::Linear, *this, weight, out, nullptr, bias, act);
     return out;
 }
 
-std::shared_ptr<Tensor> Tensor::reshape(int rows, int cols) {
-    Eigen::MatrixXf reshaped = Eigen::Map<Eigen::MatrixXf>(
-        data_.data(), rows, cols
-    );
+std::shared_ptr<Tensor> Tensor::conv2d(std::shared_ptr<Tensor> weight, std::shared_ptr<Tensor> bias,
+                                       const Conv2dShape& geometry, ConvAlgorithm algorithm) {
+    check_images(*this, geometry, "conv2d");
+    if (weight->rows() != geometry.out_channels || weight->cols() != geometry.patch_size()
+        || bias->rows() != geometry.out_channels || bias->cols() != 1) {
+        throw std::runtime_error("conv2d: weight must be out_channels x (channels * kernel * kernel) and bias "
+                                 "out_channels x 1");
+    }
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("conv2d: convolutions cannot be captured into a static graph");
+    }
+    ProfileScope profile("conv2d", ProfilePhase::Forward);
+    algorithm = kernels::conv2d_algorithm(algorithm, geometry);
+    OpBuffer result = new_buffer(geometry.out_features(), data_.cols());
+    kernels::conv2d(data_, weight->data_, bias->data_, geometry, algorithm, result.data);
+    bool requires_grad = grad_enabled() && (requires_grad_ || weight->requires_grad_ || bias->requires_grad_);
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = layout_;
 
-    auto out = std::make_shared<Tensor>(reshaped, requires_grad_);
+    if (requires_grad) {
+        out->prev_ = {shared_from_this(), weight, bias};
+        out->op_ = "conv2d";
 
-    if (requires_grad_) {
+        out->set_backward([self=shared_from_this(), weight, bias, geometry, algorithm, out=out.get()]() {
+            if (weight->requires_grad_) {
+                kernels::conv2d_backward_weight(self->data_, out->grad_, geometry, algorithm, weight->grad_);
+            }
+            if (bias->requires_grad_) {
+                kernels::conv2d_backward_bias(out->grad_, geometry, bias->grad_);
+            }
+            if (self->requires_grad_) {
+                kernels::conv2d_backward_input(weight->data_, out->grad_, geometry, algorithm, self->grad_);
+            }
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(2.0 * out->data_.size() * geometry.patch_size() + out->data_.size(), node_bytes(*out),
+                         {shape(data_), shape(weight->data_), shape(bias->data_)});
+    }
+    return out;
+}
+
+std::shared_ptr<Tensor> Tensor::max_pool2d(const Conv2dShape& geometry) {
+    check_pool(*this, geometry, "max_pool2d");
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("max_pool2d: pooling cannot be captured into a static graph");
+    }
+    ProfileScope profile("max_pool2d", ProfilePhase::Forward);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(new_buffer(geometry.out_features(), data_.cols()), requires_grad);
+    out->layout_ = layout_;
+    std::pmr::memory_resource* resource = out->prev_.get_allocator().resource();
+
+    std::pmr::vector<int> argmax(out->data_.size(), resource);
+    kernels::max_pool2d(data_, geometry, out->data_, argmax.data());
+
+    if (requires_grad) {
+        out->prev_ = {shared_from_this()};
+        out->op_ = "max_pool2d";
+
+        out->set_backward([self=shared_from_this(), argmax=std::move(argmax), out=out.get()]() {
+            kernels::max_pool2d_backward(argmax.data(), out->grad_, self->grad_);
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(static_cast<double>(out->data_.size()) * geometry.kernel * geometry.kernel,
+                         node_bytes(*out) + out->data_.size() * sizeof(int), {shape(data_)});
+    }
+    return out;
+}
+
+std::shared_ptr<Tensor> Tensor::avg_pool2d(const Conv2dShape& geometry) {
+    check_pool(*this, geometry, "avg_pool2d");
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("avg_pool2d: pooling cannot be captured into a static graph");
+    }
+    ProfileScope profile("avg_pool2d", ProfilePhase::Forward);
+    OpBuffer result = new_buffer(geometry.out_features(), data_.cols());
+    kernels::avg_pool2d(data_, geometry, result.data);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = layout_;
+
+    if (requires_grad) {
+        out->prev_ = {shared_from_this()};
+        out->op_ = "avg_pool2d";
+
+        out->set_backward([self=shared_from_this(), geometry, out=out.get()]() {
+            kernels::avg_pool2d_backward(out->grad_, geometry, self->grad_);
+        });
+    }
+
+    if (profile.enabled()) {
+        profile.describe(static_cast<double>(out->data_.size()) * geometry.kernel * geometry.kernel, node_bytes(*out),
+                         {shape(data_)});
+    }
+    return out;
+}
+
+std::shared_ptr<Tensor> Tensor::reshape(int rows, int cols) {
+    ProfileScope profile("reshape", ProfilePhase::Forward);
+    OpBuffer reshaped = new_buffer(rows, cols);
+    kernels::reshape(data_, reshaped.data);
+    bool requires_grad = grad_enabled() && requires_grad_;
+    auto out = make_node(std::move(reshaped), requires_grad);
+    out->layout_ = layout_;
+
+    if (requires_grad) {
         out->prev_ = {shared_from_this()};
         out->op_ = "reshape";
 
-        out->backward_fn_ = [self=shared_from_this(), out]() {
-            Eigen::MatrixXf reshaped_grad = Eigen::Map<Eigen::MatrixXf>(
-                out->grad_.data(), self->data_.rows(), self->data_.cols()
-            );
-            self->grad_ += reshaped_grad;
-        };
+        out->set_backward([self=shared_from_this(), out=out.get()]() {
+            kernels::reshape_backward(out->grad_, self->grad_);
+        });
     }
 
+    if (profile.enabled()) {
+        profile.describe(0.0, node_bytes(*out), {shape(data_)});
+    }
+
+    record_op(OpCode::Reshape, *this, nullptr, out);
     return out;
 }
 
-void Tensor::backward() {
-    std::vector<std::shared_ptr<Tensor>> topo;
-    std::unordered_set<Tensor*> visited;
+std::shared_ptr<Tensor> Tensor::log_softmax_() {
+    if (grad_enabled() && requires_grad_) {
+        throw std::runtime_error("log_softmax_: in-place op on a tensor that requires grad");
+    }
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("log_softmax_: in-place ops cannot be captured into a static graph");
+    }
+    ProfileScope profile("log_softmax_", ProfilePhase::Forward);
+    profile.describe(4.0 * data_.size(), 0, {shape(data_)});
+    kernels::log_softmax(data_, layout_, data_);
+    version_++;
+    return shared_from_this();
+}
+
+void Tensor::record_on_tape() {
+    Tape* tape = Tape::current();
+    if (!tape || prev_.get_allocator().resource() != tape->resource()) {
+        return;
+    }
+
+    // structure of the node: its op and which tape nodes feed it
+    std::uint64_t hash = std::hash<std::string>{}(op_);
+    for (const auto& parent : prev_) {
+        int index = tape->contains(parent.get(), parent->tape_index_) ? parent->tape_index_ : -1;
+        hash = (hash ^ static_cast<std::uint64_t>(index + 1)) * 0x100000001b3ull;
+    }
+    tape_index_ = tape->record(this, hash);
+    tape->track_bytes((data_.size() + grad_.size()) * sizeof(float));
+}
+
+std::uint64_t Tensor::input_versions() const {
+    std::uint64_t versions = version_;
+    for (const auto& parent : prev_) {
+        versions += parent->version_;
+    }
+    return versions;
+}
 
-    std::function<void(std::shared_ptr<Tensor>)> build_topo = [&](std::shared_ptr<Tensor> node) {
-        if (visited.find(node.get()) == visited.end()) {
-            visited.insert(node.get());
-            for (const auto& child : node->prev_) {
-                build_topo(child);
+void Tensor::topo_sort(Tensor* root, std::vector<Tensor*>& order) {
+    static std::atomic<std::uint64_t> generation{0};
+    const std::uint64_t mark = ++generation;
+
+    // explicit stack of (node, next parent to visit), so deep graphs cannot overflow
+    std::vector<std::pair<Tensor*, std::size_t>> stack;
+    root->topo_mark_ = mark;
+    stack.push_back({root, 0});
+
+    while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        if (next < node->prev_.size()) {
+            Tensor* parent = node->prev_[next++].get();
+            if (parent->topo_mark_ != mark) {
+                parent->topo_mark_ = mark;
+                stack.push_back({parent, 0});
             }
-            topo.push_back(node);
+        } else {
+            order.push_back(node);
+            stack.pop_back();
         }
-    };
+    }
+}
+
+void Tensor::materialize_grad(Tape& tape) {
+    if (!requires_grad_ || grad_.data()) {
+        return;
+    }
+    owned_grad_ = tape.acquire(data_.rows(), data_.cols());
+    owned_grad_.setZero();
+    new (&grad_) MatrixView(owned_grad_.data(), data_.rows(), data_.cols());
+    tape.track_bytes(grad_.size() * sizeof(float));
+}
+
+void Tensor::release_buffers(Tape& tape) {
+    // only nodes of this tape that own their buffers; leaves and parameters stay as they are
+    if (!tape.contains(this, tape_index_) || storage_) {
+        return;
+    }
+    tape.untrack_bytes((data_.size() + grad_.size()) * sizeof(float));
+    tape.recycle(std::move(owned_data_));
+    tape.recycle(std::move(owned_grad_));
+    owned_data_ = Eigen::MatrixXf();
+    owned_grad_ = Eigen::MatrixXf();
+    new (&data_) MatrixView(nullptr, 0, 0);
+    new (&grad_) MatrixView(nullptr, 0, 0);
+    released_ = true;
+}
+
+void Tensor::run_backward(Tape* planner, bool release) {
+    // versions only grow, so an equal sum means none of the saved values was overwritten
+    if (input_versions() != saved_versions_) {
+        throw std::runtime_error("backward: an input of " + op_ + " was modified in place after the op read it");
+    }
+    ProfileScope profile(op_.c_str(), ProfilePhase::Backward);
+    if (profile.enabled()) {
+        std::size_t deferred_grads = 0; // allocated below, on a planning tape
+        for (const auto& parent : prev_) {
+            if (planner && parent->requires_grad_ && !parent->grad_.data()) {
+                deferred_grads += parent->data_.size() * sizeof(float);
+            }
+            profile.add_shape(parent->data_.rows(), parent->data_.cols());
+        }
+        profile.describe(backward_flops(*this), deferred_grads);
+    }
+
+    if (!planner) {
+        backward_fn_();
+        return;
+    }
 
-    build_topo(shared_from_this());
+    // in reverse topological order every consumer of this node has already run, so once
+    // its own closure is done neither its value nor its grad is read again
+    for (const auto& parent : prev_) {
+        if (released_ || parent->released_) {
+            throw std::runtime_error("backward: the graph's buffers were already released by the memory planner");
+        }
+        parent->materialize_grad(*planner);
+    }
+    backward_fn_();
+    if (release) {
+        release_buffers(*planner);
+    }
+}
 
-    if (data_.rows() == 1 && data_.cols() == 1) {
-        grad_(0, 0) = 1.0f;
-    } else {
+void Tensor::backward() {
+    if (data_.rows() != 1 || data_.cols() != 1) {
         throw std::runtime_error("backward should be called only on scalar outputs, i.e., loss)");
     }
+    static const Eigen::MatrixXf one = Eigen::MatrixXf::Ones(1, 1);
+    backward(one);
+}
+
+void Tensor::backward(kernels::ConstMatrixRef grad_output) {
+    if (!requires_grad_) {
+        throw std::runtime_error("backward: tensor does not require grad (built under NoGradGuard?)");
+    }
+    if (grad_output.rows() != data_.rows() || grad_output.cols() != data_.cols()) {
+        throw std::runtime_error("backward: grad_output shape differs from the tensor's");
+    }
+
+    Tape* tape = Tape::current();
+    Tape* planner = tape && tape->plan_memory() ? tape : nullptr;
+    if (planner) {
+        materialize_grad(*planner);
+    }
+    grad_ = grad_output;
+
+    bool cacheable = tape && tape->reuse_order() && tape->contains(this, tape_index_);
+    if (cacheable) {
+        if (const std::vector<int>* cached = tape->cached_order(tape_index_)) {
+            for (int index : *cached) {
+                Tensor* node = tape->node(index);
+                node->run_backward(planner, node != this);
+            }
+            return;
+        }
+    }
+
+    std::vector<Tensor*> topo;
+    topo_sort(this, topo);
 
-    std::reverse(topo.begin(), topo.end());
-    for (const auto& node : topo) {
-        if (node->backward_fn_) {
-            node->backward_fn_();
+    std::vector<int> order;
+    for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
+        Tensor* node = *it;
+        if (!node->backward_fn_) {
+            continue;
+        }
+        if (cacheable) {
+            // a node built outside the tape has no stable index to cache
+            if (tape->contains(node, node->tape_index_)) {
+                order.push_back(node->tape_index_);
+            } else {
+                cacheable = false;
+            }
         }
+        node->run_backward(planner, node != this);
+    }
+
+    if (cacheable) {
+        tape->store_order(tape_index_, std::move(order));
+    }
+}
+
+std::shared_ptr<Tensor> checkpoint(const SegmentFn& segment, std::shared_ptr<Tensor> x,
+                                   const std::vector<std::shared_ptr<Tensor>>& parameters) {
+    if (GraphRecorder::active()) {
+        throw std::runtime_error("checkpoint: checkpointed segments cannot be captured into a static graph");
+    }
+
+    ProfileScope profile("checkpoint", ProfilePhase::Forward);
+    bool requires_grad = grad_enabled() && x->requires_grad_;
+    for (const auto& p : parameters) {
+        requires_grad = requires_grad || (grad_enabled() && p->requires_grad_);
+    }
+
+    // forward without a graph: the segment's activations are dropped as soon as they are consumed
+    OpBuffer result;
+    Layout layout;
+    {
+        NoGradGuard no_grad;
+        auto y = segment(x);
+        result = new_buffer(y->data_.rows(), y->data_.cols());
+        result.data = y->data_;
+        layout = y->layout_;
+    }
+    auto out = make_node(std::move(result), requires_grad);
+    out->layout_ = layout;
+    if (profile.enabled()) {
+        profile.describe(0.0, node_bytes(*out), {shape(x->data_)}); // the segment's ops are recorded on their own
     }
+
+    if (requires_grad) {
+        out->prev_ = {x};
+        out->prev_.insert(out->prev_.end(), parameters.begin(), parameters.end());
+        out->op_ = "checkpoint";
+
+        out->set_backward([segment, x, out=out.get()]() {
+            // the segment is re-run on a private tape, so the outer tape's nodes and cached
+            // order are untouched, and backpropagated from this node's grad; the tapes are kept
+            // per thread, one per nesting level, so their arenas and pools are reused
+            thread_local std::vector<std::unique_ptr<Tape>> tapes;
+            thread_local std::size_t depth = 0;
+            if (depth == tapes.size()) {
+                tapes.push_back(std::make_unique<Tape>());
+                tapes.back()->set_plan_memory(true);
+            }
+            Tape& tape = *tapes[depth];
+            struct Nesting {
+                std::size_t& depth;
+                explicit Nesting(std::size_t& d) : depth(d) { depth++; }
+                ~Nesting() { depth--; }
+            } nesting(depth);
+            TapeGuard guard(tape);
+
+            auto input = std::make_shared<Tensor>(Eigen::MatrixXf(x->data_), x->requires_grad_);
+            input->layout_ = x->layout_;
+            auto y = segment(input);
+            y->backward(out->grad_);
+            if (x->requires_grad_) {
+                x->grad_ += input->grad_;
+            }
+        });
+    }
+
+    return out;
 }
 
 std::shared_ptr<Tensor> operator+(std::shared_ptr<Tensor> a, std::shared_ptr<Tensor> b) {
@@ -236,4 +855,18 @@ std::shared_ptr<Tensor> matmul(std::shared_ptr<Tensor> a, std::shared_ptr<Tensor
 
 std::shared_ptr<Tensor> relu(std::shared_ptr<Tensor> x) {
     return x->relu();
-}
\ No newline at end of file
+}
+
+std::shared_ptr<Tensor> linear(std::shared_ptr<Tensor> x, std::shared_ptr<Tensor> weight,
+                               std::shared_ptr<Tensor> bias, Activation act) {
+    return x->linear(weight, bias, act);
+}
+
+std::shared_ptr<Tensor> cross_entropy(std::shared_ptr<Tensor> logits, const std::vector<int>& targets) {
+    return logits->cross_entropy(targets);
+}
+
+std::shared_ptr<Tensor> conv2d(std::shared_ptr<Tensor> x, std::shared_ptr<Tensor> weight, std::shared_ptr<Tensor> bias,
+                               const Conv2dShape& shape, ConvAlgorithm algorithm) {
+    return x->conv2d(weight, bias, shape, algorithm);
+}
@@ -0,0 +1,86 @@
+#include "../include/thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+ThreadPool::ThreadPool(int num_threads) {
+    for (int i = 1; i < std::max(num_threads, 1); i++) {
+        workers_.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::worker_loop() {
+    std::uint64_t seen = 0;
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+        if (stop_) {
+            return;
+        }
+        seen = generation_;
+        lock.unlock();
+
+        run_tasks();
+
+        lock.lock();
+        if (--active_workers_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_tasks() {
+    for (int i = next_task_++; i < num_tasks_; i = next_task_++) {
+        try {
+            (*task_)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int n, const std::function<void(int)>& fn) {
+    if (n <= 0) {
+        return;
+    }
+    if (workers_.empty() || n == 1) {
+        for (int i = 0; i < n; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &fn;
+        num_tasks_ = n;
+        next_task_ = 0;
+        active_workers_ = static_cast<int>(workers_.size());
+        error_ = nullptr;
+        generation_++;
+    }
+    start_.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&]() { return active_workers_ == 0; });
+    task_ = nullptr;
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
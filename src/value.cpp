@@ -1,6 +1,8 @@
 #include "../include/value.h"
 
+#include <atomic>
 #include <cmath>
+#include <vector>
 
 Value::Value(double data, const std::string& label)
     : data_(data), grad_(0.0), op_(""), prev_(), label_(label) {}
@@ -84,6 +86,7 @@ std::shared_ptr<Value> Value::pow(std::shared_ptr<Value> other) {
     std::string label = "(" + op + "(" + this->label_ + "," + other->label_ + ")" + ")";
 
     auto out = std::make_shared<Value>(result, 0.0, op, prev, label);
+    out->exponent_ = other;
 
     out->backward_ = [this, out, other]() {
         auto self = shared_from_this();
@@ -103,24 +106,32 @@ std::ostream& operator<<(std::ostream& os, const Value& val) {
 }
 
 void Value::backward() {
-    std::vector<std::shared_ptr<Value>> topo;
-    std::unordered_set<Value*> visited;
-
-    std::function<void(std::shared_ptr<Value>)> build_topo = [&](std::shared_ptr<Value> v) {
-        if (visited.find(v.get()) == visited.end()) {
-            visited.insert(v.get());
-            for (const auto& child : v->prev_) {
-                build_topo(child);
+    static std::atomic<std::uint64_t> generation{0};
+    const std::uint64_t mark = ++generation;
+
+    // iterative post-order dfs with an explicit stack, so deep expressions cannot overflow
+    std::vector<Value*> topo;
+    std::vector<std::pair<Value*, std::set<std::shared_ptr<Value>>::const_iterator>> stack;
+    this->topo_mark_ = mark;
+    stack.push_back({this, prev_.begin()});
+
+    while (!stack.empty()) {
+        auto& [v, next] = stack.back();
+        if (next != v->prev_.end()) {
+            Value* child = (next++)->get();
+            if (child->topo_mark_ != mark) {
+                child->topo_mark_ = mark;
+                stack.push_back({child, child->prev_.begin()});
             }
+        } else {
             topo.push_back(v);
+            stack.pop_back();
         }
-    };
+    }
 
-    build_topo(shared_from_this());
     this->grad_ = 1.0;
 
-    std::reverse(topo.begin(), topo.end());
-    for (const auto& v : topo) {
-        if (v->backward_) v->backward_();
+    for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
+        if ((*it)->backward_) (*it)->backward_();
     }
 }
\ No newline at end of file
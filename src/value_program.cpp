@@ -0,0 +1,196 @@
+#include "../include/value_program.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+// operands of a node in evaluation order; a+a and a*a keep a single entry in prev
+int operands_of(const Value* v, std::array<const Value*, 2>& operands) {
+    const auto& prev = v->get_prev();
+    int n = 0;
+    for (const auto& p : prev) {
+        operands[n++] = p.get();
+    }
+    if (v->get_op() == "pow") {
+        operands[n++] = v->get_exponent().get();
+    } else if (n == 1 && (v->get_op() == "+" || v->get_op() == "*")) {
+        operands[n++] = operands[0];
+    }
+    return n;
+}
+
+ValueOpCode opcode_of(const std::string& op) {
+    if (op == "+") return ValueOpCode::Add;
+    if (op == "*") return ValueOpCode::Mul;
+    if (op == "tanh") return ValueOpCode::Tanh;
+    if (op == "exp") return ValueOpCode::Exp;
+    if (op == "pow") return ValueOpCode::Pow;
+    throw std::runtime_error("ValueProgram: unsupported op '" + op + "'");
+}
+}
+
+ValueProgram ValueProgram::compile(const std::shared_ptr<Value>& root, const std::vector<std::shared_ptr<Value>>& inputs) {
+    ValueProgram program;
+    program.num_inputs_ = static_cast<int>(inputs.size());
+
+    std::unordered_map<const Value*, std::int32_t> slot_of;
+    std::vector<char> constant; // per slot: its value does not depend on any input
+    for (const auto& input : inputs) {
+        if (!slot_of.emplace(input.get(), static_cast<std::int32_t>(program.values_.size())).second) {
+            throw std::runtime_error("ValueProgram: input passed twice");
+        }
+        program.values_.push_back(input->get_data());
+        constant.push_back(0);
+    }
+
+    // iterative post-order dfs, so operands get their slots before the nodes that read them
+    struct Frame {
+        const Value* v;
+        std::array<const Value*, 2> operands;
+        int num_operands;
+        int next;
+    };
+    std::vector<Frame> stack;
+    auto visit = [&](const Value* v) {
+        if (slot_of.count(v)) {
+            return;
+        }
+        Frame frame{v, {}, 0, 0};
+        frame.num_operands = operands_of(v, frame.operands);
+        stack.push_back(frame);
+    };
+
+    visit(root.get());
+    while (!stack.empty()) {
+        Frame& frame = stack.back();
+        if (frame.next < frame.num_operands) {
+            visit(frame.operands[frame.next++]);
+            continue;
+        }
+
+        const Value* v = frame.v;
+        const std::int32_t slot = static_cast<std::int32_t>(program.values_.size());
+        bool folded = true;
+        std::array<std::int32_t, 2> operand_slots = {-1, -1};
+        for (int i = 0; i < frame.num_operands; i++) {
+            operand_slots[i] = slot_of.at(frame.operands[i]);
+            folded = folded && constant[operand_slots[i]];
+        }
+        stack.pop_back();
+
+        slot_of.emplace(v, slot);
+        program.values_.push_back(v->get_data());
+        constant.push_back(folded);
+        if (!folded) {
+            program.instructions_.push_back({opcode_of(v->get_op()), operand_slots[0], operand_slots[1], slot});
+        }
+    }
+
+    program.root_ = slot_of.at(root.get());
+    program.grads_.assign(program.values_.size(), 0.0);
+    return program;
+}
+
+double ValueProgram::forward(const Eigen::Ref<const Eigen::VectorXd>& inputs) {
+    if (inputs.size() != num_inputs_) {
+        throw std::runtime_error("ValueProgram: expected " + std::to_string(num_inputs_) + " inputs");
+    }
+    double* v = values_.data();
+    for (int i = 0; i < num_inputs_; i++) {
+        v[i] = inputs[i];
+    }
+    for (const Instruction& ins : instructions_) {
+        switch (ins.op) {
+            case ValueOpCode::Add: v[ins.out] = v[ins.a] + v[ins.b]; break;
+            case ValueOpCode::Mul: v[ins.out] = v[ins.a] * v[ins.b]; break;
+            case ValueOpCode::Tanh: v[ins.out] = std::tanh(v[ins.a]); break;
+            case ValueOpCode::Exp: v[ins.out] = std::exp(v[ins.a]); break;
+            case ValueOpCode::Pow: v[ins.out] = std::pow(v[ins.a], v[ins.b]); break;
+        }
+    }
+    return v[root_];
+}
+
+void ValueProgram::backward() {
+    const double* v = values_.data();
+    double* g = grads_.data();
+    std::fill(grads_.begin(), grads_.end(), 0.0);
+    g[root_] = 1.0;
+
+    // folded constants also collect grads here, which are never read
+    for (auto it = instructions_.rbegin(); it != instructions_.rend(); ++it) {
+        const Instruction& ins = *it;
+        const double out = g[ins.out];
+        switch (ins.op) {
+            case ValueOpCode::Add:
+                g[ins.a] += out;
+                g[ins.b] += out;
+                break;
+            case ValueOpCode::Mul:
+                g[ins.a] += v[ins.b] * out;
+                g[ins.b] += v[ins.a] * out;
+                break;
+            case ValueOpCode::Tanh: g[ins.a] += (1.0 - v[ins.out] * v[ins.out]) * out; break;
+            case ValueOpCode::Exp: g[ins.a] += v[ins.out] * out; break;
+            case ValueOpCode::Pow: g[ins.a] += v[ins.b] * std::pow(v[ins.a], v[ins.b] - 1.0) * out; break;
+        }
+    }
+}
+
+Eigen::Ref<const Eigen::ArrayXd> ValueProgram::forward_lanes(const Eigen::Ref<const Eigen::ArrayXXd>& inputs) {
+    if (inputs.cols() != num_inputs_) {
+        throw std::runtime_error("ValueProgram: expected " + std::to_string(num_inputs_) + " inputs per lane");
+    }
+    const Eigen::Index lanes = inputs.rows();
+    const Eigen::Index slots = static_cast<Eigen::Index>(values_.size());
+    if (lane_values_.rows() != lanes) {
+        // the constants sit in values_ and are broadcast once per lane count
+        lane_values_ = Eigen::Map<const Eigen::Array<double, 1, Eigen::Dynamic>>(values_.data(), slots).replicate(lanes, 1);
+        lane_grads_.resize(lanes, slots);
+    }
+
+    auto& v = lane_values_;
+    v.leftCols(num_inputs_) = inputs;
+    for (const Instruction& ins : instructions_) {
+        switch (ins.op) {
+            case ValueOpCode::Add: v.col(ins.out) = v.col(ins.a) + v.col(ins.b); break;
+            case ValueOpCode::Mul: v.col(ins.out) = v.col(ins.a) * v.col(ins.b); break;
+            case ValueOpCode::Tanh: v.col(ins.out) = v.col(ins.a).tanh(); break;
+            case ValueOpCode::Exp: v.col(ins.out) = v.col(ins.a).exp(); break;
+            case ValueOpCode::Pow: v.col(ins.out) = v.col(ins.a).pow(v.col(ins.b)); break;
+        }
+    }
+    return v.col(root_);
+}
+
+Eigen::Ref<const Eigen::ArrayXXd> ValueProgram::backward_lanes() {
+    const auto& v = lane_values_;
+    auto& g = lane_grads_;
+    g.setZero();
+    g.col(root_).setOnes();
+
+    for (auto it = instructions_.rbegin(); it != instructions_.rend(); ++it) {
+        const Instruction& ins = *it;
+        switch (ins.op) {
+            case ValueOpCode::Add:
+                g.col(ins.a) += g.col(ins.out);
+                g.col(ins.b) += g.col(ins.out);
+                break;
+            case ValueOpCode::Mul:
+                g.col(ins.a) += v.col(ins.b) * g.col(ins.out);
+                g.col(ins.b) += v.col(ins.a) * g.col(ins.out);
+                break;
+            case ValueOpCode::Tanh: g.col(ins.a) += (1.0 - v.col(ins.out).square()) * g.col(ins.out); break;
+            case ValueOpCode::Exp: g.col(ins.a) += v.col(ins.out) * g.col(ins.out); break;
+            case ValueOpCode::Pow:
+                g.col(ins.a) += v.col(ins.b) * v.col(ins.a).pow(v.col(ins.b) - 1.0) * g.col(ins.out);
+                break;
+        }
+    }
+    return g.leftCols(num_inputs_);
+}
@@ -1,8 +1,133 @@
 #include "../include/tensor.h"
+#include "../include/value.h"
+#include "../include/scalar.h"
+#include "../include/value_program.h"
 #include "../include/nn.h"
 #include "../include/optim.h"
+#include "../include/tape.h"
+#include "../include/buffer_pool.h"
+#include "../include/lazy.h"
+#include "../include/graph.h"
+#include "../include/parallel.h"
+#include "../include/data.h"
+#include "../include/data_loader.h"
+#include "../include/checkpoint.h"
+#include "../include/quantize.h"
+#include "../include/server.h"
+#include "../include/profiler.h"
 #include <iostream>
-#include <cassert>s
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+void test_scalar_tape() {
+    // the neuron of src/main.cpp on both engines
+    auto x1 = std::make_shared<Value>(0.5, "x1");
+    auto x2 = std::make_shared<Value>(-2.0, "x2");
+    auto w1 = std::make_shared<Value>(0.2, "w1");
+    auto w2 = std::make_shared<Value>(-0.5, "w2");
+    auto b = std::make_shared<Value>(0.1, "b");
+    auto z = *(*(*w1 * x1) + (*w2 * x2)) + b;
+    auto h = z->exp()->pow(std::make_shared<Value>(2.0))->tanh();
+    h->backward();
+
+    ScalarTape tape;
+    Scalar sx1 = tape.leaf(0.5, "x1");
+    Scalar sx2 = tape.leaf(-2.0, "x2");
+    Scalar sw1 = tape.leaf(0.2, "w1");
+    Scalar sw2 = tape.leaf(-0.5, "w2");
+    Scalar sb = tape.leaf(0.1, "b");
+    Scalar sh = ((sw1 * sx1 + sw2 * sx2 + sb).exp().pow(2.0)).tanh();
+    tape.backward(sh);
+
+    assert(std::abs(sh.data() - h->get_data()) < 1e-12);
+    assert(std::abs(sx1.grad() - x1->get_grad()) < 1e-12);
+    assert(std::abs(sw2.grad() - w2->get_grad()) < 1e-12);
+    assert(std::abs(sb.grad() - b->get_grad()) < 1e-12);
+    assert(tape.label(sh) == "tanh(pow(exp((((w1*x1)+(w2*x2))+b)),v10))");
+
+    // a deep chain: no recursion and no per-node allocation beyond the arrays
+    tape.clear();
+    tape.reserve(2'000'001);
+    Scalar x = tape.leaf(1.0);
+    Scalar y = x;
+    for (int i = 0; i < 1'000'000; i++) {
+        y = y * 1.0000001;
+    }
+    tape.backward(y);
+    assert(std::abs(x.grad() - y.data()) < 1e-9);
+    assert(tape.size() == 2'000'001);
+
+    std::cout << "test_scalar_tape: PASSED" << std::endl;
+}
+
+void test_value_program() {
+    auto neuron = [](double x1, double x2, double w1, double w2, double b) {
+        std::vector<std::shared_ptr<Value>> leaves = {
+            std::make_shared<Value>(x1), std::make_shared<Value>(x2), std::make_shared<Value>(w1),
+            std::make_shared<Value>(w2), std::make_shared<Value>(b)};
+        auto z = *(*(*leaves[2] * leaves[0]) + (*leaves[3] * leaves[1])) + leaves[4];
+        // a square (one entry in prev) and a constant subexpression that should be folded
+        auto two = std::make_shared<Value>(2.0);
+        auto e = z->exp()->pow(two);
+        auto h = (*(*e * e) + (*two * two))->tanh();
+        leaves.push_back(h);
+        return leaves;
+    };
+
+    auto graph = neuron(0.5, -2.0, 0.2, -0.5, 0.1);
+    auto root = graph.back();
+    graph.pop_back();
+    ValueProgram program = ValueProgram::compile(root, graph);
+    assert(program.num_inputs() == 5);
+    assert(program.num_instructions() == 9); // the 2*2 node is folded
+
+    // new leaf values: the compiled program against a freshly built graph
+    Eigen::ArrayXXd sets(7, 5);
+    for (int lane = 0; lane < sets.rows(); lane++) {
+        sets.row(lane) << 0.1 * lane, -0.3, 0.05 * lane, 0.4, -0.2 + 0.01 * lane;
+    }
+    for (int lane = 0; lane < sets.rows(); lane++) {
+        auto expected = neuron(sets(lane, 0), sets(lane, 1), sets(lane, 2), sets(lane, 3), sets(lane, 4));
+        expected.back()->backward();
+
+        Eigen::VectorXd inputs = sets.row(lane).transpose();
+        assert(std::abs(program.forward(inputs) - expected.back()->get_data()) < 1e-12);
+        program.backward();
+        for (int i = 0; i < 5; i++) {
+            assert(std::abs(program.grad(i) - expected[i]->get_grad()) < 1e-12);
+        }
+    }
+
+    // every input set at once, one per lane
+    auto outputs = program.forward_lanes(sets);
+    Eigen::ArrayXd out = outputs;
+    Eigen::ArrayXXd grads = program.backward_lanes();
+    for (int lane = 0; lane < sets.rows(); lane++) {
+        Eigen::VectorXd inputs = sets.row(lane).transpose();
+        assert(std::abs(out(lane) - program.forward(inputs)) < 1e-12);
+        program.backward();
+        for (int i = 0; i < 5; i++) {
+            assert(std::abs(grads(lane, i) - program.grad(i)) < 1e-12);
+        }
+    }
+
+    bool threw = false;
+    try {
+        program.forward(Eigen::VectorXd::Zero(3));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "test_value_program: PASSED" << std::endl;
+}
 
 void test_basic_operations() {
     Eigen::MatrixXf a_data(2, 2);
@@ -65,12 +190,1323 @@ void test_optimization() {
     std::cout << "test_optimization: PASSED" << std::endl;
 }
 
+void test_optimizers() {
+    // scalar reference updates, three steps with a fixed gradient
+    const float lr = 0.01f, b1 = 0.9f, b2 = 0.999f, eps = 1e-8f, wd = 0.1f, mu = 0.9f;
+    auto reference = [&](const std::string& kind, float p, float g) {
+        float m = 0.0f, v = 0.0f;
+        for (int t = 1; t <= 3; t++) {
+            if (kind == "nesterov") {
+                v = mu * v + g;
+                p -= lr * (g + mu * v);
+            } else {
+                float gt = kind == "adam" ? g + wd * p : g;
+                if (kind == "adamw") p *= 1.0f - lr * wd;
+                m = b1 * m + (1 - b1) * gt;
+                v = b2 * v + (1 - b2) * gt * gt;
+                float m_hat = m / (1 - std::pow(b1, t)), v_hat = v / (1 - std::pow(b2, t));
+                p -= lr * m_hat / (std::sqrt(v_hat) + eps);
+            }
+        }
+        return p;
+    };
+
+    // larger than one chunk, so the update is split and can run on the pool
+    auto make_params = []() {
+        auto w = std::make_shared<Tensor>(Eigen::MatrixXf::Random(100, 50), true);
+        auto b = std::make_shared<Tensor>(Eigen::MatrixXf::Random(100, 1), true);
+        w->grad().setRandom();
+        b->grad().setRandom();
+        return std::vector<std::shared_ptr<Tensor>>{w, b};
+    };
+
+    ThreadPool pool(3);
+    for (std::string kind : {"nesterov", "adam", "adamw"}) {
+        auto serial = make_params();
+        auto threaded = serial;
+        for (auto& p : threaded) {
+            p = std::make_shared<Tensor>(p->data(), true);
+        }
+        for (std::size_t i = 0; i < serial.size(); i++) {
+            threaded[i]->grad() = serial[i]->grad();
+        }
+        Eigen::MatrixXf initial = serial[0]->data();
+
+        auto make_optimizer = [&](const std::vector<std::shared_ptr<Tensor>>& params) -> std::unique_ptr<Optimizer> {
+            if (kind == "nesterov") return std::make_unique<SGD>(params, lr, mu, true);
+            if (kind == "adam") return std::make_unique<Adam>(params, lr, b1, b2, eps, wd);
+            return std::make_unique<AdamW>(params, lr, b1, b2, eps, wd);
+        };
+        auto a = make_optimizer(serial);
+        auto b = make_optimizer(threaded);
+        b->set_thread_pool(&pool);
+        for (int t = 0; t < 3; t++) {
+            a->step();
+            b->step();
+        }
+
+        assert(serial[0]->data() == threaded[0]->data());
+        assert(serial[1]->data() == threaded[1]->data());
+        for (int i = 0; i < initial.size(); i += 97) {
+            float expected = reference(kind, initial(i), serial[0]->grad()(i));
+            assert(std::abs(serial[0]->data()(i) - expected) < 1e-5f);
+        }
+    }
+
+    std::cout << "test_optimizers: PASSED" << std::endl;
+}
+
+void test_flat_parameters() {
+    auto make_model = []() {
+        return Sequential({std::make_shared<Linear>(6, 5), std::make_shared<ReLU>(), std::make_shared<Linear>(5, 3)});
+    };
+    Sequential flat = make_model();
+    Sequential reference = make_model();
+    auto params = flat.parameters();
+    auto reference_params = reference.parameters();
+    for (std::size_t i = 0; i < params.size(); i++) {
+        reference_params[i]->data() = params[i]->data();
+    }
+
+    ParameterBuffer& buffer = flat.flatten_parameters();
+    assert(buffer.size() == 6 * 5 + 5 + 5 * 3 + 3);
+    assert(reinterpret_cast<std::uintptr_t>(buffer.data().data()) % 64 == 0);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < params.size(); i++) {
+        // same tensors, now views into the buffer, values preserved
+        assert(params[i]->data().data() == buffer.data().data() + offset);
+        assert(params[i]->grad().data() == buffer.grad().data() + offset);
+        assert(params[i]->data() == reference_params[i]->data());
+        offset += params[i]->data().size();
+    }
+
+    Adam flat_optimizer(params, 0.01f);
+    Adam reference_optimizer(reference_params, 0.01f);
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(6, 4));
+    std::vector<int> target = {0, 2, 1, 0};
+    for (int step = 0; step < 3; step++) {
+        flat_optimizer.zero_grad();
+        reference_optimizer.zero_grad();
+        flat.forward(x)->log_softmax()->nll_loss(target)->backward();
+        reference.forward(x)->log_softmax()->nll_loss(target)->backward();
+        flat_optimizer.step();
+        reference_optimizer.step();
+    }
+    // small products are vectorized around the buffers' alignment, so allow rounding differences
+    for (std::size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->data().isApprox(reference_params[i]->data(), 1e-5f));
+    }
+
+    float norm = flat.clip_grad_norm(0.01f);
+    assert(std::abs(norm - reference.clip_grad_norm(0.01f)) < 1e-5f);
+    assert(std::abs(buffer.grad().norm() - 0.01f) < 1e-4f);
+
+    flat.zero_grad();
+    assert(buffer.grad().isZero(0.0f));
+
+    // views have a fixed shape; set_data gives a parameter its own storage of a new shape
+    auto bias = params.back();
+    bias->set_data(Eigen::MatrixXf::Ones(4, 1));
+    assert(bias->rows() == 4 && bias->data().isOnes() && bias->grad().rows() == 4);
+    assert(bias->data().data() != buffer.data().data() + buffer.size() - 3);
+
+    std::cout << "test_flat_parameters: PASSED" << std::endl;
+}
+
+void test_tape() {
+    Linear layer(3, 2);
+
+    Eigen::MatrixXf input_data(3, 4);
+    input_data.setRandom();
+    auto input = std::make_shared<Tensor>(input_data);
+    std::vector<int> target = {0, 1, 1, 0};
+
+    layer.zero_grad();
+    layer.forward(input)->log_softmax()->nll_loss(target)->backward();
+    Eigen::MatrixXf eager_grad = layer.parameters()[0]->grad();
+
+    Tape tape;
+    {
+        TapeGuard guard(tape);
+        layer.zero_grad();
+        auto loss = layer.forward(input)->log_softmax()->nll_loss(target);
+        loss->backward();
+        assert(tape.arena().bytes_allocated() > 0);
+    }
+    assert(tape.arena().bytes_allocated() == 0);
+    assert(tape.arena().live_allocations() == 0);
+    assert(tape.resets() == 1);
+    assert(layer.parameters()[0]->grad().isApprox(eager_grad));
+
+    // a node still referenced keeps the arena from rewinding, but the tape forgets the step
+    {
+        TapeGuard guard(tape);
+        auto loss = layer.forward(input)->log_softmax()->nll_loss(target);
+        assert(tape.num_nodes() > 0);
+        assert(!tape.reset());
+        assert(tape.failed_resets() == 1 && tape.resets() == 1);
+        assert(tape.num_nodes() == 0);
+        assert(tape.arena().bytes_allocated() > 0);
+    }
+    assert(tape.resets() == 2 && tape.arena().bytes_allocated() == 0);
+
+    std::cout << "test_tape: PASSED" << std::endl;
+}
+
+void test_backward_order() {
+    // long chain: the topo sort must not recurse per node
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Constant(1, 1, 2.0f), true);
+    auto one = std::make_shared<Tensor>(Eigen::MatrixXf::Constant(1, 1, 1.0f));
+    auto y = x;
+    for (int i = 0; i < 10000; i++) {
+        y = y->add(one);
+    }
+    y->backward();
+    assert(x->grad()(0, 0) == 1.0f);
+
+    // same graph structure on every step: the order is computed once
+    Linear layer(3, 2);
+    auto input = std::make_shared<Tensor>(Eigen::MatrixXf::Random(3, 4));
+    std::vector<int> target = {0, 1, 1, 0};
+
+    layer.zero_grad();
+    layer.forward(input)->relu()->log_softmax()->nll_loss(target)->backward();
+    Eigen::MatrixXf eager_grad = layer.parameters()[0]->grad();
+
+    Tape tape;
+    tape.set_reuse_order(true);
+    for (int step = 0; step < 3; step++) {
+        TapeGuard guard(tape);
+        layer.zero_grad();
+        auto loss = layer.forward(input)->relu()->log_softmax()->nll_loss(target);
+        loss->backward();
+        assert(layer.parameters()[0]->grad().isApprox(eager_grad));
+    }
+    assert(tape.order_misses() == 1);
+    assert(tape.order_hits() == 2);
+
+    std::cout << "test_backward_order: PASSED" << std::endl;
+}
+
+void test_memory_planner() {
+    Sequential model({std::make_shared<Linear>(6, 8), std::make_shared<ReLU>(), std::make_shared<Linear>(8, 8),
+                      std::make_shared<ReLU>(), std::make_shared<Linear>(8, 3)});
+    auto input = std::make_shared<Tensor>(Eigen::MatrixXf::Random(6, 5));
+    std::vector<int> target = {0, 1, 2, 1, 0};
+
+    auto run = [&](Tape& tape) {
+        model.zero_grad();
+        TapeGuard guard(tape);
+        auto hidden = model.forward(input);
+        auto loss = hidden->cross_entropy(target);
+        loss->backward();
+        if (tape.plan_memory()) {
+            // the logits were released once backward consumed them, the loss stays readable
+            assert(hidden->data().size() == 0);
+            assert(loss->data()(0, 0) > 0.0f);
+            assert(tape.live_bytes() < tape.peak_bytes());
+            bool threw = false;
+            try {
+                loss->backward();
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            assert(threw);
+        }
+        std::vector<Eigen::MatrixXf> grads;
+        for (auto& p : model.parameters()) grads.push_back(p->grad());
+        return grads;
+    };
+
+    Tape plain;
+    auto expected = run(plain);
+
+    Tape planned;
+    planned.set_plan_memory(true);
+    planned.set_reuse_order(true);
+    for (int step = 0; step < 3; step++) {
+        auto grads = run(planned);
+        for (size_t i = 0; i < grads.size(); i++) {
+            assert(grads[i] == expected[i]);
+        }
+        assert(planned.pooled_buffers() > 0);
+    }
+    assert(planned.last_peak_bytes() > 0);
+    assert(planned.last_peak_bytes() < plain.last_peak_bytes());
+
+    std::cout << "test_memory_planner: PASSED" << std::endl;
+}
+
+void test_buffer_pool() {
+    Sequential model({std::make_shared<Linear>(6, 8), std::make_shared<ReLU>(), std::make_shared<Linear>(8, 3)});
+    auto input = std::make_shared<Tensor>(Eigen::MatrixXf::Random(6, 5));
+    std::vector<int> target = {0, 1, 2, 1, 0};
+
+    auto step = [&]() {
+        model.zero_grad();
+        auto loss = model.forward(input)->cross_entropy(target);
+        loss->backward();
+        std::vector<Eigen::MatrixXf> grads;
+        for (auto& p : model.parameters()) grads.push_back(p->grad());
+        return grads;
+    };
+
+    auto expected = step();
+    BufferPool::set_enabled(true);
+    BufferPool::reset_stats();
+    step();
+    BufferPoolStats first = BufferPool::stats();
+    assert(first.misses > 0);
+    assert(first.bytes_in_use == 0 && first.bytes_cached > 0);
+
+    // same shapes every step: every buffer comes back from the pool, and the footprint stays put
+    for (int i = 0; i < 3; i++) {
+        auto grads = step();
+        for (size_t j = 0; j < grads.size(); j++) {
+            assert(grads[j] == expected[j]);
+        }
+    }
+    BufferPoolStats steady = BufferPool::stats();
+    assert(steady.misses == first.misses);
+    assert(steady.hits == 3 * first.misses);
+    assert(steady.peak_bytes == first.peak_bytes);
+
+    // a buffer freed on a thread that then exits is found by the others
+    Eigen::MatrixXf buffer = BufferPool::acquire(7, 9);
+    std::thread([&buffer]() { BufferPool::release(std::move(buffer)); }).join();
+    std::size_t hits = BufferPool::stats().hits;
+    buffer = BufferPool::acquire(9, 7);
+    assert(BufferPool::stats().hits == hits + 1);
+    assert(buffer.rows() == 9 && buffer.cols() == 7);
+    BufferPool::release(std::move(buffer));
+
+    // a tensor on a caller's matrix never hands it to the pool, and one on a pooled buffer
+    // still does after the pool is switched off
+    {
+        auto own = std::make_shared<Tensor>(Eigen::MatrixXf::Zero(4, 4), true, std::pmr::get_default_resource());
+        auto pooled = input->relu();
+        assert(BufferPool::stats().bytes_in_use == pooled->data().size() * sizeof(float));
+        BufferPool::set_enabled(false);
+        own.reset();
+        assert(BufferPool::stats().bytes_in_use == pooled->data().size() * sizeof(float));
+        pooled.reset();
+        assert(BufferPool::stats().bytes_in_use == 0);
+    }
+
+    BufferPool::set_enabled(false);
+    BufferPool::trim();
+    assert(BufferPool::stats().bytes_cached == 0);
+
+    std::cout << "test_buffer_pool: PASSED" << std::endl;
+}
+
+void test_conv2d() {
+    // naive loops over the flattened channel x row x column layout
+    auto reference = [](const Eigen::MatrixXf& x, const Eigen::MatrixXf& w, const Eigen::MatrixXf& b,
+                        const Conv2dShape& s) {
+        Eigen::MatrixXf out(s.out_features(), x.cols());
+        for (int n = 0; n < x.cols(); n++) {
+            for (int o = 0; o < s.out_channels; o++) {
+                for (int y = 0; y < s.out_height(); y++) {
+                    for (int xo = 0; xo < s.out_width(); xo++) {
+                        float sum = b(o, 0);
+                        for (int c = 0; c < s.channels; c++) {
+                            for (int ky = 0; ky < s.kernel; ky++) {
+                                for (int kx = 0; kx < s.kernel; kx++) {
+                                    int iy = y * s.stride + ky - s.padding, ix = xo * s.stride + kx - s.padding;
+                                    if (iy >= 0 && iy < s.height && ix >= 0 && ix < s.width) {
+                                        sum += w(o, (c * s.kernel + ky) * s.kernel + kx)
+                                               * x((c * s.height + iy) * s.width + ix, n);
+                                    }
+                                }
+                            }
+                        }
+                        out((o * s.out_height() + y) * s.out_width() + xo, n) = sum;
+                    }
+                }
+            }
+        }
+        return out;
+    };
+
+    for (Conv2dShape s : {Conv2dShape{2, 7, 6, 3, 3, 2, 1}, Conv2dShape{2, 7, 6, 3, 3, 1, 1},
+                          Conv2dShape{3, 9, 8, 4, 5, 1, 2}, Conv2dShape{2, 6, 6, 3, 4, 1, 0}}) {
+        Eigen::MatrixXf x_data = Eigen::MatrixXf::Random(s.in_features(), 3);
+        Eigen::MatrixXf w_data = Eigen::MatrixXf::Random(s.out_channels, s.patch_size());
+        Eigen::MatrixXf b_data = Eigen::MatrixXf::Random(s.out_channels, 1);
+        Eigen::MatrixXf grad_output = Eigen::MatrixXf::Random(s.out_features(), 3);
+        Eigen::MatrixXf expected = reference(x_data, w_data, b_data, s);
+
+        std::vector<ConvAlgorithm> algorithms = {ConvAlgorithm::Im2col};
+        if (s.kernel != 4) {
+            algorithms.push_back(ConvAlgorithm::Direct);
+        }
+        std::vector<Eigen::MatrixXf> first;
+        for (ConvAlgorithm algorithm : algorithms) {
+            auto x = std::make_shared<Tensor>(x_data, true);
+            auto w = std::make_shared<Tensor>(w_data, true);
+            auto b = std::make_shared<Tensor>(b_data, true);
+            auto out = x->conv2d(w, b, s, algorithm);
+            assert(out->op() == "conv2d" && out->rows() == s.out_features());
+            assert(out->data().isApprox(expected, 1e-5f));
+            out->backward(grad_output);
+            std::vector<Eigen::MatrixXf> grads = {x->grad(), w->grad(), b->grad()};
+            if (first.empty()) {
+                first = grads;
+            } else {
+                for (size_t i = 0; i < grads.size(); i++) {
+                    assert(grads[i].isApprox(first[i], 1e-5f));
+                }
+            }
+        }
+
+        // the conv is linear in x and w, so central differences are exact up to rounding
+        auto x = std::make_shared<Tensor>(x_data, true);
+        auto w = std::make_shared<Tensor>(w_data, true);
+        auto b = std::make_shared<Tensor>(b_data, true);
+        x->conv2d(w, b, s)->backward(grad_output);
+        const float eps = 1e-2f;
+        for (auto& leaf : {x, w, b}) {
+            for (int i = 0; i < leaf->data().size(); i += 7) {
+                float saved = leaf->data()(i);
+                leaf->data()(i) = saved + eps;
+                float up = x->conv2d(w, b, s)->data().cwiseProduct(grad_output).sum();
+                leaf->data()(i) = saved - eps;
+                float down = x->conv2d(w, b, s)->data().cwiseProduct(grad_output).sum();
+                leaf->data()(i) = saved;
+                assert(std::abs((up - down) / (2 * eps) - leaf->grad()(i)) < 1e-2f);
+            }
+        }
+    }
+
+    auto expect_throw = [](auto&& fn) {
+        bool threw = false;
+        try {
+            fn();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    };
+    Conv2dShape s{1, 6, 6, 2, 3};
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(36, 2));
+    auto w = std::make_shared<Tensor>(Eigen::MatrixXf::Random(2, 9));
+    auto b = std::make_shared<Tensor>(Eigen::MatrixXf::Zero(2, 1));
+    expect_throw([&]() { x->conv2d(w, b, Conv2dShape{1, 6, 6, 2, 4}, ConvAlgorithm::Direct); });
+    expect_throw([&]() { x->conv2d(w, b, Conv2dShape{1, 5, 6, 2, 3}); });
+    expect_throw([&]() { x->conv2d(b, w, s); });
+    auto batch_major = std::make_shared<Tensor>(Eigen::MatrixXf::Random(2, 36));
+    batch_major->set_layout(Layout::BatchMajor);
+    expect_throw([&]() { batch_major->conv2d(w, b, s); });
+    // no static graph opcode for convolutions
+    expect_throw([&]() {
+        StaticGraph::capture(x, {0, 1}, [&](std::shared_ptr<Tensor> in, const std::vector<int>& t) {
+            return std::vector<std::shared_ptr<Tensor>>{in->conv2d(w, b, s)->nll_loss(t)};
+        });
+    });
+
+    std::cout << "test_conv2d: PASSED" << std::endl;
+}
+
+void test_pool2d() {
+    // one 4x4 channel, 2x2 windows
+    Eigen::MatrixXf image(16, 1);
+    image << 1, 5, 2, 0,
+             3, 4, 8, 1,
+             0, 2, 1, 1,
+             7, 1, 3, 9;
+    auto x = std::make_shared<Tensor>(image, true);
+    MaxPool2d max_pool(1, 4, 4, 2);
+    auto pooled = max_pool.forward(x);
+    assert(pooled->rows() == 4);
+    assert(pooled->data()(0, 0) == 5 && pooled->data()(1, 0) == 8 && pooled->data()(2, 0) == 7
+           && pooled->data()(3, 0) == 9);
+    pooled->backward(Eigen::MatrixXf::Constant(4, 1, 2.0f));
+    assert(x->grad().sum() == 8.0f && x->grad()(1, 0) == 2 && x->grad()(6, 0) == 2 && x->grad()(12, 0) == 2
+           && x->grad()(15, 0) == 2);
+
+    x->zero_grad();
+    AvgPool2d avg_pool(1, 4, 4, 2);
+    auto averaged = avg_pool.forward(x);
+    assert(averaged->data()(0, 0) == 3.25f && averaged->data()(3, 0) == 3.5f);
+    averaged->backward(Eigen::MatrixXf::Ones(4, 1));
+    assert(x->grad().isApprox(Eigen::MatrixXf::Constant(16, 1, 0.25f)));
+
+    // overlapping windows (3x3, stride 1) over two channels: every window's max gets its grad
+    MaxPool2d overlapping(2, 4, 4, 3, 1);
+    auto y = std::make_shared<Tensor>(Eigen::MatrixXf::Random(32, 3), true);
+    overlapping.forward(y)->backward(Eigen::MatrixXf::Ones(8, 3));
+    assert(std::abs(y->grad().sum() - 24.0f) < 1e-5f);
+
+    // a small conv net trains on a fixed batch
+    Sequential model({std::make_shared<Conv2d>(1, 4, 3, 8, 8, 1, 1), std::make_shared<ReLU>(),
+                      std::make_shared<MaxPool2d>(4, 8, 8, 2), std::make_shared<Linear>(64, 3)});
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(64, 6));
+    std::vector<int> targets = {0, 1, 2, 0, 1, 2};
+    SGD optimizer(model.parameters(), 0.1f);
+    float first = 0.0f, last = 0.0f;
+    for (int step = 0; step < 50; step++) {
+        auto loss = model.forward(inputs)->cross_entropy(targets);
+        optimizer.zero_grad();
+        loss->backward();
+        optimizer.step();
+        (step == 0 ? first : last) = loss->data()(0, 0);
+    }
+    assert(last < 0.5f * first);
+
+    std::cout << "test_pool2d: PASSED" << std::endl;
+}
+
+void test_lazy_elementwise() {
+    Eigen::MatrixXf a_data = Eigen::MatrixXf::Random(5, 4);
+    Eigen::MatrixXf b_data = Eigen::MatrixXf::Random(5, 4);
+    Eigen::MatrixXf c_data = Eigen::MatrixXf::Random(5, 4);
+    Eigen::MatrixXf w_data = Eigen::MatrixXf::Random(3, 5);
+    std::vector<int> target = {0, 1, 2, 1};
+
+    // relu(a + b) fused into one node matches the eager ops, through a matmul boundary and under
+    // a memory-planning tape
+    auto run = [&](bool fused, bool planned) {
+        auto a = std::make_shared<Tensor>(a_data, true);
+        auto b = std::make_shared<Tensor>(b_data, true);
+        auto w = std::make_shared<Tensor>(w_data, true);
+        Tape tape;
+        tape.set_plan_memory(planned);
+        TapeGuard guard(tape);
+        std::shared_ptr<Tensor> hidden = fused ? lazy::relu(lazy::leaf(a) + b).eval() : a->add(b)->relu();
+        if (fused) {
+            assert(hidden->op() == "fused_elementwise" && hidden->prev().size() == 2);
+        }
+        auto loss = w->matmul(hidden)->cross_entropy(target);
+        loss->backward();
+        return std::vector<Eigen::MatrixXf>{a->grad(), b->grad(), w->grad()};
+    };
+    auto expected = run(false, false);
+    for (bool planned : {false, true}) {
+        auto grads = run(true, planned);
+        for (size_t i = 0; i < grads.size(); i++) {
+            assert(grads[i].isApprox(expected[i], 1e-6f));
+        }
+    }
+
+    // several backward blocks and a partial one
+    {
+        Eigen::MatrixXf grad_output = Eigen::MatrixXf::Random(37, 29);
+        auto big_a = std::make_shared<Tensor>(Eigen::MatrixXf::Random(37, 29), true);
+        auto big_b = std::make_shared<Tensor>(Eigen::MatrixXf::Random(37, 29), true);
+        big_a->add(big_b)->relu()->backward(grad_output);
+        Eigen::MatrixXf expected_a = big_a->grad(), expected_b = big_b->grad();
+        big_a->zero_grad();
+        big_b->zero_grad();
+        lazy::relu(lazy::leaf(big_a) + big_b).eval()->backward(grad_output);
+        assert(big_a->grad() == expected_a && big_b->grad() == expected_b);
+    }
+
+    // mul, sigmoid, tanh, constants and a repeated leaf, against finite differences
+    auto a = std::make_shared<Tensor>(a_data, true);
+    auto b = std::make_shared<Tensor>(b_data, false);
+    auto c = std::make_shared<Tensor>(c_data, true);
+    auto f = [&]() {
+        return lazy::tanh(lazy::relu(lazy::leaf(a) + b) * lazy::sigmoid(lazy::leaf(c))) * 0.5f - lazy::leaf(a) * c;
+    };
+    std::shared_ptr<Tensor> y = f();
+    assert(y->prev().size() == 3);
+    y->backward(Eigen::MatrixXf::Ones(5, 4));
+    assert(b->grad().size() == 0);
+
+    const float eps = 1e-2f;
+    for (auto& leaf : {a, c}) {
+        for (int i = 0; i < leaf->data().size(); i++) {
+            if (std::abs(a_data(i) + b_data(i)) < 2 * eps) {
+                continue; // relu's kink is within the step
+            }
+            float saved = leaf->data()(i);
+            leaf->data()(i) = saved + eps;
+            float up = f().eval()->data().sum();
+            leaf->data()(i) = saved - eps;
+            float down = f().eval()->data().sum();
+            leaf->data()(i) = saved;
+            assert(std::abs((up - down) / (2 * eps) - leaf->grad()(i)) < 1e-2f);
+        }
+    }
+
+    {
+        NoGradGuard no_grad;
+        std::shared_ptr<Tensor> z = f();
+        assert(z->prev().empty() && z->grad().size() == 0);
+        assert(z->data().isApprox(y->data()));
+    }
+
+    bool threw = false;
+    try {
+        auto wrong = std::make_shared<Tensor>(Eigen::MatrixXf::Random(5, 1));
+        std::shared_ptr<Tensor> z = lazy::leaf(a) + wrong;
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "test_lazy_elementwise: PASSED" << std::endl;
+}
+
+void test_checkpoint_segments() {
+    Sequential model({std::make_shared<Linear>(6, 8), std::make_shared<ReLU>(), std::make_shared<Linear>(8, 8),
+                      std::make_shared<ReLU>(), std::make_shared<Linear>(8, 8), std::make_shared<ReLU>(),
+                      std::make_shared<Linear>(8, 3)});
+    auto input = std::make_shared<Tensor>(Eigen::MatrixXf::Random(6, 5), true);
+    std::vector<int> target = {0, 1, 2, 1, 0};
+
+    auto run = [&](int segment, bool plan) {
+        model.zero_grad();
+        input->zero_grad();
+        model.set_checkpoint_segments(segment);
+        Tape tape;
+        tape.set_plan_memory(plan);
+        TapeGuard guard(tape);
+        auto loss = model.forward(input)->cross_entropy(target);
+        loss->backward();
+        std::vector<Eigen::MatrixXf> grads = {input->grad()};
+        for (auto& p : model.parameters()) grads.push_back(p->grad());
+        return grads;
+    };
+
+    auto expected = run(0, false);
+    for (int segment : {1, 3, 4}) {
+        for (bool plan : {false, true}) {
+            auto grads = run(segment, plan);
+            for (size_t i = 0; i < grads.size(); i++) {
+                assert(grads[i].isApprox(expected[i], 1e-5f));
+            }
+        }
+    }
+
+    // the segments keep their layers alive, so backward can run after the Sequential is gone
+    {
+        auto owner = std::make_unique<Sequential>(model.modules());
+        owner->set_checkpoint_segments(3);
+        model.zero_grad();
+        input->zero_grad();
+        auto loss = owner->forward(input)->cross_entropy(target);
+        owner.reset();
+        loss->backward();
+        assert(input->grad().isApprox(expected[0], 1e-5f));
+    }
+
+    // a single checkpointed module, with its fused activation forwarded
+    auto fc = std::make_shared<Linear>(6, 4);
+    auto wrapped = checkpoint(fc);
+    assert(wrapped->parameters().size() == fc->parameters().size());
+    input->zero_grad();
+    fc->zero_grad();
+    fc->forward(input, Activation::ReLU)->backward(Eigen::MatrixXf::Ones(4, 5));
+    Eigen::MatrixXf input_grad = input->grad();
+    Eigen::MatrixXf weight_grad = fc->weight()->grad();
+    input->zero_grad();
+    fc->zero_grad();
+    auto out = wrapped->forward(input, Activation::ReLU);
+    assert(out->data().isApprox(fc->forward(input, Activation::ReLU)->data()));
+    out->backward(Eigen::MatrixXf::Ones(4, 5));
+    assert(input->grad().isApprox(input_grad));
+    assert(fc->weight()->grad().isApprox(weight_grad));
+
+    std::cout << "test_checkpoint_segments: PASSED" << std::endl;
+}
+
+void test_sequential_modules() {
+    auto fc1 = std::make_shared<Linear>(6, 5);
+    auto fc2 = std::make_shared<Linear>(5, 3);
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(6, 4));
+    Eigen::MatrixXf expected = fc2->forward(fc1->forward(x)->relu())->data();
+
+    // any module chains, the linear + relu pair runs fused
+    Sequential model({fc1, std::make_shared<ReLU>(), fc2});
+    assert(model.forward(x)->data().isApprox(expected));
+    assert(model.parameters().size() == 4);
+
+    Sequential nested({std::make_shared<Sequential>(model), std::make_shared<ReLU>(), std::make_shared<ReLU>()});
+    assert(nested.forward(x)->data().isApprox(expected.cwiseMax(0.0f)));
+
+    // the same pipeline resolved at compile time, sharing the layers' parameters
+    StaticSequential<Linear, ReLU, Linear> fixed(*fc1, ReLU(), *fc2);
+    assert(fixed.parameters().size() == 4);
+    assert(fixed.layer<0>().weight() == fc1->weight());
+    std::vector<int> target = {0, 2, 1, 0};
+    model.zero_grad();
+    model.forward(x)->cross_entropy(target)->backward();
+    Eigen::MatrixXf weight_grad = fc1->weight()->grad();
+    model.zero_grad();
+    auto out = fixed.forward(x);
+    assert(out->data().isApprox(expected));
+    out->cross_entropy(target)->backward();
+    assert(fc1->weight()->grad().isApprox(weight_grad));
+
+    bool threw = false;
+    try {
+        QuantizedSequential::layers_of(nested);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "test_sequential_modules: PASSED" << std::endl;
+}
+
+void test_inference_server() {
+    Sequential model({std::make_shared<Linear>(6, 5), std::make_shared<ReLU>(), std::make_shared<Linear>(5, 3)});
+    Eigen::MatrixXf samples = Eigen::MatrixXf::Random(6, 40);
+    Eigen::MatrixXf expected;
+    {
+        NoGradGuard guard;
+        expected = model.forward(std::make_shared<Tensor>(samples))->data();
+    }
+
+    std::vector<std::future<Eigen::VectorXf>> results(samples.cols());
+    std::vector<Eigen::VectorXf> outputs(samples.cols());
+    {
+        // batches only leave once full, as the delay never runs out, so 40 requests are 5 batches
+        // of 8 whatever the timing of the clients
+        InferenceServer server(model, 6, {.max_batch_size = 8, .max_delay = std::chrono::hours(1)});
+        std::vector<std::thread> clients;
+        for (int c = 0; c < 4; c++) {
+            clients.emplace_back([&, c]() {
+                for (int i = c; i < samples.cols(); i += 4) {
+                    results[i] = server.submit(samples.col(i));
+                }
+            });
+        }
+        for (auto& client : clients) client.join();
+
+        // requests were coalesced, and every one got its own column back
+        for (int i = 0; i < samples.cols(); i++) {
+            outputs[i] = results[i].get();
+            assert(outputs[i].isApprox(expected.col(i)));
+        }
+        assert(server.requests() == samples.cols());
+        assert(server.batches() == samples.cols() / 8);
+
+        bool threw = false;
+        try {
+            server.submit(Eigen::VectorXf::Zero(5));
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+
+        // the destructor serves what is still queued, without waiting out the delay
+        results[0] = server.submit(samples.col(0));
+    }
+    outputs[0] = results[0].get();
+    assert(outputs[0].isApprox(expected.col(0)));
+
+    std::cout << "test_inference_server: PASSED" << std::endl;
+}
+
+void test_profiler() {
+    Sequential model({std::make_shared<Linear>(6, 5), std::make_shared<ReLU>(), std::make_shared<Linear>(5, 3)});
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(6, 4));
+    std::vector<int> target = {0, 2, 1, 0};
+
+    // nothing is recorded without a started profiler
+    Profiler profiler;
+    model.forward(x)->cross_entropy(target)->backward();
+    assert(profiler.events().empty());
+
+    profiler.start();
+    {
+        ProfileScope step("step");
+        model.forward(x)->cross_entropy(target)->backward();
+    }
+    profiler.stop();
+    model.forward(x)->cross_entropy(target)->backward();
+
+    auto events = profiler.events();
+    int forward_linear = 0;
+    int backward_linear = 0;
+    for (const auto& event : events) {
+        std::string name = event.name;
+        if (name == "linear" && event.phase == ProfilePhase::Forward) {
+            forward_linear++;
+            assert(event.flops > 0.0 && event.bytes > 0 && event.num_shapes == 3);
+            if (event.shapes[1][0] == 5) {
+                assert(event.shapes[0][0] == 6 && event.shapes[0][1] == 4);
+                assert(event.flops == 2.0 * 5 * 6 * 4 + 2.0 * 5 * 4);
+            }
+        }
+        if (name == "linear" && event.phase == ProfilePhase::Backward) {
+            backward_linear++;
+        }
+        assert(event.duration_ns >= 0);
+    }
+    assert(forward_linear == 2 && backward_linear == 2);
+    assert(std::string(events.back().name) == "step" && events.back().phase == ProfilePhase::Scope);
+
+    std::ostringstream summary;
+    profiler.print_summary(summary);
+    assert(summary.str().find("cross_entropy") != std::string::npos);
+    std::ostringstream trace;
+    profiler.write_trace(trace);
+    std::string json = trace.str();
+    assert(json.rfind("{\"traceEvents\":[", 0) == 0);
+    assert(std::count(json.begin(), json.end(), '\n') == static_cast<long>(events.size()) + 2);
+
+    // a start that loses to the running profiler leaves its events alone
+    profiler.start();
+    { ProfileScope named("say \"hi\"\\\n"); }
+    Profiler other;
+    bool threw = false;
+    try {
+        other.start();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw && profiler.events().size() == 1);
+
+    // names are escaped in the trace
+    std::ostringstream escaped;
+    profiler.write_trace(escaped);
+    assert(escaped.str().find("\"name\":\"say \\\"hi\\\"\\\\\\n\"") != std::string::npos);
+
+    // stop waits for a scope still open on another thread, and refuses to run inside its own
+    std::atomic<bool> opened{false};
+    std::thread worker([&]() {
+        ProfileScope slow("slow");
+        opened = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    });
+    while (!opened) std::this_thread::yield();
+    threw = false;
+    {
+        ProfileScope outer("outer");
+        try {
+            profiler.stop();
+        } catch (const std::logic_error&) {
+            threw = true;
+        }
+    }
+    assert(threw);
+    profiler.stop();
+    // the named scope, outer and slow
+    assert(profiler.events().size() == 3);
+    worker.join();
+
+    // destroying a running profiler deactivates it too, after the other threads' scopes close
+    std::thread late;
+    {
+        Profiler scoped;
+        scoped.start();
+        opened = false;
+        late = std::thread([&]() {
+            ProfileScope slow("slow");
+            opened = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+        while (!opened) std::this_thread::yield();
+    }
+    assert(Profiler::active() == nullptr);
+    late.join();
+
+    std::cout << "test_profiler: PASSED" << std::endl;
+}
+
+void test_static_graph() {
+    Linear fc1(4, 3);
+    Linear fc2(3, 2);
+    auto params = fc1.parameters();
+    auto fc2_params = fc2.parameters();
+    params.insert(params.end(), fc2_params.begin(), fc2_params.end());
+
+    auto forward = [&](std::shared_ptr<Tensor> x, const std::vector<int>& t) {
+        auto outputs = fc2.forward(fc1.forward(x, Activation::ReLU));
+        return std::vector<std::shared_ptr<Tensor>>{outputs->log_softmax()->nll_loss(t), outputs};
+    };
+
+    auto placeholder = std::make_shared<Tensor>(Eigen::MatrixXf::Zero(4, 5));
+    StaticGraph graph = StaticGraph::capture(placeholder, {0, 0, 0, 0, 0}, forward);
+    assert(graph.num_instructions() == 4);
+
+    Eigen::MatrixXf batch = Eigen::MatrixXf::Random(4, 5);
+    std::vector<int> target = {1, 0, 1, 1, 0};
+
+    for (auto& p : params) p->zero_grad();
+    auto eager = forward(std::make_shared<Tensor>(batch), target);
+    eager[0]->backward();
+    std::vector<Eigen::MatrixXf> eager_grads;
+    for (auto& p : params) eager_grads.push_back(p->grad());
+
+    for (auto& p : params) p->zero_grad();
+    graph.replay(batch, target);
+
+    assert(graph.loss() == eager[0]->data()(0, 0));
+    assert(graph.output(1) == eager[1]->data());
+    for (size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->grad() == eager_grads[i]);
+    }
+
+    std::cout << "test_static_graph: PASSED" << std::endl;
+}
+
+void test_fused_linear() {
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(4, 6), true);
+    auto w = std::make_shared<Tensor>(Eigen::MatrixXf::Random(3, 4), true);
+    auto b = std::make_shared<Tensor>(Eigen::MatrixXf::Random(3, 1), true);
+    auto target = std::make_shared<Tensor>(Eigen::MatrixXf::Random(3, 6));
+
+    auto y = w->matmul(x)->add(b)->relu();
+    y->mse_loss(target)->backward();
+    Eigen::MatrixXf dx = x->grad(), dw = w->grad(), db = b->grad(), dy = y->grad();
+
+    x->zero_grad();
+    w->zero_grad();
+    b->zero_grad();
+    auto out = x->linear(w, b, Activation::ReLU);
+    assert(out->data().isApprox((w->data() * x->data() + b->data().replicate(1, 6)).cwiseMax(0.0f)));
+    out->mse_loss(target)->backward();
+
+    assert(x->grad().isApprox(dx));
+    assert(w->grad().isApprox(dw));
+    assert(b->grad().isApprox(db));
+    assert(b->grad().cols() == 1);
+    // the relu mask is not applied to the output's own grad
+    assert(out->grad().isApprox(dy));
+
+    std::cout << "test_fused_linear: PASSED" << std::endl;
+}
+
+void test_batch_major_layout() {
+    // the same model on a batch-major copy of the batch gives the same loss and grads
+    Sequential model({std::make_shared<Linear>(6, 5), std::make_shared<ReLU>(), std::make_shared<Linear>(5, 3)});
+    Eigen::MatrixXf batch = Eigen::MatrixXf::Random(6, 8);
+    std::vector<int> targets = {0, 1, 2, 2, 1, 0, 1, 2};
+
+    auto x = std::make_shared<Tensor>(batch, true);
+    auto loss = model.forward(x)->log_softmax()->nll_loss(targets);
+    loss->backward();
+    std::vector<Eigen::MatrixXf> expected_grads;
+    for (auto& p : model.parameters()) expected_grads.push_back(p->grad());
+
+    model.zero_grad();
+    auto xt = std::make_shared<Tensor>(batch.transpose(), true);
+    xt->set_layout(Layout::BatchMajor);
+    auto outputs = model.forward(xt);
+    assert(outputs->layout() == Layout::BatchMajor && outputs->rows() == 8 && outputs->batch_size() == 8);
+    auto loss_t = outputs->log_softmax()->nll_loss(targets);
+    loss_t->backward();
+
+    assert(std::abs(loss_t->data()(0, 0) - loss->data()(0, 0)) < 1e-5f);
+    assert(xt->grad().isApprox(x->grad().transpose(), 1e-5f));
+    auto params = model.parameters();
+    for (size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->grad().isApprox(expected_grads[i], 1e-5f));
+    }
+
+    // a single-row operand broadcasts over the batch rows
+    auto bias_row = std::make_shared<Tensor>(Eigen::MatrixXf::Ones(1, 3), true);
+    outputs->add(bias_row)->mse_loss(std::make_shared<Tensor>(Eigen::MatrixXf::Zero(8, 3)))->backward();
+    assert(bias_row->grad().rows() == 1 && bias_row->grad().cols() == 3);
+
+    // static graph replay keeps the captured layout
+    for (auto& p : params) p->zero_grad();
+    StaticGraph graph = StaticGraph::capture(xt, targets,
+        [&](std::shared_ptr<Tensor> in, const std::vector<int>& t) {
+            return std::vector<std::shared_ptr<Tensor>>{model.forward(in)->log_softmax()->nll_loss(t)};
+        });
+    for (auto& p : params) p->zero_grad();
+    graph.replay(batch.transpose(), targets);
+    assert(std::abs(graph.loss() - loss->data()(0, 0)) < 1e-5f);
+    for (size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->grad().isApprox(expected_grads[i], 1e-5f));
+    }
+
+    std::cout << "test_batch_major_layout: PASSED" << std::endl;
+}
+
+void test_cross_entropy() {
+    std::vector<int> targets = {2, 0, 1, 1, 3};
+    for (Layout layout : {Layout::FeatureMajor, Layout::BatchMajor}) {
+        Eigen::MatrixXf logits = layout == Layout::BatchMajor ? Eigen::MatrixXf::Random(5, 4) * 5.0f
+                                                              : Eigen::MatrixXf::Random(4, 5) * 5.0f;
+        auto a = std::make_shared<Tensor>(logits, true);
+        auto b = std::make_shared<Tensor>(logits, true);
+        a->set_layout(layout);
+        b->set_layout(layout);
+
+        auto expected = a->log_softmax()->nll_loss(targets);
+        expected->backward();
+        auto loss = cross_entropy(b, targets);
+        loss->backward();
+
+        assert(std::abs(loss->data()(0, 0) - expected->data()(0, 0)) < 1e-5f);
+        assert(b->grad().isApprox(a->grad(), 1e-5f));
+
+        // replay of a captured cross_entropy matches eager mode
+        StaticGraph graph = StaticGraph::capture(b, targets,
+            [](std::shared_ptr<Tensor> x, const std::vector<int>& t) {
+                return std::vector<std::shared_ptr<Tensor>>{x->cross_entropy(t)};
+            });
+        graph.replay(logits, targets);
+        assert(graph.loss() == loss->data()(0, 0));
+    }
+
+    std::cout << "test_cross_entropy: PASSED" << std::endl;
+}
+
+void test_data_parallel() {
+    Linear model(5, 3);
+    auto loss_fn = [](Linear& m, std::shared_ptr<Tensor> x, const std::vector<int>& t) {
+        auto outputs = m.forward(x);
+        return std::vector<std::shared_ptr<Tensor>>{outputs->log_softmax()->nll_loss(t), outputs};
+    };
+
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(5, 7));
+    std::vector<int> targets = {0, 1, 2, 2, 1, 0, 1};
+
+    model.zero_grad();
+    auto expected = loss_fn(model, inputs, targets);
+    expected[0]->backward();
+    std::vector<Eigen::MatrixXf> expected_grads;
+    for (auto& p : model.parameters()) expected_grads.push_back(p->grad());
+
+    DataParallel<Linear> trainer(model, 3, loss_fn, []() { return std::make_unique<Linear>(5, 3); });
+    float loss = trainer.step(inputs, targets);
+
+    assert(std::abs(loss - expected[0]->data()(0, 0)) < 1e-5f);
+    assert(trainer.outputs().isApprox(expected[1]->data()));
+    auto params = model.parameters();
+    for (size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->grad().isApprox(expected_grads[i], 1e-5f));
+    }
+
+    bool threw = false;
+    try {
+        trainer.step(std::make_shared<Tensor>(Eigen::MatrixXf(5, 0)), {});
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "test_data_parallel: PASSED" << std::endl;
+}
+
+void write_idx(const std::string& path, const std::vector<uint32_t>& header, const std::vector<unsigned char>& payload) {
+    std::ofstream file(path, std::ios::binary);
+    for (uint32_t field : header) {
+        unsigned char be[4] = {static_cast<unsigned char>(field >> 24), static_cast<unsigned char>(field >> 16),
+                               static_cast<unsigned char>(field >> 8), static_cast<unsigned char>(field)};
+        file.write(reinterpret_cast<char*>(be), 4);
+    }
+    file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+}
+
+void test_mnist_dataset() {
+    auto dir = std::filesystem::temp_directory_path();
+    std::string images = (dir / "krykhitgrad-test-images.idx3-ubyte").string();
+    std::string labels = (dir / "krykhitgrad-test-labels.idx1-ubyte").string();
+
+    std::vector<unsigned char> pixels(3 * 2 * 2);
+    for (size_t i = 0; i < pixels.size(); i++) pixels[i] = static_cast<unsigned char>(i * 20);
+    write_idx(images, {0x803, 3, 2, 2}, pixels);
+    write_idx(labels, {0x801, 3}, {7, 1, 4});
+
+    MNISTDataset dataset(images, labels);
+    assert(dataset.size() == 3);
+    assert(dataset.image_size() == 4);
+
+    auto [batch, targets] = dataset.get_batch(2, 1);
+    assert(batch->rows() == 4 && batch->cols() == 2);
+    assert(batch->data()(0, 0) == 80.0f / 255.0f);
+    assert(batch->data()(3, 1) == 220.0f / 255.0f);
+    assert(targets == std::vector<int>({1, 4}));
+
+    auto batch_major = dataset.get_batch(2, 1, Layout::BatchMajor).first;
+    assert(batch_major->layout() == Layout::BatchMajor);
+    assert(batch_major->data() == batch->data().transpose());
+
+    MNISTDataset limited(images, labels, 2);
+    assert(limited.size() == 2);
+
+    std::filesystem::remove(images);
+    std::filesystem::remove(labels);
+
+    std::cout << "test_mnist_dataset: PASSED" << std::endl;
+}
+
+void test_data_loader() {
+    auto dir = std::filesystem::temp_directory_path();
+    std::string images = (dir / "krykhitgrad-loader-images.idx3-ubyte").string();
+    std::string labels = (dir / "krykhitgrad-loader-labels.idx1-ubyte").string();
+
+    // sample i has every pixel equal to i, and label i
+    std::vector<unsigned char> pixels, label_bytes;
+    for (int i = 0; i < 5; i++) {
+        pixels.insert(pixels.end(), 4, static_cast<unsigned char>(i));
+        label_bytes.push_back(static_cast<unsigned char>(i));
+    }
+    write_idx(images, {0x803, 5, 2, 2}, pixels);
+    write_idx(labels, {0x801, 5}, label_bytes);
+    MNISTDataset dataset(images, labels);
+
+    auto collect = [&](DataLoaderOptions options, int epochs) {
+        DataLoader loader(dataset, options);
+        std::vector<std::vector<int>> batches;
+        for (int e = 0; e < epochs; e++) {
+            while (const auto* batch = loader.next()) {
+                for (int j = 0; j < batch->inputs->cols(); j++) {
+                    assert(batch->inputs->data()(0, j) * 255.0f == static_cast<float>(batch->targets[j]));
+                }
+                batches.push_back(batch->targets);
+            }
+        }
+        return batches;
+    };
+
+    auto prefetched = collect({.batch_size = 2, .seed = 7, .prefetch = 2}, 2);
+    assert(prefetched.size() == 6);
+    assert(prefetched == collect({.batch_size = 2, .seed = 7, .prefetch = 0}, 2));
+
+    std::vector<int> seen;
+    for (int b = 0; b < 3; b++) seen.insert(seen.end(), prefetched[b].begin(), prefetched[b].end());
+    std::sort(seen.begin(), seen.end());
+    assert(seen == std::vector<int>({0, 1, 2, 3, 4}));
+
+    auto dropped = collect({.batch_size = 2, .shuffle = false, .drop_last = true}, 1);
+    assert(dropped == std::vector<std::vector<int>>({{0, 1}, {2, 3}}));
+
+    std::filesystem::remove(images);
+    std::filesystem::remove(labels);
+
+    std::cout << "test_data_loader: PASSED" << std::endl;
+}
+
+void test_no_grad() {
+    Linear layer(4, 3);
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(4, 5));
+    auto tracked = layer.forward(x, Activation::ReLU)->log_softmax();
+    assert(tracked->requires_grad() && !tracked->prev().empty());
+
+    std::shared_ptr<Tensor> untracked;
+    {
+        NoGradGuard no_grad;
+        assert(!grad_enabled());
+        {
+            NoGradGuard nested;
+        }
+        assert(!grad_enabled());
+
+        untracked = layer.forward(x, Activation::ReLU)->log_softmax();
+        assert(!untracked->requires_grad());
+        assert(untracked->prev().empty());
+        assert(untracked->grad().size() == 0);
+        assert(untracked->data() == tracked->data());
+
+        auto untracked_loss = untracked->nll_loss({0, 1, 2, 0, 1});
+        bool threw = false;
+        try {
+            untracked_loss->backward();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+
+        // in-place ops keep writing into the same buffer
+        auto logits = layer.forward(x);
+        const float* buffer = logits->data().data();
+        auto probs = logits->relu_()->log_softmax_();
+        assert(probs == logits && probs->data().data() == buffer);
+        assert(probs->data() == tracked->data());
+    }
+    assert(grad_enabled());
+
+    bool threw = false;
+    try {
+        std::make_shared<Tensor>(Eigen::MatrixXf::Ones(1, 1))->backward();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    threw = false;
+    try {
+        layer.forward(x)->relu_();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // an input without grad is still saved by the nodes that read it, so overwriting it
+    // in place makes backward throw rather than return grads of the new values
+    auto input = std::make_shared<Tensor>(Eigen::MatrixXf::Random(4, 5));
+    auto target = std::make_shared<Tensor>(Eigen::MatrixXf::Zero(3, 5));
+    auto loss = input->linear(layer.parameters()[0], layer.parameters()[1])->mse_loss(target);
+    input->relu_();
+    threw = false;
+    try {
+        loss->backward();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::cout << "test_no_grad: PASSED" << std::endl;
+}
+
+void test_checkpoint() {
+    std::string path = (std::filesystem::temp_directory_path() / "krykhitgrad-test.ckpt").string();
+    auto make_model = []() {
+        return Sequential({std::make_shared<Linear>(5, 4), std::make_shared<ReLU>(), std::make_shared<Linear>(4, 3)});
+    };
+    auto x = std::make_shared<Tensor>(Eigen::MatrixXf::Random(5, 6));
+    std::vector<int> target = {0, 1, 2, 0, 1, 2};
+    auto train_step = [&](Sequential& model, Optimizer& optimizer) {
+        optimizer.zero_grad();
+        model.forward(x)->log_softmax()->nll_loss(target)->backward();
+        optimizer.step();
+    };
+
+    Sequential model = make_model();
+    Adam optimizer(model.parameters(), 0.01f);
+    train_step(model, optimizer);
+    train_step(model, optimizer);
+    Checkpoint::save(path, model.parameters(), &optimizer);
+    Eigen::MatrixXf saved_weight = model.parameters()[0]->data();
+
+    // resuming from the checkpoint continues exactly where the original left off
+    Sequential resumed = make_model();
+    Adam resumed_optimizer(resumed.parameters(), 0.01f);
+    Checkpoint checkpoint(path);
+    assert(checkpoint.num_tensors() == 4 && checkpoint.has_optimizer_state());
+    checkpoint.load(resumed.parameters(), &resumed_optimizer);
+    assert(resumed_optimizer.steps() == 2);
+    train_step(model, optimizer);
+    train_step(resumed, resumed_optimizer);
+    auto params = model.parameters();
+    auto resumed_params = resumed.parameters();
+    for (std::size_t i = 0; i < params.size(); i++) {
+        assert(params[i]->data() == resumed_params[i]->data());
+    }
+
+    // zero-copy: the weights are views into the mapping, which outlives the Checkpoint
+    Sequential mapped = make_model();
+    {
+        Checkpoint reopened(path);
+        reopened.map(mapped.parameters());
+    }
+    Checkpoint copied(path);
+    Sequential reference = make_model();
+    copied.load(reference.parameters());
+    auto mapped_params = mapped.parameters();
+    auto reference_params = reference.parameters();
+    for (std::size_t i = 0; i < mapped_params.size(); i++) {
+        assert(reinterpret_cast<std::uintptr_t>(mapped_params[i]->data().data()) % 64 == 0);
+        assert(mapped_params[i]->data() == reference_params[i]->data());
+    }
+    {
+        NoGradGuard no_grad;
+        assert(mapped.forward(x)->data().isApprox(reference.forward(x)->data(), 1e-5f));
+    }
+
+    // writes to mapped weights stay private to the process
+    mapped_params[0]->data().setZero();
+    Checkpoint(path).load(reference.parameters());
+    assert(reference_params[0]->data() == saved_weight);
+
+    bool threw = false;
+    try {
+        Sequential wrong({std::make_shared<Linear>(5, 4)});
+        Checkpoint(path).load(wrong.parameters());
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    std::filesystem::remove(path);
+
+    std::cout << "test_checkpoint: PASSED" << std::endl;
+}
+
+void test_quantized_linear() {
+    // the simd gemm matches a scalar reference, including the tail of an odd depth
+    const int rows = 5, depth = 37, cols = 3;
+    std::vector<std::int16_t> w(rows * depth);
+    std::vector<std::int8_t> x(depth * cols);
+    for (int i = 0; i < rows * depth; i++) w[i] = static_cast<std::int16_t>(i * 37 % 255 - 127);
+    for (int i = 0; i < depth * cols; i++) x[i] = static_cast<std::int8_t>(i * 91 % 255 - 127);
+    std::vector<std::int32_t> out(rows * cols);
+    kernels::gemm_s8(w.data(), x.data(), rows, depth, cols, out.data());
+    for (int j = 0; j < cols; j++) {
+        for (int i = 0; i < rows; i++) {
+            std::int32_t expected = 0;
+            for (int k = 0; k < depth; k++) expected += w[i * depth + k] * x[j * depth + k];
+            assert(out[j * rows + i] == expected);
+        }
+    }
+
+    // the simd body and the scalar tail saturate out-of-range values and map NaN to 0 alike
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> special = {nan, inf, -inf, 1e10f, -1e10f, 3e9f, 126.6f, -127.4f};
+    std::vector<float> values(16 + special.size());
+    std::copy(special.begin(), special.end(), values.begin());
+    std::copy(special.begin(), special.end(), values.begin() + 16);
+    std::vector<std::int8_t> quantized_values(values.size());
+    kernels::quantize_s8(values.data(), 1.0f, values.size(), quantized_values.data());
+    const std::int8_t saturated[] = {0, 127, -127, 127, -127, 127, 127, -127};
+    for (std::size_t i = 0; i < special.size(); i++) {
+        assert(quantized_values[i] == saturated[i] && quantized_values[16 + i] == saturated[i]);
+    }
+
+    Sequential model({std::make_shared<Linear>(20, 16), std::make_shared<ReLU>(), std::make_shared<Linear>(16, 5)});
+    auto inputs = std::make_shared<Tensor>(Eigen::MatrixXf::Random(20, 64));
+    // calibrated on the evaluated batch too, so no activation saturates
+    std::vector<std::shared_ptr<Tensor>> calibration = {inputs};
+    for (int b = 0; b < 4; b++) {
+        calibration.push_back(std::make_shared<Tensor>(Eigen::MatrixXf::Random(20, 32)));
+    }
+    QuantizedSequential quantized(QuantizedSequential::layers_of(model), calibration);
+    assert(quantized.layers().size() == 2 && quantized.layers()[0].weight_bytes() == 20 * 16);
+
+    NoGradGuard no_grad;
+    Eigen::MatrixXf expected = model.forward(inputs)->data();
+    auto result = quantized.forward(inputs);
+    assert(!result->requires_grad());
+
+    // int8 error stays within a few quantization steps of the output range
+    float range = expected.cwiseAbs().maxCoeff();
+    assert((result->data() - expected).cwiseAbs().maxCoeff() < 0.05f * range);
+
+    std::cout << "test_quantized_linear: PASSED" << std::endl;
+}
+
 int main() {
     std::cout << "running tests for krykhitgrad..." << std::endl;
 
     test_basic_operations();
     test_simple_network();
     test_optimization();
+    test_optimizers();
+    test_flat_parameters();
+    test_tape();
+    test_backward_order();
+    test_memory_planner();
+    test_checkpoint_segments();
+    test_sequential_modules();
+    test_static_graph();
+    test_fused_linear();
+    test_batch_major_layout();
+    test_cross_entropy();
+    test_data_parallel();
+    test_mnist_dataset();
+    test_data_loader();
+    test_no_grad();
+    test_checkpoint();
+    test_quantized_linear();
+    test_inference_server();
+    test_profiler();
+    test_scalar_tape();
+    test_value_program();
+    test_buffer_pool();
+    test_lazy_elementwise();
+    test_conv2d();
+    test_pool2d();
 
     std::cout << "all tests passed!" << std::endl;
     return 0;